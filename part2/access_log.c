@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "access_log.h"
+
+#define LINE_MAX_LEN 1024
+#define PATH_LOG_MAX 512 // longer request targets are cut short in the log
+
+static access_log_ring_t *rings = NULL;
+static int n_rings = 0;
+static int log_fd = -1;
+static int flush_interval_ms;
+static pthread_t writer;
+static int writer_started = 0;
+static unsigned long stopped_dropped = 0; // drop count once the rings are freed
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wakeup = PTHREAD_COND_INITIALIZER;
+static int stopping = 0;
+
+// Ring of the calling worker, NULL for threads that don't log
+static __thread access_log_ring_t *my_ring = NULL;
+
+// The timestamp only changes once a second, so format it once per second
+static __thread time_t cached_second = -1;
+static __thread char cached_time[32];
+
+static const char *timestamp(void) {
+    time_t now = time(NULL);
+    if (now != cached_second) {
+        struct tm local;
+        localtime_r(&now, &local);
+        strftime(cached_time, sizeof(cached_time), "%d/%b/%Y:%H:%M:%S %z", &local);
+        cached_second = now;
+    }
+    return cached_time;
+}
+
+// writev every iovec, in IOV_MAX sized batches and across partial writes
+// Returns 0 on success or -1 on error
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("writev");
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Write out everything the workers have logged so far in a single writev
+static void drain_rings(void) {
+    struct iovec *iov = malloc(2 * n_rings * sizeof(struct iovec));
+    size_t *heads = malloc(n_rings * sizeof(size_t));
+    if (iov == NULL || heads == NULL) {
+        perror("malloc");
+        free(iov);
+        free(heads);
+        return;
+    }
+
+    int iovcnt = 0;
+    for (int i = 0; i < n_rings; i++) {
+        access_log_ring_t *ring = &rings[i];
+        // acquire pairs with the worker's release, the bytes are complete
+        heads[i] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t start = ring->tail & (ACCESS_LOG_RING_SIZE - 1);
+        size_t len = heads[i] - ring->tail;
+        if (len == 0) {
+            continue;
+        }
+        // at most two pieces when the pending bytes wrap around the end
+        size_t first = ACCESS_LOG_RING_SIZE - start < len ? ACCESS_LOG_RING_SIZE - start : len;
+        iov[iovcnt].iov_base = ring->buf + start;
+        iov[iovcnt].iov_len = first;
+        iovcnt++;
+        if (first < len) {
+            iov[iovcnt].iov_base = ring->buf;
+            iov[iovcnt].iov_len = len - first;
+            iovcnt++;
+        }
+    }
+
+    if (iovcnt > 0) {
+        // on a write error the batch is lost, the workers must not stall
+        writev_all(log_fd, iov, iovcnt);
+        for (int i = 0; i < n_rings; i++) {
+            __atomic_store_n(&rings[i].tail, heads[i], __ATOMIC_RELEASE);
+        }
+    }
+    free(iov);
+    free(heads);
+}
+
+static void *writer_func(void *arg) {
+    pthread_mutex_lock(&writer_lock);
+    while (!stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flush_interval_ms / 1000;
+        deadline.tv_nsec += (flush_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&writer_wakeup, &writer_lock, &deadline);
+        if (stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&writer_lock);
+        drain_rings();
+        pthread_mutex_lock(&writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+
+    // final flush, the workers have all stopped by now
+    drain_rings();
+    return NULL;
+}
+
+int access_log_start(const char *path, int ring_count, int flush_ms) {
+    if (strcmp(path, "-") == 0) {
+        log_fd = STDOUT_FILENO;
+    } else {
+        log_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (log_fd == -1) {
+            perror("open");
+            return -1;
+        }
+    }
+
+    rings = calloc(ring_count, sizeof(access_log_ring_t));
+    if (rings == NULL) {
+        perror("calloc");
+        access_log_stop();
+        return -1;
+    }
+    n_rings = ring_count;
+    for (int i = 0; i < n_rings; i++) {
+        rings[i].buf = malloc(ACCESS_LOG_RING_SIZE);
+        if (rings[i].buf == NULL) {
+            perror("malloc");
+            access_log_stop();
+            return -1;
+        }
+    }
+
+    flush_interval_ms = flush_ms;
+    int result;
+    if ((result = pthread_create(&writer, NULL, writer_func, NULL)) != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(result));
+        access_log_stop();
+        return -1;
+    }
+    writer_started = 1;
+    return 0;
+}
+
+int access_log_enabled(void) {
+    return rings != NULL;
+}
+
+void access_log_attach(int id) {
+    if (rings != NULL && id >= 0 && id < n_rings) {
+        my_ring = &rings[id];
+    }
+}
+
+void access_log_request(const char *peer, const http_request_t *request, int status, size_t bytes,
+                        long long latency_us) {
+    access_log_ring_t *ring = my_ring;
+    if (ring == NULL) {
+        return;
+    }
+
+    char line[LINE_MAX_LEN];
+    int len;
+    if (request != NULL) {
+        int path_len = request->path.len < PATH_LOG_MAX ? request->path.len : PATH_LOG_MAX;
+        len = snprintf(line, sizeof(line), "%s - - [%s] \"%.*s %.*s %.*s\" %d %zu %lld\n", peer, timestamp(),
+                       (int) request->method.len, request->method.data, path_len, request->path.data,
+                       (int) request->version.len, request->version.data, status, bytes, latency_us);
+    } else {
+        len = snprintf(line, sizeof(line), "%s - - [%s] \"-\" %d %zu %lld\n", peer, timestamp(),
+                       status, bytes, latency_us);
+    }
+    if (len >= (int) sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    // only this thread moves head, the writer only moves tail forward
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (ACCESS_LOG_RING_SIZE - (head - tail) < (size_t) len) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    size_t start = head & (ACCESS_LOG_RING_SIZE - 1);
+    size_t first = ACCESS_LOG_RING_SIZE - start < (size_t) len ? ACCESS_LOG_RING_SIZE - start : (size_t) len;
+    memcpy(ring->buf + start, line, first);
+    memcpy(ring->buf, line + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+int access_log_stop(void) {
+    int ret_val = 0;
+    if (writer_started) {
+        // let the writer do the final flush
+        pthread_mutex_lock(&writer_lock);
+        stopping = 1;
+        pthread_cond_signal(&writer_wakeup);
+        pthread_mutex_unlock(&writer_lock);
+        int result = pthread_join(writer, NULL);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+            ret_val = -1;
+        }
+        writer_started = 0;
+    }
+    if (rings != NULL) {
+        stopped_dropped = access_log_dropped();
+        for (int i = 0; i < n_rings; i++) {
+            free(rings[i].buf);
+        }
+        free(rings);
+        rings = NULL;
+        n_rings = 0;
+    }
+    if (log_fd != -1 && log_fd != STDOUT_FILENO && close(log_fd) == -1) {
+        perror("close");
+        ret_val = -1;
+    }
+    log_fd = -1;
+    return ret_val;
+}
+
+unsigned long access_log_dropped(void) {
+    if (rings == NULL) {
+        return stopped_dropped;
+    }
+    unsigned long dropped = 0;
+    for (int i = 0; i < n_rings; i++) {
+        dropped += __atomic_load_n(&rings[i].dropped, __ATOMIC_RELAXED);
+    }
+    return dropped;
+}
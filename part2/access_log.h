@@ -0,0 +1,69 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+#include "http.h"
+
+#define ACCESS_LOG_RING_SIZE (256 * 1024) // bytes per worker, a power of two
+#define ACCESS_LOG_DEFAULT_FLUSH_MS 100
+#define ACCESS_LOG_PAD_SIZE 64
+
+// Byte ring owned by one worker thread. The worker is the only producer and
+// the writer thread the only consumer, so head and tail are each written by
+// one side and kept on separate cache lines.
+typedef struct {
+    char *buf;
+    size_t head;           // next byte the worker writes, only it stores
+    char pad0[ACCESS_LOG_PAD_SIZE];
+    size_t tail;           // next byte the writer drains, only it stores
+    char pad1[ACCESS_LOG_PAD_SIZE];
+    unsigned long dropped; // entries that didn't fit, written by the worker
+    char pad2[ACCESS_LOG_PAD_SIZE];
+} access_log_ring_t;
+
+/*
+ * Open the log and start the writer thread. Must be called before any
+ * worker threads start. Without it every other function does nothing.
+ * path: File to append to, or "-" for standard output
+ * n_rings: Number of worker threads that will call access_log_attach
+ * flush_ms: How often the writer drains the rings
+ * Returns 0 on success or -1 on error
+ */
+int access_log_start(const char *path, int n_rings, int flush_ms);
+
+/*
+ * Returns 1 if access_log_start succeeded, 0 otherwise
+ */
+int access_log_enabled(void);
+
+/*
+ * Bind the calling thread to ring 'id' (0 <= id < n_rings). Only one running
+ * thread may use a ring at a time.
+ */
+void access_log_attach(int id);
+
+/*
+ * Queue one Common Log Format line for a request. Never blocks: if the
+ * thread's ring is full, the entry is dropped and counted.
+ * peer: Client address as text
+ * request: The parsed request, or NULL if it could not be parsed
+ * status: Response status code
+ * bytes: Response size in bytes, header included
+ * latency_us: Time taken to answer the request
+ */
+void access_log_request(const char *peer, const http_request_t *request, int status, size_t bytes,
+                        long long latency_us);
+
+/*
+ * Stop the writer thread after a final flush of every ring and close the log.
+ * Call once no worker thread is logging anymore.
+ * Returns 0 on success or -1 on error
+ */
+int access_log_stop(void);
+
+/*
+ * Total number of entries dropped because a ring was full
+ */
+unsigned long access_log_dropped(void);
+
+#endif // ACCESS_LOG_H
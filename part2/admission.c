@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "admission.h"
+#include "http.h"
+#include "metrics.h"
+
+#define UNAVAILABLE_BUFSIZE 128
+#define DRAIN_BUFSIZE 4096
+#define MAX_DRAIN_READS 4
+
+static int max_inflight = 0;   // 0: no limit
+static int queue_wait_ms = -1; // -1: no deadline
+static int inflight = 0;       // shared by every acceptor and worker
+static char unavailable[UNAVAILABLE_BUFSIZE];
+static int unavailable_len = 0;
+
+int admission_init(int max, int wait_ms, int retry_after) {
+    max_inflight = max;
+    queue_wait_ms = wait_ms;
+    // formatted once, shedding has to stay cheap when the server is swamped
+    unavailable_len = http_format_unavailable(unavailable, sizeof(unavailable), retry_after);
+    if (unavailable_len == -1) {
+        fprintf(stderr, "admission_init: Retry-After of %d doesn't fit\n", retry_after);
+        return -1;
+    }
+    return 0;
+}
+
+int admission_queue_wait_ms(void) {
+    return queue_wait_ms;
+}
+
+int admission_enter(void) {
+    if (max_inflight == 0) {
+        return 1;
+    }
+    if (__atomic_add_fetch(&inflight, 1, __ATOMIC_RELAXED) > max_inflight) {
+        __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void admission_leave(void) {
+    if (max_inflight > 0) {
+        __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int admission_expired(long long wait_us) {
+    // whole milliseconds, like the deadline, so a deadline of 0 still
+    // serves connections a worker took right away
+    return queue_wait_ms >= 0 && wait_us / 1000 > queue_wait_ms;
+}
+
+void admission_shed(int fd, int reason) {
+    // A fresh socket's send buffer always has room for the response, and a
+    // client that can't take it right away isn't worth waiting for. Closing
+    // with the request still unread would reset the connection, which can
+    // destroy the 503 before the client reads it, so discard what has
+    // arrived and only then close.
+    if (send(fd, unavailable, unavailable_len, MSG_DONTWAIT | MSG_NOSIGNAL) == unavailable_len) {
+        shutdown(fd, SHUT_WR);
+        char discard[DRAIN_BUFSIZE];
+        for (int i = 0; i < MAX_DRAIN_READS && recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0; i++) {
+        }
+    }
+    if (close(fd) == -1) {
+        perror("close");
+    }
+    metrics_record_shed(reason);
+}
@@ -0,0 +1,61 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#define ADMISSION_DEFAULT_RETRY_AFTER 1 // seconds
+
+// Admission control decides whether a new connection gets served or is
+// turned away. Without it the acceptor blocks whenever the connection
+// queue is full, and new clients wait in the kernel's listen backlog with
+// no answer until they time out. With a limit on connections in flight or a
+// queue wait deadline configured, the acceptor never waits longer than the
+// deadline. Connections over either limit get a pre-built 503 with
+// Retry-After and are closed, and each one is counted by reason in the
+// metrics (see METRICS_SHED_*).
+
+/*
+ * Configure admission control. Must be called before any thread accepts.
+ * max_inflight: Most connections accepted and not yet finished by a
+ *               worker, 0 for no limit
+ * queue_wait_ms: Longest a connection may wait for a worker, both for room
+ *                in the connection queue and in the queue itself, or -1 to
+ *                wait for as long as it takes
+ * retry_after: Seconds the 503 asks clients to wait before retrying
+ * Returns 0 on success or -1 on error
+ */
+int admission_init(int max_inflight, int queue_wait_ms, int retry_after);
+
+/*
+ * Returns how long an acceptor may wait for room in the connection queue,
+ * -1 for as long as it takes
+ */
+int admission_queue_wait_ms(void);
+
+/*
+ * Count a new connection in flight.
+ * Returns 1 if it may be served, or 0 if it is over the limit, in which
+ * case it is not counted and should be passed to admission_shed
+ */
+int admission_enter(void);
+
+/*
+ * A connection counted by admission_enter is done: closed, or parked where
+ * it costs no worker until its next request.
+ */
+void admission_leave(void);
+
+/*
+ * Check the time a worker's connection spent in the queue.
+ * wait_us: As returned by metrics_connection_dequeued
+ * Returns 1 if it waited past the deadline and should be shed, 0 otherwise
+ */
+int admission_expired(long long wait_us);
+
+/*
+ * Send the pre-built 503 without blocking, close the connection and count
+ * it. The connection must not be counted in flight anymore.
+ * fd: The client socket
+ * reason: One of METRICS_SHED_*
+ */
+void admission_shed(int fd, int reason);
+
+#endif // ADMISSION_H
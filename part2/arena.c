@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+static arena_chunk_t *chunk_create(size_t size) {
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+int arena_init(arena_t *arena, size_t chunk_size) {
+    arena->chunk_size = chunk_size;
+    arena->used = 0;
+    arena->stats.reserved = chunk_size;
+    arena->stats.high_water = 0;
+    arena->stats.overflows = 0;
+    arena->stats.resets = 0;
+    arena->head = chunk_create(chunk_size);
+    return arena->head == NULL ? -1 : 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+    arena_chunk_t *chunk = arena->head;
+    if (size > chunk->size - chunk->used) {
+        // oversized requests get a chunk of their own
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        if ((chunk = chunk_create(chunk_size)) == NULL) {
+            return NULL;
+        }
+        if (arena->head->next == NULL) {
+            arena->stats.overflows++; // the first extra chunk of this request
+        }
+        chunk->next = arena->head;
+        arena->head = chunk;
+        arena->stats.reserved += chunk_size;
+    }
+    void *memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    return memory;
+}
+
+void arena_reset(arena_t *arena) {
+    if (arena->used > arena->stats.high_water) {
+        arena->stats.high_water = arena->used;
+    }
+    arena->used = 0;
+    arena->stats.resets++;
+    // the first chunk is the last in the list
+    while (arena->head->next != NULL) {
+        arena_chunk_t *older = arena->head->next;
+        arena->stats.reserved -= arena->head->size;
+        free(arena->head);
+        arena->head = older;
+    }
+    arena->head->used = 0;
+}
+
+void arena_free(arena_t *arena) {
+    while (arena->head != NULL) {
+        arena_chunk_t *older = arena->head->next;
+        free(arena->head);
+        arena->head = older;
+    }
+    arena->stats.reserved = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_CHUNK (128 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+    struct arena_chunk *next; // older chunk
+    size_t size;              // bytes of data
+    size_t used;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_chunk_t;
+
+typedef struct {
+    size_t reserved;   // bytes of chunks held, the first one stays between resets
+    size_t high_water; // most bytes one request (reset to reset) has used
+    unsigned long overflows; // requests that outgrew the first chunk
+    unsigned long resets;    // requests served, allocations before the last one are gone
+} arena_stats_t;
+
+// Struct representing a bump allocator for per-request scratch space. A
+// worker owns one and resets it when a request is done, which frees
+// everything allocated from it at once. Allocating is a pointer bump in the
+// current chunk with no locking, so an arena must only be used by the
+// thread that owns it. Requests that need more than a chunk get extra
+// chunks, which are given back by the next reset.
+typedef struct {
+    arena_chunk_t *head; // chunk being allocated from
+    size_t chunk_size;
+    size_t used;         // bytes allocated since the last reset
+    arena_stats_t stats;
+} arena_t;
+
+/*
+ * Initialize an arena and allocate its first chunk.
+ * arena: Pointer to arena_t to be initialized
+ * chunk_size: Size of the chunk kept between requests, ARENA_DEFAULT_CHUNK
+ *             unless requests are known to need more
+ * Returns 0 on success or -1 on error
+ */
+int arena_init(arena_t *arena, size_t chunk_size);
+
+/*
+ * Allocate 'size' bytes aligned to ARENA_ALIGN, valid until the next
+ * arena_reset. The memory is not zeroed.
+ * Returns the memory, or NULL on error
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Free everything allocated since the last reset and update the high-water
+ * mark. Chunks beyond the first are returned to the system.
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ * Free every chunk. The arena must be initialized again before reuse.
+ */
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,53 @@
+#! /bin/bash
+
+# Benchmark one or more http_server builds over the same server_files/ corpus
+# with identical load, one after another, and compare their throughput.
+#
+# Usage: ./bench_compare.sh <http_server> [<http_server> ...] [-- loadgen args]
+# Environment: PORT (default 8000), SERVER_ARGS passed to every server,
+#              SERVE_DIR (default server_files)
+
+PORT=${PORT:-8000}
+SERVE_DIR=${SERVE_DIR:-server_files}
+
+servers=( )
+while [ $# -gt 0 ] && [ "$1" != "--" ]
+do
+    servers+=("$1")
+    shift
+done
+shift
+loadgen_args=("$@")
+
+if [ ${#servers[@]} -eq 0 ]
+then
+    echo "Usage: $0 <http_server> [<http_server> ...] [-- loadgen args]"
+    exit 1
+fi
+
+throughputs=( )
+for server in ${servers[@]}
+do
+    echo "== $server $SERVER_ARGS"
+    $server $SERVER_ARGS $SERVE_DIR $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    ./loadgen -D $SERVE_DIR ${loadgen_args[@]} localhost $PORT | tee bench_output.txt
+    throughputs+=($(awk '/^throughput:/ { print $2 }' bench_output.txt))
+    rm -f bench_output.txt
+
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo
+done
+
+if [ ${#servers[@]} -gt 1 ]
+then
+    base=${throughputs[0]}
+    for i in ${!servers[@]}
+    do
+        awk -v name="${servers[$i]}" -v rps="${throughputs[$i]}" -v base="$base" \
+            'BEGIN { printf "%-40s %10.1f req/s  %+6.1f%%\n", name, rps, base > 0 ? (rps / base - 1) * 100 : 0 }'
+    done
+fi
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compress.h"
+
+// Bodies are compressed once and then served from the cache many times, so
+// the levels lean towards size over speed
+#define GZIP_LEVEL 9
+#define BROTLI_QUALITY 9
+#define GZIP_WINDOW_BITS (15 + 16) // 32K window, gzip wrapper
+
+const char *compress_encoding_name(int encoding) {
+    switch (encoding) {
+    case ENCODING_GZIP:
+        return "gzip";
+    case ENCODING_BR:
+        return "br";
+    default:
+        return "identity";
+    }
+}
+
+const char *compress_suffix(int encoding) {
+    switch (encoding) {
+    case ENCODING_GZIP:
+        return ".gz";
+    case ENCODING_BR:
+        return ".br";
+    default:
+        return "";
+    }
+}
+
+int compress_available(int encoding) {
+#ifdef HAVE_BROTLI
+    return encoding == ENCODING_GZIP || encoding == ENCODING_BR;
+#else
+    return encoding == ENCODING_GZIP;
+#endif
+}
+
+static int has_suffix(const char *str, const char *suffix) {
+    size_t len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+int compress_eligible(const char *content_type) {
+    return strncmp(content_type, "text/", 5) == 0 || has_suffix(content_type, "+xml") ||
+           has_suffix(content_type, "+json") || strcmp(content_type, "application/javascript") == 0 ||
+           strcmp(content_type, "application/json") == 0 || strcmp(content_type, "application/wasm") == 0 ||
+           strcmp(content_type, "application/postscript") == 0 || strcmp(content_type, "application/rtf") == 0 ||
+           strcmp(content_type, "application/sql") == 0 || strcmp(content_type, "application/x-tex") == 0 ||
+           strcmp(content_type, "application/x-latex") == 0 || strcmp(content_type, "image/bmp") == 0 ||
+           strcmp(content_type, "image/x-icon") == 0 || strcmp(content_type, "font/ttf") == 0 ||
+           strcmp(content_type, "font/otf") == 0;
+}
+
+static int compress_gzip(const char *in, size_t in_len, char **out, size_t *out_len) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int result = deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK) {
+        fprintf(stderr, "deflateInit2: %s\n", zError(result));
+        return -1;
+    }
+    size_t bound = deflateBound(&stream, in_len);
+    char *buf = malloc(bound);
+    if (buf == NULL) {
+        perror("malloc");
+        deflateEnd(&stream);
+        return -1;
+    }
+    stream.next_in = (Bytef *) in;
+    stream.avail_in = in_len;
+    stream.next_out = (Bytef *) buf;
+    stream.avail_out = bound;
+    result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        fprintf(stderr, "deflate: %s\n", zError(result));
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_len = stream.total_out;
+    return 0;
+}
+
+#ifdef HAVE_BROTLI
+static int compress_brotli(const char *in, size_t in_len, char **out, size_t *out_len) {
+    size_t bound = BrotliEncoderMaxCompressedSize(in_len);
+    if (bound == 0) {
+        fprintf(stderr, "BrotliEncoderMaxCompressedSize: input too large\n");
+        return -1;
+    }
+    char *buf = malloc(bound);
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    size_t len = bound;
+    if (!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, in_len,
+                               (const uint8_t *) in, &len, (uint8_t *) buf)) {
+        fprintf(stderr, "BrotliEncoderCompress failed\n");
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_len = len;
+    return 0;
+}
+#endif
+
+int compress_buffer(int encoding, const char *in, size_t in_len, char **out, size_t *out_len) {
+    switch (encoding) {
+    case ENCODING_GZIP:
+        return compress_gzip(in, in_len, out, out_len);
+#ifdef HAVE_BROTLI
+    case ENCODING_BR:
+        return compress_brotli(in, in_len, out, out_len);
+#endif
+    default:
+        return -1;
+    }
+}
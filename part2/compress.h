@@ -0,0 +1,46 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+// Content codings the server can send. The values double as preference
+// order: when a client accepts several equally, the higher one wins.
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+#define ENCODING_BR 2
+#define COMPRESS_N_ENCODINGS 2 // not counting identity
+
+/*
+ * Returns the Content-Encoding token for an encoding, such as "gzip"
+ */
+const char *compress_encoding_name(int encoding);
+
+/*
+ * Returns the file name suffix of a precompressed sibling, such as ".gz"
+ */
+const char *compress_suffix(int encoding);
+
+/*
+ * Returns 1 if the server can compress bodies with 'encoding' itself, 0 if
+ * it was built without the library (br needs HAVE_BROTLI)
+ */
+int compress_available(int encoding);
+
+/*
+ * Returns 1 if bodies of this MIME type are worth compressing (text and
+ * text-like formats), 0 for types that are already compressed
+ */
+int compress_eligible(const char *content_type);
+
+/*
+ * Compress a whole body in one call
+ * encoding: ENCODING_GZIP or ENCODING_BR
+ * in: The body
+ * in_len: Length of 'in' in bytes
+ * out: Set to a malloc'd buffer holding the compressed body
+ * out_len: Set to the length of *out
+ * Returns 0 on success or -1 on error
+ */
+int compress_buffer(int encoding, const char *in, size_t in_len, char **out, size_t *out_len);
+
+#endif // COMPRESS_H
@@ -1,15 +1,229 @@
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include "connection_queue.h"
 
-int connection_queue_init(connection_queue_t *queue) {
+// Deque owned by the calling worker in work-stealing mode
+static __thread int steal_worker_id = -1;
 
+// Lock-free ring helpers, used when queue->ring != NULL
+
+static void futex_wait(int *addr, int expected, const struct timespec *timeout) {
+    // returns immediately with EAGAIN if *addr already changed
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+static long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+static void futex_wake(int *addr, int n_waiters) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n_waiters, NULL, NULL, 0);
+}
+
+// Returns 0 on success or -1 if the ring is full
+static int ring_try_enqueue(connection_queue_t *queue, int connection_fd) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    connection_ring_cell_t *cell;
+    while (1) {
+        cell = &queue->ring[pos & queue->ring_mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) seq - (long) pos;
+        if (diff == 0) {
+            // slot is free for this position, try to claim it
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // slot still holds an item from one lap ago
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->fd = connection_fd;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Returns the dequeued fd or -1 if the ring is empty
+static int ring_try_dequeue(connection_queue_t *queue) {
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    connection_ring_cell_t *cell;
+    while (1) {
+        cell = &queue->ring[pos & queue->ring_mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) seq - (long) (pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    int connection_fd = cell->fd;
+    // hand the slot to the producer one lap ahead
+    __atomic_store_n(&cell->sequence, pos + queue->ring_mask + 1, __ATOMIC_RELEASE);
+    return connection_fd;
+}
+
+// Wake one thread sleeping on 'seq' if any registered as a waiter. The
+// seq_cst fence pairs with the one in ring_block so a waiter either sees our
+// update to the ring or we see it in 'waiters'.
+static void ring_signal(int *seq, int *waiters) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(seq, 1);
+    }
+}
+
+// timeout_ms < 0 waits forever
+static int ring_enqueue(connection_queue_t *queue, int connection_fd, int timeout_ms) {
+    long deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : 0;
+    while (ring_try_enqueue(queue, connection_fd) == -1) {
+        struct timespec remaining;
+        if (timeout_ms >= 0) {
+            long left = deadline - monotonic_ms();
+            if (left <= 0) {
+                return CONNECTION_QUEUE_TIMEOUT;
+            }
+            remaining.tv_sec = left / 1000;
+            remaining.tv_nsec = (left % 1000) * 1000000;
+        }
+
+        // slow path: ring is full, sleep until a consumer frees a slot
+        int seq = __atomic_load_n(&queue->not_full_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&queue->full_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring_try_enqueue(queue, connection_fd) == 0) {
+            __atomic_sub_fetch(&queue->full_waiters, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        if (__atomic_load_n(&queue->shutdown, __ATOMIC_SEQ_CST) == 1) {
+            __atomic_sub_fetch(&queue->full_waiters, 1, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+        futex_wait(&queue->not_full_seq, seq, timeout_ms >= 0 ? &remaining : NULL);
+        __atomic_sub_fetch(&queue->full_waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&queue->shutdown, __ATOMIC_SEQ_CST) == 1) {
+            return -1;
+        }
+    }
+    ring_signal(&queue->not_empty_seq, &queue->empty_waiters);
+    return 0;
+}
+
+// timeout_ms < 0 waits forever
+static int ring_dequeue(connection_queue_t *queue, int timeout_ms) {
+    long deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : 0;
+    int connection_fd;
+    while ((connection_fd = ring_try_dequeue(queue)) == -1) {
+        struct timespec remaining;
+        if (timeout_ms >= 0) {
+            long left = deadline - monotonic_ms();
+            if (left <= 0) {
+                return CONNECTION_QUEUE_TIMEOUT;
+            }
+            remaining.tv_sec = left / 1000;
+            remaining.tv_nsec = (left % 1000) * 1000000;
+        }
+
+        // slow path: ring is empty, sleep until a producer adds something
+        int seq = __atomic_load_n(&queue->not_empty_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&queue->empty_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        connection_fd = ring_try_dequeue(queue);
+        if (connection_fd != -1) {
+            __atomic_sub_fetch(&queue->empty_waiters, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        if (__atomic_load_n(&queue->shutdown, __ATOMIC_SEQ_CST) == 1) {
+            __atomic_sub_fetch(&queue->empty_waiters, 1, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+        futex_wait(&queue->not_empty_seq, seq, timeout_ms >= 0 ? &remaining : NULL);
+        __atomic_sub_fetch(&queue->empty_waiters, 1, __ATOMIC_SEQ_CST);
+        // woken by a shutdown, try once more so nothing is left queued
+    }
+    ring_signal(&queue->not_full_seq, &queue->full_waiters);
+    return connection_fd;
+}
+
+int connection_queue_init_lockfree(connection_queue_t *queue, size_t capacity) {
+    memset(queue, 0, sizeof(connection_queue_t));
+
+    size_t ring_size = 2;
+    while (ring_size < capacity) {
+        ring_size <<= 1;
+    }
+    queue->ring = malloc(ring_size * sizeof(connection_ring_cell_t));
+    if (queue->ring == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    for (size_t i = 0; i < ring_size; i++) {
+        queue->ring[i].sequence = i;
+        queue->ring[i].fd = -1;
+    }
+    queue->ring_mask = ring_size - 1;
+    return 0;
+}
+
+int connection_queue_init_stealing(connection_queue_t *queue, int n_workers, int capacity, int policy) {
+    memset(queue, 0, sizeof(connection_queue_t));
+    queue->steal = malloc(sizeof(steal_queue_t));
+    if (queue->steal == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    if (steal_queue_init(queue->steal, n_workers, capacity, policy) == -1) {
+        free(queue->steal);
+        queue->steal = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int connection_queue_register_worker(connection_queue_t *queue) {
+    if (queue->steal != NULL) {
+        steal_worker_id = steal_queue_register_worker(queue->steal);
+        if (steal_worker_id == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int connection_queue_init(connection_queue_t *queue, int capacity) {
+
+    queue->ring = NULL;
+    queue->steal = NULL;
+    queue->capacity = capacity;
     queue->length = 0;
     queue->read_idx = 0;
     queue->write_idx = 0;
     queue->shutdown = 0;
 
-    for (int i = 0; i<CAPACITY; i++) {
+    queue->client_fds = malloc(capacity * sizeof(int));
+    if (queue->client_fds == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i<capacity; i++) {
         queue->client_fds[i] = -1;
     }
     int result;
@@ -32,7 +246,30 @@ int connection_queue_init(connection_queue_t *queue) {
 }
 
 int connection_enqueue(connection_queue_t *queue, int connection_fd) {
+    return connection_enqueue_timed(queue, connection_fd, -1);
+}
+
+int connection_enqueue_timed(connection_queue_t *queue, int connection_fd, int timeout_ms) {
+    if (queue->ring != NULL) {
+        return ring_enqueue(queue, connection_fd, timeout_ms);
+    }
+    if (queue->steal != NULL) {
+        int result = steal_queue_push(queue->steal, connection_fd, timeout_ms);
+        return result == STEAL_QUEUE_TIMEOUT ? CONNECTION_QUEUE_TIMEOUT : result;
+    }
     int result;
+
+    // condition variables wait against CLOCK_REALTIME by default
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
     
     // grab lock
     if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
@@ -41,8 +278,18 @@ int connection_enqueue(connection_queue_t *queue, int connection_fd) {
     }
 
     // make sure queue isnt full
-    while (queue->length == CAPACITY) {
-        if ((result = pthread_cond_wait(&queue->queue_full, &queue->lock)) != 0) {
+    while (queue->length == queue->capacity) {
+        if (timeout_ms >= 0) {
+            result = pthread_cond_timedwait(&queue->queue_full, &queue->lock, &deadline);
+        } else {
+            result = pthread_cond_wait(&queue->queue_full, &queue->lock);
+        }
+        if (result == ETIMEDOUT) {
+            if (queue->length == queue->capacity && queue->shutdown == 0) {
+                pthread_mutex_unlock(&queue->lock);
+                return CONNECTION_QUEUE_TIMEOUT;
+            }
+        } else if (result != 0) {
             fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
             return -1;
         }
@@ -62,7 +309,7 @@ int connection_enqueue(connection_queue_t *queue, int connection_fd) {
     queue->length++;
 
     // update write_idx
-    if (queue->write_idx == 4) {
+    if (queue->write_idx == queue->capacity - 1) {
         queue->write_idx = 0;
     } else {
         queue->write_idx++;
@@ -84,21 +331,39 @@ int connection_enqueue(connection_queue_t *queue, int connection_fd) {
 }
 
 int connection_dequeue(connection_queue_t *queue) {
+    return connection_dequeue_timed(queue, -1);
+}
+
+int connection_dequeue_timed(connection_queue_t *queue, int timeout_ms) {
+    if (queue->ring != NULL) {
+        return ring_dequeue(queue, timeout_ms);
+    }
+    if (queue->steal != NULL) {
+        return steal_queue_pop(queue->steal, steal_worker_id);
+    }
     int result;
 
+    // condition variables wait against CLOCK_REALTIME by default
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
     // grab the lock
     if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
         fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
         return -1;
     }
 
-    // make sure queue isnt empty
+    // make sure queue isnt empty, after a shutdown what is still queued is
+    // handed out and only an empty queue is an error
     while (queue->length == 0) {
-        if ((result = pthread_cond_wait(&queue->queue_empty, &queue->lock)) != 0) {
-            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
-            return -1;
-        }
-
         // handle shutdown - release lock
         if (queue->shutdown == 1) {
             if ((result = pthread_mutex_unlock(&queue->lock)) != 0) {
@@ -107,6 +372,20 @@ int connection_dequeue(connection_queue_t *queue) {
             }
             return -1;
         }
+        if (timeout_ms >= 0) {
+            result = pthread_cond_timedwait(&queue->queue_empty, &queue->lock, &deadline);
+        } else {
+            result = pthread_cond_wait(&queue->queue_empty, &queue->lock);
+        }
+        if (result == ETIMEDOUT) {
+            if (queue->length == 0 && queue->shutdown == 0) {
+                pthread_mutex_unlock(&queue->lock);
+                return CONNECTION_QUEUE_TIMEOUT;
+            }
+        } else if (result != 0) {
+            fprintf(stderr, "pthread_cond_wait: %s\n", strerror(result));
+            return -1;
+        }
     }
 
     // get the current FD and decrement length
@@ -115,7 +394,7 @@ int connection_dequeue(connection_queue_t *queue) {
     queue->length--;
 
     // update read_idx
-    if (queue->read_idx == 4) {
+    if (queue->read_idx == queue->capacity - 1) {
         queue->read_idx = 0;
     } else {
         queue->read_idx++;
@@ -136,7 +415,36 @@ int connection_dequeue(connection_queue_t *queue) {
     return return_fd;
 }
 
+int connection_queue_length(connection_queue_t *queue) {
+    if (queue->ring != NULL) {
+        size_t dequeue_pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        size_t enqueue_pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        return enqueue_pos > dequeue_pos ? (int) (enqueue_pos - dequeue_pos) : 0;
+    }
+    if (queue->steal != NULL) {
+        int pending = __atomic_load_n(&queue->steal->pending, __ATOMIC_RELAXED);
+        return pending > 0 ? pending : 0;
+    }
+    pthread_mutex_lock(&queue->lock);
+    int length = queue->length;
+    pthread_mutex_unlock(&queue->lock);
+    return length;
+}
+
 int connection_queue_shutdown(connection_queue_t *queue) {
+    if (queue->ring != NULL) {
+        // wake every sleeper, each re-checks shutdown before sleeping again
+        __atomic_store_n(&queue->shutdown, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&queue->not_empty_seq, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&queue->not_full_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&queue->not_empty_seq, INT_MAX);
+        futex_wake(&queue->not_full_seq, INT_MAX);
+        return 0;
+    }
+    if (queue->steal != NULL) {
+        queue->shutdown = 1;
+        return steal_queue_shutdown(queue->steal);
+    }
     queue->shutdown = 1; // stops adding new clients inside thread_func
     int result;
 
@@ -164,6 +472,17 @@ int connection_queue_shutdown(connection_queue_t *queue) {
 }
 
 int connection_queue_free(connection_queue_t *queue) {
+    if (queue->ring != NULL) {
+        free(queue->ring);
+        queue->ring = NULL;
+        return 0;
+    }
+    if (queue->steal != NULL) {
+        int ret_val = steal_queue_free(queue->steal);
+        free(queue->steal);
+        queue->steal = NULL;
+        return ret_val;
+    }
     int result;
     // locking and unlocking theoretically not needed but added just in case
     if ((result = pthread_mutex_lock(&queue->lock)) != 0) {
@@ -190,5 +509,7 @@ int connection_queue_free(connection_queue_t *queue) {
         fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
         return -1;
     }
+    free(queue->client_fds);
+    queue->client_fds = NULL;
     return 0;
 }
@@ -2,13 +2,28 @@
 #define CONNECTION_QUEUE_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include "steal_queue.h"
 
-#define CAPACITY 5
+#define CAPACITY 5 // default capacity
+#define CACHE_LINE_SIZE 64
+
+// Returned by connection_dequeue_timed when nothing arrived in time, and by
+// connection_enqueue_timed when no space opened up in time
+#define CONNECTION_QUEUE_TIMEOUT -2
+
+// One slot of the lock-free ring. 'sequence' tells producers and consumers
+// whose turn it is to use the slot (Vyukov's bounded MPMC queue).
+typedef struct {
+    size_t sequence;
+    int fd;
+} connection_ring_cell_t;
 
 // Struct representing a thread-safe queue data structure
 // The queue stores file descriptors of active client TCP sockets
 typedef struct {
-    int client_fds[CAPACITY];
+    int *client_fds;
+    int capacity;
     int length;
     int read_idx;
     int write_idx;
@@ -17,15 +32,67 @@ typedef struct {
     pthread_mutex_t lock;
     pthread_cond_t queue_full;
     pthread_cond_t queue_empty;
+
+    // Lock-free mode only (see connection_queue_init_lockfree), ring is NULL
+    // for the mutex-based queue above. The hot positions are padded onto
+    // their own cache lines so producers and consumers don't false-share.
+    connection_ring_cell_t *ring;
+    size_t ring_mask;
+    char pad0[CACHE_LINE_SIZE];
+    size_t enqueue_pos;
+    char pad1[CACHE_LINE_SIZE];
+    size_t dequeue_pos;
+    char pad2[CACHE_LINE_SIZE];
+    // futex words, bumped whenever a blocked consumer/producer must re-check
+    int not_empty_seq;
+    int not_full_seq;
+    int empty_waiters;
+    int full_waiters;
+
+    // Work-stealing mode only (see connection_queue_init_stealing)
+    steal_queue_t *steal;
 } connection_queue_t;
 
 /*
  * Initialize a new connection queue.
- * The queue can store at most 'CAPACITY' elements.
+ * The queue can store at most 'capacity' elements.
+ * queue: Pointer to connection_queue_t to be initialized
+ * capacity: Maximum number of elements, CAPACITY unless configured otherwise
+ * Returns 0 on success or -1 on error
+ */
+int connection_queue_init(connection_queue_t *queue, int capacity);
+
+/*
+ * Initialize a new connection queue backed by a lock-free multi-producer
+ * multi-consumer ring instead of a mutex. Enqueue and dequeue only touch a
+ * futex when they have to block on a full or empty ring. All other
+ * connection_queue functions work unchanged on it.
+ * queue: Pointer to connection_queue_t to be initialized
+ * capacity: Minimum number of elements, rounded up to a power of two
+ * Returns 0 on success or -1 on error
+ */
+int connection_queue_init_lockfree(connection_queue_t *queue, size_t capacity);
+
+/*
+ * Initialize a new connection queue made of one deque per worker thread.
+ * Enqueue places each connection on one worker's deque (round-robin or the
+ * least loaded one). Dequeue serves the calling worker's own deque and
+ * steals from the others when it is empty.
  * queue: Pointer to connection_queue_t to be initialized
+ * n_workers: Number of workers that will call connection_queue_register_worker
+ * capacity: Maximum number of elements per worker deque
+ * policy: STEAL_ROUND_ROBIN or STEAL_LEAST_LOADED
  * Returns 0 on success or -1 on error
  */
-int connection_queue_init(connection_queue_t *queue);
+int connection_queue_init_stealing(connection_queue_t *queue, int n_workers, int capacity, int policy);
+
+/*
+ * Called once by each worker thread before its first dequeue. In
+ * work-stealing mode this binds the thread to its own deque. For other
+ * queue types it does nothing.
+ * Returns 0 on success or -1 on error
+ */
+int connection_queue_register_worker(connection_queue_t *queue);
 
 /*
  * Add a new file descriptor to a connection queue. If the queue is full, then
@@ -37,19 +104,46 @@ int connection_queue_init(connection_queue_t *queue);
  */
 int connection_enqueue(connection_queue_t *queue, int connection_fd);
 
+/*
+ * Like connection_enqueue, but gives up if the queue stays full for
+ * 'timeout_ms' milliseconds. A timeout of 0 only adds the descriptor if
+ * there is room right now, a negative one waits forever.
+ * queue: A pointer to the connection_queue_t to add to
+ * connection_fd: The socket file descriptor to add to the queue
+ * Returns 0 on success, CONNECTION_QUEUE_TIMEOUT on timeout, or -1 on error
+ */
+int connection_enqueue_timed(connection_queue_t *queue, int connection_fd, int timeout_ms);
+
 /*
  * Remove a file descriptor from the connection queue. If the queue is empty,
- * then this function blocks until an item becomes available. If the queue is
- * shut down, then no removal from the queue takes place and an error is
- * returned.
+ * then this function blocks until an item becomes available. Once the queue
+ * is shut down, descriptors still in it are handed out as usual, and an
+ * error is returned when it is empty.
  * queue: A pointer to the connection_queue_t to remove from
  * Returns the removed socket file descriptor on success or -1 on error
  */
 int connection_dequeue(connection_queue_t *queue);
 
+/*
+ * Like connection_dequeue, but gives up if the queue stays empty for
+ * 'timeout_ms' milliseconds. A negative timeout waits forever. Not supported
+ * in work-stealing mode, where the timeout is ignored.
+ * queue: A pointer to the connection_queue_t to remove from
+ * Returns the removed socket file descriptor on success,
+ * CONNECTION_QUEUE_TIMEOUT on timeout, or -1 on error
+ */
+int connection_dequeue_timed(connection_queue_t *queue, int timeout_ms);
+
+/*
+ * Number of connections currently waiting in the queue. Lock-free and
+ * work-stealing queues report a snapshot that may already be stale.
+ */
+int connection_queue_length(connection_queue_t *queue);
+
 /*
  * Cleanly shuts down the connection queue. All threads currently blocked on an
- * enqueue or dequeue operation are unblocked and an error is returned to them.
+ * enqueue or dequeue operation are unblocked and an error is returned to them,
+ * unless a dequeue finds a descriptor that is still queued.
  * queue: A pointer to the connection_queue_t to shut down
  * Returns 0 on success or -1 on error
  */
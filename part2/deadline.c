@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // glibc's struct tcp_info lacks the byte counters
+#include "deadline.h"
+#include "metrics.h"
+
+// One wheel and the lock that guards it. Timers being checked by the
+// watchdog are out of the wheel with 'busy' set, and their owner waits on
+// 'checked' before touching them.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t checked;
+    deadline_timer_t *wheel[DEADLINE_WHEEL_SLOTS];
+    long long next_tick; // first tick the watchdog hasn't swept
+} __attribute__((aligned(64))) deadline_shard_t;
+
+static int running = 0;
+static int phase_ms[3];         // timeout by phase, 0 for none
+static unsigned long long min_bytes; // per rate window
+static deadline_shard_t shards[DEADLINE_SHARDS];
+static int next_shard = 0;
+static __thread int thread_shard = -1;
+static pthread_t watchdog;
+static int stop_pipe[2];
+
+static long long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Put a timer in the slot for its expiry. A deadline in a tick already
+// swept goes in the next one to be swept. Caller holds the shard's lock.
+static void wheel_insert(deadline_shard_t *shard, deadline_timer_t *timer) {
+    long long tick = timer->expires_ms / DEADLINE_TICK_MS;
+    if (tick < shard->next_tick) {
+        tick = shard->next_tick;
+    }
+    timer->slot = tick & (DEADLINE_WHEEL_SLOTS - 1);
+    timer->prev = NULL;
+    timer->next = shard->wheel[timer->slot];
+    if (timer->next != NULL) {
+        timer->next->prev = timer;
+    }
+    shard->wheel[timer->slot] = timer;
+}
+
+// Caller holds the shard's lock
+static void wheel_remove(deadline_shard_t *shard, deadline_timer_t *timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        shard->wheel[timer->slot] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+}
+
+void deadline_timer_init(deadline_timer_t *timer, int fd) {
+    memset(timer, 0, sizeof(deadline_timer_t));
+    timer->fd = fd;
+    if (thread_shard == -1) {
+        thread_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % DEADLINE_SHARDS;
+    }
+    timer->shard = thread_shard;
+}
+
+// Lock a timer's shard once the watchdog is done with the timer
+static deadline_shard_t *lock_timer(deadline_timer_t *timer) {
+    deadline_shard_t *shard = &shards[timer->shard];
+    pthread_mutex_lock(&shard->lock);
+    while (timer->busy) {
+        pthread_cond_wait(&shard->checked, &shard->lock);
+    }
+    return shard;
+}
+
+void deadline_arm(deadline_timer_t *timer, int phase) {
+    if (!running) {
+        return;
+    }
+    if (phase_ms[phase] == 0) {
+        deadline_disarm(timer);
+        return;
+    }
+    deadline_shard_t *shard = lock_timer(timer);
+    if (timer->phase != DEADLINE_OFF) {
+        wheel_remove(shard, timer);
+    }
+    timer->phase = phase;
+    timer->expires_ms = now_ms() + phase_ms[phase];
+    timer->sampled = 0;
+    wheel_insert(shard, timer);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void deadline_disarm(deadline_timer_t *timer) {
+    if (!running) {
+        return;
+    }
+    deadline_shard_t *shard = lock_timer(timer);
+    if (timer->phase != DEADLINE_OFF) {
+        wheel_remove(shard, timer);
+        timer->phase = DEADLINE_OFF;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Bytes the peer has sent plus bytes it has acknowledged, which only grow
+// while the connection makes progress in either direction
+// Returns 0 on success or -1 on error
+static int tcp_progress(int fd, unsigned long long *progress) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+        return -1;
+    }
+    *progress = info.tcpi_bytes_received + info.tcpi_bytes_acked;
+    return 0;
+}
+
+// Take a due timer out of the wheel for checking outside the lock, adding
+// it to 'due'. Caller holds the shard's lock.
+static void take(deadline_shard_t *shard, deadline_timer_t *timer, deadline_timer_t **due) {
+    wheel_remove(shard, timer);
+    timer->busy = 1;
+    timer->next = *due;
+    *due = timer;
+}
+
+// Drop a connection that missed its deadline. The owner can't disarm and
+// close the descriptor while the timer is busy, so the reset can't hit a
+// reused descriptor.
+static void expire(deadline_timer_t *timer) {
+    struct linger linger = {1, 0}; // reset rather than flush to a stalled peer
+    setsockopt(timer->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    shutdown(timer->fd, SHUT_RDWR);
+}
+
+// Check the timers taken from 'shard' without its lock: drop late headers,
+// sends that made too little progress over the last window, and everything
+// if 'drain'. Then put the survivors back for another window and let the
+// owners have their timers again.
+static void check_due(deadline_shard_t *shard, deadline_timer_t *due, long long now, int drain) {
+    deadline_timer_t *expired = NULL;
+    deadline_timer_t *kept = NULL;
+    while (due != NULL) {
+        deadline_timer_t *timer = due;
+        due = timer->next;
+        unsigned long long progress;
+        if (drain || timer->phase == DEADLINE_HEADER || tcp_progress(timer->fd, &progress) == -1 ||
+            (timer->sampled && progress - timer->progress < min_bytes)) {
+            expire(timer);
+            timer->next = expired;
+            expired = timer;
+        } else {
+            timer->sampled = 1;
+            timer->progress = progress;
+            timer->next = kept;
+            kept = timer;
+        }
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    while (kept != NULL) {
+        deadline_timer_t *timer = kept;
+        kept = timer->next;
+        timer->busy = 0;
+        timer->expires_ms = now + DEADLINE_RATE_WINDOW_MS;
+        wheel_insert(shard, timer);
+    }
+    for (; expired != NULL; expired = expired->next) {
+        expired->busy = 0;
+        metrics_record_timeout(drain ? METRICS_TIMEOUT_DRAIN
+                               : expired->phase == DEADLINE_HEADER ? METRICS_TIMEOUT_HEADER
+                                                                   : METRICS_TIMEOUT_SEND);
+        expired->phase = DEADLINE_OFF;
+    }
+    pthread_cond_broadcast(&shard->checked);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void deadline_expire_all(void) {
+    if (!running) {
+        return;
+    }
+    for (int i = 0; i < DEADLINE_SHARDS; i++) {
+        deadline_shard_t *shard = &shards[i];
+        deadline_timer_t *due = NULL;
+        pthread_mutex_lock(&shard->lock);
+        for (int slot = 0; slot < DEADLINE_WHEEL_SLOTS; slot++) {
+            while (shard->wheel[slot] != NULL) {
+                take(shard, shard->wheel[slot], &due);
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+        check_due(shard, due, now_ms(), 1);
+    }
+}
+
+static void *watchdog_func(void *arg) {
+    struct pollfd stop;
+    stop.fd = stop_pipe[0];
+    stop.events = POLLIN;
+    while (1) {
+        int n = poll(&stop, 1, DEADLINE_TICK_MS);
+        if (n == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (n > 0) {
+            break;
+        }
+
+        long long now = now_ms();
+        for (int i = 0; i < DEADLINE_SHARDS; i++) {
+            deadline_shard_t *shard = &shards[i];
+            deadline_timer_t *due = NULL;
+            pthread_mutex_lock(&shard->lock);
+            // sweep every tick that has completely passed, so every timer
+            // in it is due unless it is a turn of the wheel ahead. There
+            // may be several ticks if this thread was held up.
+            while (shard->next_tick < now / DEADLINE_TICK_MS) {
+                deadline_timer_t *timer = shard->wheel[shard->next_tick & (DEADLINE_WHEEL_SLOTS - 1)];
+                shard->next_tick++;
+                while (timer != NULL) {
+                    deadline_timer_t *next = timer->next;
+                    if (timer->expires_ms <= now) {
+                        take(shard, timer, &due);
+                    }
+                    timer = next;
+                }
+            }
+            pthread_mutex_unlock(&shard->lock);
+            if (due != NULL) {
+                check_due(shard, due, now, 0);
+            }
+        }
+    }
+    return NULL;
+}
+
+int deadline_start(int header_ms, int send_ms, int min_rate) {
+    if (header_ms == 0 && send_ms == 0) {
+        return 0; // nothing to enforce, timers stay no-ops
+    }
+    phase_ms[DEADLINE_HEADER] = header_ms;
+    phase_ms[DEADLINE_SEND] = send_ms;
+    min_bytes = (unsigned long long) min_rate * DEADLINE_RATE_WINDOW_MS / 1000;
+    if (min_bytes == 0) {
+        min_bytes = 1; // a send that moves nothing at all is stalled
+    }
+    int result;
+    for (int i = 0; i < DEADLINE_SHARDS; i++) {
+        if ((result = pthread_mutex_init(&shards[i].lock, NULL)) != 0) {
+            fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+            return -1;
+        }
+        if ((result = pthread_cond_init(&shards[i].checked, NULL)) != 0) {
+            fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+            return -1;
+        }
+        shards[i].next_tick = now_ms() / DEADLINE_TICK_MS;
+    }
+
+    if (pipe(stop_pipe) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    // the watchdog must never take SIGINT meant for the accept loop
+    sigset_t all_signals;
+    sigset_t old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+    result = pthread_create(&watchdog, NULL, watchdog_func, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (result != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(result));
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+int deadline_stop(void) {
+    if (!running) {
+        return 0;
+    }
+    int return_code = 0;
+    if (write(stop_pipe[1], "x", 1) == -1) {
+        perror("write");
+        return_code = -1;
+    }
+    int result;
+    if ((result = pthread_join(watchdog, NULL)) != 0) {
+        fprintf(stderr, "pthread_join: %s\n", strerror(result));
+        return_code = -1;
+    }
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    running = 0;
+    return return_code;
+}
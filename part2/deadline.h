@@ -0,0 +1,88 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+// Header-read and body-send deadlines for client connections. Workers do
+// blocking I/O, so a peer that trickles its request or stops reading the
+// response would otherwise hold a worker for as long as it likes. Each
+// connection's timer sits in a hashed timer wheel swept by one watchdog
+// thread, and arming or moving a timer is a list operation with no system
+// calls. The wheel is sharded, each thread that initialises timers gets a
+// shard with its own lock, so workers don't contend with each other. An
+// expired connection is reset and shut down from the watchdog, which fails
+// whatever read or write its owner is blocked in, and the owner then closes
+// it as it would a client that hung up.
+// Keep-alive idle waits keep their own timeouts (poll, the reactor and the
+// io_uring link timeout), which only need to be counted here.
+
+#define DEADLINE_TICK_MS 100
+#define DEADLINE_WHEEL_SLOTS 512      // a power of two, 51.2s per turn of the wheel
+#define DEADLINE_SHARDS 16            // wheels, threads beyond this many share them
+#define DEADLINE_RATE_WINDOW_MS 1000  // how often a slow send's progress is checked
+#define DEADLINE_DEFAULT_HEADER_SECS 10
+#define DEADLINE_DEFAULT_SEND_SECS 10
+
+// What a connection is doing, and so which deadline applies
+#define DEADLINE_OFF 0
+#define DEADLINE_HEADER 1 // reading a request header, which must be complete in time
+#define DEADLINE_SEND 2   // sending a response, which must keep making progress
+
+// One connection's timer, owned by whoever is serving the connection
+typedef struct deadline_timer {
+    int fd;
+    int phase;                   // DEADLINE_OFF while not in the wheel
+    long long expires_ms;        // CLOCK_MONOTONIC
+    int shard;                   // wheel the timer lives in, fixed at init
+    int slot;                    // wheel slot while armed
+    int busy;                    // the watchdog is checking it outside the lock
+    int sampled;                 // 'progress' holds a sample from this send
+    unsigned long long progress; // bytes received plus bytes acked by the peer
+    struct deadline_timer *prev;
+    struct deadline_timer *next;
+} deadline_timer_t;
+
+/*
+ * Start the watchdog thread. Must be called before any connection is served,
+ * without it arming a timer does nothing.
+ * header_ms: Time allowed to receive a request header once a request has
+ *            started, 0 for no limit
+ * send_ms: Time a response may take before its progress is checked, 0 for
+ *          no limit. From then on it is dropped as soon as a
+ *          DEADLINE_RATE_WINDOW_MS window delivers less than 'min_rate'
+ * min_rate: Bytes per second a slow response must keep up, at least 1
+ * Returns 0 on success or -1 on error
+ */
+int deadline_start(int header_ms, int send_ms, int min_rate);
+
+/*
+ * Prepare a timer for a newly accepted connection. It goes in the calling
+ * thread's shard, so init it from the thread that will serve the connection.
+ */
+void deadline_timer_init(deadline_timer_t *timer, int fd);
+
+/*
+ * Start the deadline for 'phase' (DEADLINE_HEADER or DEADLINE_SEND) from
+ * now, replacing whatever the timer was armed for.
+ */
+void deadline_arm(deadline_timer_t *timer, int phase);
+
+/*
+ * Take a timer out of the wheel. Must be called before the connection's
+ * descriptor is closed or handed to another thread.
+ */
+void deadline_disarm(deadline_timer_t *timer);
+
+/*
+ * Drop every connection that has a deadline running right now, as if it
+ * had just missed it. Used when a shutdown drain runs out of time, so
+ * whoever is blocked serving one of them gives up at once. Connections in
+ * a phase configured without a limit have no timer and are not reached.
+ */
+void deadline_expire_all(void);
+
+/*
+ * Stop the watchdog thread. Call once no connection is being served.
+ * Returns 0 on success or -1 on error
+ */
+int deadline_stop(void);
+
+#endif // DEADLINE_H
@@ -0,0 +1,387 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "fd_cache.h"
+
+// Anything that can change what a path refers to or what its stat says.
+// Changes made to a symlink's target outside the watched directory are not
+// seen, so serve_dir shouldn't lead out of itself through links.
+// IN_CREATE is for siblings, which count even where there were none.
+#define WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | \
+                      IN_DELETE_SELF | IN_MOVE_SELF | IN_CREATE)
+#define EVENT_BUFSIZE 4096
+
+// FNV-1a, like the file cache
+static unsigned long hash_path(const char *path) {
+    unsigned long hash = 14695981039346656037UL;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211UL;
+    }
+    return hash % FD_CACHE_BUCKETS;
+}
+
+static void siblings_free(fd_cache_sibling_t *siblings) {
+    for (int i = 0; i < COMPRESS_N_ENCODINGS; i++) {
+        if (siblings[i].fd != -1) {
+            close(siblings[i].fd);
+        }
+    }
+    free(siblings);
+}
+
+static void entry_free(fd_cache_entry_t *entry) {
+    if (close(entry->fd) == -1) {
+        perror("close");
+    }
+    if (entry->siblings != NULL) {
+        siblings_free(entry->siblings);
+    }
+    free(entry->path);
+    free(entry);
+}
+
+void fd_cache_release(fd_cache_entry_t *entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        entry_free(entry);
+    }
+}
+
+// Find an entry by path. Caller holds cache->lock.
+static fd_cache_entry_t *find_entry(fd_cache_t *cache, const char *path) {
+    fd_cache_entry_t *entry = cache->buckets[hash_path(path)];
+    while (entry != NULL && strcmp(entry->path, path) != 0) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+static void lru_push_front(fd_cache_t *cache, fd_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = entry;
+    }
+}
+
+static void lru_remove(fd_cache_t *cache, fd_cache_entry_t *entry) {
+    if (entry->lru_prev == NULL) {
+        cache->lru_head = entry->lru_next;
+    } else {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    if (entry->lru_next == NULL) {
+        cache->lru_tail = entry->lru_prev;
+    } else {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+}
+
+// Unlink an entry and drop the cache's reference to it. Caller holds
+// cache->lock.
+static void unlink_entry(fd_cache_t *cache, fd_cache_entry_t *entry) {
+    fd_cache_entry_t **link = &cache->buckets[hash_path(entry->path)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    lru_remove(cache, entry);
+    cache->stats.entries--;
+    fd_cache_release(entry);
+}
+
+// Returns 1 if an event for 'name' concerns the file 'entry_name', that is
+// names the file itself or one of its precompressed siblings
+static int event_concerns(const char *entry_name, const char *name) {
+    size_t len = strlen(entry_name);
+    if (strncmp(entry_name, name, len) != 0) {
+        return 0;
+    }
+    if (name[len] == '\0') {
+        return 1;
+    }
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        if (strcmp(name + len, compress_suffix(encoding)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Drop the entries for 'name' in the directory watched by 'wd', every entry
+// in that directory if 'name' is NULL, or everything if 'wd' is -1. Events
+// name the directory by watch rather than by path, so a file reached through
+// different spellings of its path is still found. Caller holds cache->lock.
+static void invalidate(fd_cache_t *cache, int wd, const char *name) {
+    fd_cache_entry_t *entry = cache->lru_head;
+    while (entry != NULL) {
+        fd_cache_entry_t *next = entry->lru_next;
+        if ((wd == -1 || entry->wd == wd) && (name == NULL || event_concerns(entry->name, name))) {
+            unlink_entry(cache, entry);
+            cache->stats.invalidations++;
+        }
+        entry = next;
+    }
+}
+
+// Read inotify events until fd_cache_free asks the thread to stop
+static void *watcher_func(void *arg) {
+    fd_cache_t *cache = arg;
+    char buf[EVENT_BUFSIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = cache->inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = cache->stop_pipe[0];
+    fds[1].events = POLLIN;
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        ssize_t n = read(cache->inotify_fd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            perror("read");
+            break;
+        }
+
+        pthread_mutex_lock(&cache->lock);
+        cache->generation++;
+        const struct inotify_event *event;
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                invalidate(cache, -1, NULL); // events were lost, trust nothing
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                invalidate(cache, event->wd, NULL);
+            } else if (event->len > 0) {
+                invalidate(cache, event->wd, event->name);
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    // without the watcher nothing can be trusted to stay current
+    pthread_mutex_lock(&cache->lock);
+    invalidate(cache, -1, NULL);
+    cache->max_entries = 0;
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+int fd_cache_init(fd_cache_t *cache, size_t max_entries) {
+    memset(cache, 0, sizeof(fd_cache_t));
+    cache->max_entries = max_entries;
+
+    cache->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (cache->inotify_fd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (pipe(cache->stop_pipe) == -1) {
+        perror("pipe");
+        close(cache->inotify_fd);
+        return -1;
+    }
+    int result;
+    if ((result = pthread_mutex_init(&cache->lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        close(cache->stop_pipe[0]);
+        close(cache->stop_pipe[1]);
+        close(cache->inotify_fd);
+        return -1;
+    }
+    // the watcher must never take SIGINT meant for the accept loop
+    sigset_t all_signals;
+    sigset_t old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+    result = pthread_create(&cache->watcher, NULL, watcher_func, cache);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (result != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(result));
+        pthread_mutex_destroy(&cache->lock);
+        close(cache->stop_pipe[0]);
+        close(cache->stop_pipe[1]);
+        close(cache->inotify_fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Watch the directory 'path' is in
+// Returns the watch descriptor, or -1 on error
+static int watch_directory(fd_cache_t *cache, const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        return inotify_add_watch(cache->inotify_fd, ".", WATCH_EVENTS);
+    }
+    char dir[PATH_MAX];
+    size_t len = slash == path ? 1 : (size_t) (slash - path);
+    if (len >= sizeof(dir)) {
+        return -1;
+    }
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+    // watching a directory twice returns the same descriptor
+    return inotify_add_watch(cache->inotify_fd, dir, WATCH_EVENTS);
+}
+
+int fd_cache_get(fd_cache_t *cache, const char *path, fd_cache_entry_t **entry) {
+    *entry = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    fd_cache_entry_t *cached = find_entry(cache, path);
+    if (cached != NULL) {
+        __atomic_add_fetch(&cached->refcount, 1, __ATOMIC_ACQ_REL);
+        lru_remove(cache, cached);
+        lru_push_front(cache, cached);
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->lock);
+        *entry = cached;
+        return 0;
+    }
+    cache->stats.misses++;
+    unsigned long generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Watch before opening, so a change right after the open is an event
+    // we see. The open happens outside the lock, a slow one doesn't hold up
+    // hits on other files.
+    int wd = watch_directory(cache, path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    fd_cache_entry_t *opened = calloc(1, sizeof(fd_cache_entry_t));
+    if (opened == NULL || (opened->path = strdup(path)) == NULL) {
+        perror("malloc");
+        free(opened);
+        close(fd);
+        return -1;
+    }
+    opened->fd = fd;
+    opened->wd = wd;
+    const char *slash = strrchr(opened->path, '/');
+    opened->name = slash != NULL ? slash + 1 : opened->path;
+    opened->refcount = 1; // the caller's
+    if (fstat(fd, &opened->info) == -1 || !S_ISREG(opened->info.st_mode)) {
+        entry_free(opened);
+        return -1;
+    }
+    *entry = opened;
+
+    // Cache it unless it can't be watched, or events arrived since the miss
+    // and one may have been for this file before it was in the table. Either
+    // way this request still uses the descriptor.
+    pthread_mutex_lock(&cache->lock);
+    if (wd != -1 && cache->generation == generation && cache->max_entries > 0 &&
+        find_entry(cache, path) == NULL) {
+        unsigned long bucket = hash_path(path);
+        opened->hash_next = cache->buckets[bucket];
+        cache->buckets[bucket] = opened;
+        lru_push_front(cache, opened);
+        opened->refcount++;
+        cache->stats.entries++;
+        while (cache->stats.entries > cache->max_entries) {
+            unlink_entry(cache, cache->lru_tail);
+            cache->stats.evictions++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+const fd_cache_sibling_t *fd_cache_get_siblings(fd_cache_entry_t *entry) {
+    fd_cache_sibling_t *siblings = __atomic_load_n(&entry->siblings, __ATOMIC_ACQUIRE);
+    if (siblings != NULL) {
+        return siblings;
+    }
+
+    // look outside the lock, a sibling that changes meanwhile drops the entry
+    fd_cache_sibling_t *found = malloc(COMPRESS_N_ENCODINGS * sizeof(fd_cache_sibling_t));
+    if (found == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        fd_cache_sibling_t *sibling = &found[encoding - 1];
+        char path[PATH_MAX];
+        sibling->fd = -1;
+        if (snprintf(path, sizeof(path), "%s%s", entry->path, compress_suffix(encoding)) >= (int) sizeof(path)) {
+            continue;
+        }
+        sibling->fd = open(path, O_RDONLY | O_CLOEXEC);
+        // one older than the file was left behind by an edit
+        if (sibling->fd != -1 && (fstat(sibling->fd, &sibling->info) == -1 || !S_ISREG(sibling->info.st_mode) ||
+                                  sibling->info.st_mtim.tv_sec < entry->info.st_mtim.tv_sec)) {
+            close(sibling->fd);
+            sibling->fd = -1;
+        }
+    }
+
+    // release pairs with the acquire above, readers see them complete
+    if (!__atomic_compare_exchange_n(&entry->siblings, &siblings, found, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        siblings_free(found); // another worker got there first
+        return siblings;
+    }
+    return found;
+}
+
+int fd_cache_get_stats(fd_cache_t *cache, fd_cache_stats_t *stats) {
+    int result;
+    if ((result = pthread_mutex_lock(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    *stats = cache->stats;
+    if ((result = pthread_mutex_unlock(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int fd_cache_free(fd_cache_t *cache) {
+    int return_code = 0;
+    if (write(cache->stop_pipe[1], "x", 1) == -1) {
+        perror("write");
+        return_code = -1;
+    }
+    int result;
+    if ((result = pthread_join(cache->watcher, NULL)) != 0) {
+        fprintf(stderr, "pthread_join: %s\n", strerror(result));
+        return_code = -1;
+    }
+    while (cache->lru_head != NULL) {
+        unlink_entry(cache, cache->lru_head);
+    }
+    close(cache->stop_pipe[0]);
+    close(cache->stop_pipe[1]);
+    close(cache->inotify_fd);
+    if ((result = pthread_mutex_destroy(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+        return_code = -1;
+    }
+    return return_code;
+}
@@ -0,0 +1,113 @@
+#ifndef FD_CACHE_H
+#define FD_CACHE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "compress.h"
+
+#define FD_CACHE_BUCKETS 1024
+#define FD_CACHE_DEFAULT_ENTRIES 256
+
+// A precompressed sibling of a cached file, its path with the coding's
+// suffix appended (see compress_suffix)
+typedef struct {
+    int fd;           // -1 if there is none, or it is older than the file
+    struct stat info;
+} fd_cache_sibling_t;
+
+// One open file and its stat information, shared by every request for the
+// path until the file changes. Entries are reference counted like file cache
+// entries: the cache owns one reference while the entry is linked and each
+// caller of fd_cache_get owns one, and the descriptor is closed with the
+// last reference, so a file invalidated mid-send keeps its descriptor until
+// the send is done. Bodies are sent by offset (pread, sendfile, splice), so
+// concurrent senders don't disturb each other through the file position.
+typedef struct fd_cache_entry {
+    char *path;
+    const char *name;     // last component of path
+    int fd;
+    struct stat info;     // taken right after the open, current until invalidated
+    int wd;               // inotify watch of the file's directory
+    int refcount;
+    fd_cache_sibling_t *siblings; // by encoding - 1, found and published once
+    struct fd_cache_entry *hash_next;
+    struct fd_cache_entry *lru_prev; // towards most recently used
+    struct fd_cache_entry *lru_next; // towards least recently used
+} fd_cache_entry_t;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;     // entries closed to stay under the limit
+    unsigned long invalidations; // entries dropped on an inotify event
+    size_t entries;
+} fd_cache_stats_t;
+
+// Struct representing a thread-safe LRU cache of open files keyed by path.
+// Instead of a stat per request to notice changes, a watcher thread reads
+// inotify events for the directories of cached files and drops the entries
+// of files that are modified, moved or deleted, or whose precompressed
+// siblings are.
+typedef struct {
+    fd_cache_entry_t *buckets[FD_CACHE_BUCKETS];
+    fd_cache_entry_t *lru_head;
+    fd_cache_entry_t *lru_tail;
+    size_t max_entries;
+    unsigned long generation; // bumped by every batch of events
+    fd_cache_stats_t stats;
+    pthread_mutex_t lock;
+    int inotify_fd;
+    int stop_pipe[2];         // becomes readable when the watcher should exit
+    pthread_t watcher;
+} fd_cache_t;
+
+/*
+ * Initialize a new descriptor cache and start its inotify watcher thread.
+ * cache: Pointer to fd_cache_t to be initialized
+ * max_entries: Most files kept open at once, each costs a descriptor
+ * Returns 0 on success or -1 on error
+ */
+int fd_cache_init(fd_cache_t *cache, size_t max_entries);
+
+/*
+ * Look up a file by path, opening it on a miss. A hit costs a hash lookup
+ * and no system calls.
+ * cache: The cache to look in
+ * path: Path to the file in the server's file system, used as the cache key
+ * entry: Set to a referenced entry on success, holding the open descriptor
+ *        and the file's stat information
+ * Returns 0 on success or -1 if the file does not exist or cannot be opened
+ */
+int fd_cache_get(fd_cache_t *cache, const char *path, fd_cache_entry_t **entry);
+
+/*
+ * Get the precompressed siblings of a file returned by fd_cache_get. They
+ * are opened on the first call for each version of the file, later calls
+ * cost nothing, and an event for a sibling drops the file's entry so the
+ * next request looks again. The descriptors stay open as long as 'entry'.
+ * Returns COMPRESS_N_ENCODINGS siblings indexed by encoding - 1, or NULL on
+ * error
+ */
+const fd_cache_sibling_t *fd_cache_get_siblings(fd_cache_entry_t *entry);
+
+/*
+ * Drop a reference obtained from fd_cache_get. The entry and its descriptor
+ * must not be used afterwards.
+ */
+void fd_cache_release(fd_cache_entry_t *entry);
+
+/*
+ * Copy the cache's counters into 'stats'.
+ * Returns 0 on success or -1 on error
+ */
+int fd_cache_get_stats(fd_cache_t *cache, fd_cache_stats_t *stats);
+
+/*
+ * Stop the watcher thread and close every cached descriptor. Entries still
+ * referenced by callers stay open until they are released.
+ * Returns 0 on success or -1 on error
+ */
+int fd_cache_free(fd_cache_t *cache);
+
+#endif // FD_CACHE_H
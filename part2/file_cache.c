@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "file_cache.h"
+#include "http.h"
+
+#define HEADER_BUFSIZE 512
+
+// FNV-1a, good enough to spread a few hundred paths over the buckets
+static unsigned long hash_path(const char *path) {
+    unsigned long hash = 14695981039346656037UL;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211UL;
+    }
+    return hash % FILE_CACHE_BUCKETS;
+}
+
+static size_t variant_cost(const file_cache_variant_t *variant) {
+    return variant->body_len + variant->header_len + sizeof(file_cache_variant_t);
+}
+
+static size_t entry_cost(const file_cache_entry_t *entry) {
+    size_t cost = entry->body_len + entry->header_len + strlen(entry->path) + sizeof(file_cache_entry_t);
+    for (int i = 0; i < COMPRESS_N_ENCODINGS; i++) {
+        if (entry->variants[i] != NULL) {
+            cost += variant_cost(entry->variants[i]);
+        }
+    }
+    return cost;
+}
+
+static int entry_matches(const file_cache_entry_t *entry, const struct stat *file_info) {
+    return entry->ino == file_info->st_ino && entry->size == file_info->st_size &&
+           entry->mtime.tv_sec == file_info->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == file_info->st_mtim.tv_nsec;
+}
+
+static void variant_free(file_cache_variant_t *variant) {
+    free(variant->header);
+    free(variant->body);
+    free(variant);
+}
+
+static void entry_free(file_cache_entry_t *entry) {
+    for (int i = 0; i < COMPRESS_N_ENCODINGS; i++) {
+        if (entry->variants[i] != NULL) {
+            variant_free(entry->variants[i]);
+        }
+    }
+    free(entry->path);
+    free(entry->header);
+    free(entry->body);
+    free(entry);
+}
+
+void file_cache_release(file_cache_entry_t *entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        entry_free(entry);
+    }
+}
+
+// Find an entry by path. Caller holds cache->lock.
+static file_cache_entry_t *find_entry(file_cache_t *cache, const char *path) {
+    file_cache_entry_t *entry = cache->buckets[hash_path(path)];
+    while (entry != NULL && strcmp(entry->path, path) != 0) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+// Move an entry to the most recently used end. Caller holds cache->lock.
+static void lru_push_front(file_cache_t *cache, file_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = entry;
+    }
+}
+
+static void lru_remove(file_cache_t *cache, file_cache_entry_t *entry) {
+    if (entry->lru_prev == NULL) {
+        cache->lru_head = entry->lru_next;
+    } else {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    if (entry->lru_next == NULL) {
+        cache->lru_tail = entry->lru_prev;
+    } else {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+}
+
+// Unlink an entry from the hash table and LRU list and drop the cache's
+// reference to it. Caller holds cache->lock.
+static void unlink_entry(file_cache_t *cache, file_cache_entry_t *entry) {
+    file_cache_entry_t **link = &cache->buckets[hash_path(entry->path)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    lru_remove(cache, entry);
+    entry->linked = 0;
+    cache->stats.bytes_used -= entry_cost(entry);
+    cache->stats.entries--;
+    file_cache_release(entry);
+}
+
+int file_cache_init(file_cache_t *cache, size_t byte_budget) {
+    memset(cache, 0, sizeof(file_cache_t));
+    cache->byte_budget = byte_budget;
+    cache->max_entry_size = byte_budget / 4;
+
+    int result;
+    if ((result = pthread_mutex_init(&cache->lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+// Read an open file into a newly allocated entry with its response header
+// prebuilt, or only build the header when 'with_body' is 0.
+// Returns NULL if the file can't be cached.
+static file_cache_entry_t *load_entry(int file, const char *path, const struct stat *file_info, int with_body) {
+    char header[HEADER_BUFSIZE];
+    int header_len = http_format_header(header, sizeof(header), path, file_info);
+    if (header_len == -1) {
+        return NULL;
+    }
+
+    file_cache_entry_t *entry = calloc(1, sizeof(file_cache_entry_t));
+    if (entry == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    entry->path = strdup(path);
+    entry->header = malloc(header_len);
+    if (with_body) {
+        entry->body = malloc(file_info->st_size > 0 ? file_info->st_size : 1);
+    }
+    if (entry->path == NULL || entry->header == NULL || (with_body && entry->body == NULL)) {
+        perror("malloc");
+        entry_free(entry);
+        return NULL;
+    }
+    memcpy(entry->header, header, header_len);
+    entry->header_len = header_len;
+    entry->ino = file_info->st_ino;
+    entry->size = file_info->st_size;
+    entry->mtime = file_info->st_mtim;
+    entry->refcount = 1; // the cache's own reference
+    if (!with_body) {
+        return entry;
+    }
+
+    size_t total_read = 0;
+    while (total_read < (size_t) file_info->st_size) {
+        ssize_t bytes_read = pread(file, entry->body + total_read, file_info->st_size - total_read, total_read);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            entry_free(entry);
+            return NULL;
+        }
+        if (bytes_read == 0) {
+            // file shrank while we read it, don't cache a torn copy
+            entry_free(entry);
+            return NULL;
+        }
+        total_read += bytes_read;
+    }
+
+    entry->body_len = total_read;
+    return entry;
+}
+
+// Evict least recently used entries other than 'keep' until the cache is
+// within its budget. Caller holds cache->lock.
+static void evict_over_budget(file_cache_t *cache, file_cache_entry_t *keep) {
+    while (cache->stats.bytes_used > cache->byte_budget && cache->lru_tail != keep) {
+        unlink_entry(cache, cache->lru_tail);
+        cache->stats.evictions++;
+    }
+}
+
+// Link a freshly loaded entry, replacing any other version of the same path
+// and evicting least recently used entries to stay within the budget.
+// Caller holds cache->lock.
+static void insert_entry(file_cache_t *cache, file_cache_entry_t *entry) {
+    file_cache_entry_t *old = find_entry(cache, entry->path);
+    if (old != NULL) {
+        unlink_entry(cache, old);
+    }
+
+    unsigned long bucket = hash_path(entry->path);
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    entry->linked = 1;
+    cache->stats.bytes_used += entry_cost(entry);
+    cache->stats.entries++;
+    evict_over_budget(cache, entry);
+}
+
+// Open a file whose header-only entry the caller holds. If the file changed
+// since the stat in file_cache_get, the entry is dropped so the caller builds
+// a fresh header. Returns 0 on success or -1 if the file can't be opened.
+static int open_uncached(const char *path, file_cache_entry_t **entry, int *file, struct stat *file_info) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, file_info) == -1) {
+        perror(fd == -1 ? "open" : "fstat");
+        if (fd != -1) {
+            close(fd);
+        }
+        file_cache_release(*entry);
+        *entry = NULL;
+        return -1;
+    }
+    if (!entry_matches(*entry, file_info)) {
+        file_cache_release(*entry);
+        *entry = NULL;
+    }
+    *file = fd;
+    return 0;
+}
+
+// Find the entry for the version of the file 'file_info' describes and take
+// a reference to it, dropping an entry for an older version.
+// Returns the entry, or NULL on a miss
+static file_cache_entry_t *get_current(file_cache_t *cache, const char *path, const struct stat *file_info) {
+    pthread_mutex_lock(&cache->lock);
+    file_cache_entry_t *cached = find_entry(cache, path);
+    if (cached != NULL) {
+        if (entry_matches(cached, file_info)) {
+            __atomic_add_fetch(&cached->refcount, 1, __ATOMIC_ACQ_REL);
+            lru_remove(cache, cached);
+            lru_push_front(cache, cached);
+            cache->stats.hits++;
+            pthread_mutex_unlock(&cache->lock);
+            return cached;
+        }
+        unlink_entry(cache, cached);
+        cache->stats.invalidations++;
+    }
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+// Load an open file after a miss and link the new entry, with a reference
+// for the caller. Returns the entry, or NULL if the file can't be cached.
+static file_cache_entry_t *load_and_insert(file_cache_t *cache, int file, const char *path,
+                                           const struct stat *file_info) {
+    if (!S_ISREG(file_info->st_mode)) {
+        return NULL;
+    }
+    int with_body = (size_t) file_info->st_size <= cache->max_entry_size;
+    file_cache_entry_t *loaded = load_entry(file, path, file_info, with_body);
+    if (loaded == NULL) {
+        return NULL;
+    }
+
+    // one reference for the cache, one for the caller
+    loaded->refcount = 2;
+    pthread_mutex_lock(&cache->lock);
+    insert_entry(cache, loaded);
+    pthread_mutex_unlock(&cache->lock);
+    return loaded;
+}
+
+int file_cache_get(file_cache_t *cache, const char *path, file_cache_entry_t **entry,
+                   int *file, struct stat *file_info) {
+    *entry = NULL;
+    *file = -1;
+
+    // A stat is much cheaper than open+fstat+read and tells us if the cached
+    // copy is still current
+    struct stat current;
+    if (stat(path, &current) == -1) {
+        return -1;
+    }
+    file_cache_entry_t *cached = get_current(cache, path, &current);
+    if (cached != NULL) {
+        *entry = cached;
+        *file_info = current;
+        if (cached->body != NULL) {
+            return 0;
+        }
+        // header-only: the body still comes from the file
+        return open_uncached(path, entry, file, file_info);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    if (fstat(fd, file_info) == -1) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+
+    *entry = load_and_insert(cache, fd, path, file_info);
+    if (*entry == NULL || (*entry)->body == NULL) {
+        // let the caller stream the body from the descriptor
+        *file = fd;
+    } else {
+        close(fd);
+    }
+    return 0;
+}
+
+file_cache_entry_t *file_cache_get_open(file_cache_t *cache, const char *path, int file,
+                                        const struct stat *file_info) {
+    file_cache_entry_t *cached = get_current(cache, path, file_info);
+    if (cached != NULL) {
+        return cached;
+    }
+    return load_and_insert(cache, file, path, file_info);
+}
+
+// Compress an entry's body and build the header that goes with it
+// Returns the new variant, or NULL on error
+static file_cache_variant_t *build_variant(const file_cache_entry_t *entry, int encoding) {
+    file_cache_variant_t *variant = calloc(1, sizeof(file_cache_variant_t));
+    if (variant == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    if (compress_buffer(encoding, entry->body, entry->body_len, &variant->body, &variant->body_len) == -1) {
+        free(variant);
+        return NULL;
+    }
+    if (variant->body_len >= entry->body_len) {
+        // not worth it, remember that so it isn't tried again
+        free(variant->body);
+        variant->body = NULL;
+        variant->body_len = 0;
+        return variant;
+    }
+
+    struct stat file_info;
+    memset(&file_info, 0, sizeof(file_info));
+    file_info.st_ino = entry->ino;
+    file_info.st_size = entry->size;
+    file_info.st_mtim = entry->mtime;
+    char header[HEADER_BUFSIZE];
+    int header_len = http_format_encoded_header(header, sizeof(header), entry->path, &file_info, encoding,
+                                                variant->body_len);
+    if (header_len == -1 || (variant->header = malloc(header_len)) == NULL) {
+        variant_free(variant);
+        return NULL;
+    }
+    memcpy(variant->header, header, header_len);
+    variant->header_len = header_len;
+    return variant;
+}
+
+const file_cache_variant_t *file_cache_get_variant(file_cache_t *cache, file_cache_entry_t *entry, int encoding) {
+    file_cache_variant_t **slot = &entry->variants[encoding - 1];
+    file_cache_variant_t *variant = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (variant == NULL) {
+        // compress outside the lock, the body can't change under us
+        file_cache_variant_t *built = build_variant(entry, encoding);
+        if (built == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&cache->lock);
+        variant = *slot;
+        if (variant == NULL) {
+            // release pairs with the acquire above, readers see it complete
+            __atomic_store_n(slot, built, __ATOMIC_RELEASE);
+            variant = built;
+            cache->stats.compressions++;
+            if (entry->linked) {
+                cache->stats.bytes_used += variant_cost(built);
+                evict_over_budget(cache, entry);
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+        if (variant != built) {
+            variant_free(built); // another worker got there first
+        }
+    }
+    return variant->body != NULL ? variant : NULL;
+}
+
+int file_cache_get_stats(file_cache_t *cache, file_cache_stats_t *stats) {
+    int result;
+    if ((result = pthread_mutex_lock(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    *stats = cache->stats;
+    if ((result = pthread_mutex_unlock(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int file_cache_free(file_cache_t *cache) {
+    while (cache->lru_head != NULL) {
+        unlink_entry(cache, cache->lru_head);
+    }
+
+    int result;
+    if ((result = pthread_mutex_destroy(&cache->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
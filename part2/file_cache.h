@@ -0,0 +1,133 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "compress.h"
+
+#define FILE_CACHE_BUCKETS 1024
+#define FILE_CACHE_DEFAULT_BUDGET (32 * 1024 * 1024)
+
+// One cached file: the response header (minus the Connection line and the
+// blank line, which depend on the request) and the complete file body.
+// Files too large for the body to be cached get a header-only entry, whose
+// body is NULL, so their header is still serialized only once per version.
+// Entries are reference counted. The cache owns one reference while the
+// entry is linked, and each caller of file_cache_get owns one until it
+// calls file_cache_release, so an entry evicted mid-send stays valid.
+
+// A compressed copy of a cached body with its own header, built the first
+// time a client accepts the encoding and freed with the entry
+typedef struct {
+    char *header;         // like the entry's, with Content-Encoding added
+    size_t header_len;
+    char *body;           // NULL if compressing didn't make the body smaller
+    size_t body_len;
+} file_cache_variant_t;
+
+typedef struct file_cache_entry {
+    char *path;
+    char *header;
+    size_t header_len;
+    char *body;
+    size_t body_len;
+    ino_t ino;            // st_ino, st_size and st_mtim identify the version cached
+    off_t size;
+    struct timespec mtime;
+    int refcount;
+    int linked;           // in the table, so variant bytes count against the budget
+    file_cache_variant_t *variants[COMPRESS_N_ENCODINGS]; // by encoding - 1, published once
+    struct file_cache_entry *hash_next;
+    struct file_cache_entry *lru_prev; // towards most recently used
+    struct file_cache_entry *lru_next; // towards least recently used
+} file_cache_entry_t;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;     // entries dropped to stay under the byte budget
+    unsigned long invalidations; // entries dropped because the file changed
+    unsigned long compressions;  // compressed variants built
+    size_t bytes_used;
+    size_t entries;
+} file_cache_stats_t;
+
+// Struct representing a thread-safe LRU cache of file contents keyed by path
+typedef struct {
+    file_cache_entry_t *buckets[FILE_CACHE_BUCKETS];
+    file_cache_entry_t *lru_head;
+    file_cache_entry_t *lru_tail;
+    size_t byte_budget;
+    size_t max_entry_size;
+    file_cache_stats_t stats;
+    pthread_mutex_t lock;
+} file_cache_t;
+
+/*
+ * Initialize a new file cache.
+ * cache: Pointer to file_cache_t to be initialized
+ * byte_budget: Upper bound on the memory used by cached headers and bodies.
+ *              Files larger than a quarter of the budget are never cached.
+ * Returns 0 on success or -1 on error
+ */
+int file_cache_init(file_cache_t *cache, size_t byte_budget);
+
+/*
+ * Look up a file by path, loading it into the cache on a miss. The file's
+ * current stat information is compared with the cached version, and a stale
+ * entry is replaced.
+ * cache: The cache to look in
+ * path: Path to the file in the server's file system, used as the cache key
+ * entry: Set to a referenced entry on success, or NULL if the file cannot be
+ *        cached (not a regular file)
+ * file: When *entry is NULL or header-only, set to an open descriptor for
+ *       the file that the caller must send from and close. The file is never
+ *       opened twice.
+ * file_info: Set to the file's stat information, that of *file when it is set
+ * Returns 0 on success or -1 if the file does not exist or cannot be read
+ */
+int file_cache_get(file_cache_t *cache, const char *path, file_cache_entry_t **entry,
+                   int *file, struct stat *file_info);
+
+/*
+ * Like file_cache_get for a file the caller already has open and knows to be
+ * current, as with a descriptor from the fd cache: no stat or open is made,
+ * the stat information given decides whether the cached version is current.
+ * file: Open descriptor for the file, read from on a miss but not closed
+ * file_info: The file's current stat information
+ * Returns a referenced entry, or NULL if the file cannot be cached
+ */
+file_cache_entry_t *file_cache_get_open(file_cache_t *cache, const char *path, int file,
+                                        const struct stat *file_info);
+
+/*
+ * Get a compressed copy of a cached body, compressing it on first use. Later
+ * requests for the same version are served the stored copy at no CPU cost.
+ * cache: The cache the entry came from
+ * entry: A referenced entry with a body
+ * encoding: ENCODING_GZIP or ENCODING_BR, must be compress_available
+ * Returns the variant, or NULL if the body doesn't compress or on error
+ */
+const file_cache_variant_t *file_cache_get_variant(file_cache_t *cache, file_cache_entry_t *entry, int encoding);
+
+/*
+ * Drop a reference obtained from file_cache_get. The entry must not be used
+ * afterwards.
+ */
+void file_cache_release(file_cache_entry_t *entry);
+
+/*
+ * Copy the cache's counters into 'stats'.
+ * Returns 0 on success or -1 on error
+ */
+int file_cache_get_stats(file_cache_t *cache, file_cache_stats_t *stats);
+
+/*
+ * Deallocates all cached entries and the cache's synchronization primitives.
+ * No references may be outstanding.
+ * Returns 0 on success or -1 on error
+ */
+int file_cache_free(file_cache_t *cache);
+
+#endif // FILE_CACHE_H
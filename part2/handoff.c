@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "handoff.h"
+
+#define HANDOFF_ACK 'k'
+
+// Fill in the control path's address
+// Returns 0 on success or -1 if the path doesn't fit
+static int control_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "handoff: control path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Neither side waits forever on a peer that stopped answering
+static void set_timeouts(int fd) {
+    struct timeval timeout;
+    timeout.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+int handoff_take(const char *path, int *fds, int n_fds) {
+    struct sockaddr_un addr;
+    if (n_fds > HANDOFF_MAX_FDS || control_address(path, &addr) == -1) {
+        return -1;
+    }
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sock_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(sock_fd);
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            return 0; // nothing running there, or left over from a server that exited
+        }
+        perror("connect");
+        return -1;
+    }
+    set_timeouts(sock_fd);
+
+    uint32_t count;
+    struct iovec iov = {&count, sizeof(count)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n == -1) {
+        perror("recvmsg");
+        close(sock_fd);
+        return -1;
+    }
+
+    int received = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (received < n_fds ? received : n_fds));
+    }
+    if (n != sizeof(count) || (msg.msg_flags & MSG_CTRUNC) || count != (uint32_t) received || received != n_fds) {
+        // not acknowledging leaves the running server as it was
+        fprintf(stderr, "handoff: got %d listening sockets, this server needs %d\n", received, n_fds);
+        if (cmsg != NULL) {
+            int *extra = (int *) CMSG_DATA(cmsg);
+            for (int i = 0; i < received; i++) {
+                close(extra[i]);
+            }
+        }
+        close(sock_fd);
+        return -1;
+    }
+
+    char ack = HANDOFF_ACK;
+    if (write(sock_fd, &ack, 1) != 1) {
+        perror("write");
+        for (int i = 0; i < n_fds; i++) {
+            close(fds[i]);
+        }
+        close(sock_fd);
+        return -1;
+    }
+    close(sock_fd);
+    return n_fds;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (control_address(path, &addr) == -1) {
+        return -1;
+    }
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    // the old server's socket, it keeps listening on it until it exits but
+    // the next restart should find this one
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror("unlink");
+        close(sock_fd);
+        return -1;
+    }
+    if (bind(sock_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sock_fd, 1) == -1) {
+        perror("bind");
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+int handoff_give(int control_fd, const int *fds, int n_fds) {
+    if (n_fds > HANDOFF_MAX_FDS) {
+        return -1;
+    }
+    int sock_fd = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock_fd == -1) {
+        perror("accept");
+        return -1;
+    }
+    set_timeouts(sock_fd);
+
+    uint32_t count = n_fds;
+    struct iovec iov = {&count, sizeof(count)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+    if (sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != sizeof(count)) {
+        perror("sendmsg");
+        close(sock_fd);
+        return -1;
+    }
+
+    // until the new server says it has them, it may still fail to start
+    char ack;
+    ssize_t n = read(sock_fd, &ack, 1);
+    close(sock_fd);
+    if (n != 1 || ack != HANDOFF_ACK) {
+        fprintf(stderr, "handoff: the new server didn't take the listening sockets, still serving\n");
+        return -1;
+    }
+    return 0;
+}
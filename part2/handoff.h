@@ -0,0 +1,43 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#define HANDOFF_MAX_FDS 256
+#define HANDOFF_TIMEOUT_MS 5000 // for either side to answer
+
+// Zero-downtime restart. A running server listens on a Unix socket at a
+// control path. A new server started with the same path connects to it
+// first and is sent the listening sockets over it (SCM_RIGHTS), then
+// acknowledges them. From then on both processes accept on the very same
+// sockets, so no connection is refused in between: the old one stops
+// accepting, drains and exits, and the new one binds the control path for
+// the next restart. The message is a uint32_t socket count with the
+// descriptors attached, the acknowledgement a single byte.
+
+/*
+ * Take the listening sockets from a server running on 'path'.
+ * fds: Filled with the received sockets
+ * n_fds: How many sockets this server needs, the running one has to send
+ *        exactly as many
+ * Returns n_fds once the sockets are taken over, 0 if no server is running
+ * on 'path', or -1 on error
+ */
+int handoff_take(const char *path, int *fds, int n_fds);
+
+/*
+ * Bind and listen on the control path, replacing any socket left there by
+ * the server this one took over from.
+ * Returns the listening socket, or -1 on error
+ */
+int handoff_listen(const char *path);
+
+/*
+ * Accept a new server's connection on the control socket and hand it the
+ * listening sockets. The caller still owns 'fds' either way, closing its
+ * copies doesn't affect the new server.
+ * control_fd: Socket from handoff_listen with a connection waiting
+ * Returns 0 once the new server has acknowledged the sockets, or -1 if the
+ * handoff failed and this server should keep serving
+ */
+int handoff_give(int control_fd, const int *fds, int n_fds);
+
+#endif // HANDOFF_H
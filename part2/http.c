@@ -1,175 +1,1421 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include "compress.h"
+#include "file_cache.h"
 #include "http.h"
+#include "metrics.h"
+#include "mime_hash.h"
+#include "mime_table.h" // generated by mime_gen from mime.types
 
 #define BUFSIZE 512
+#define RANGE_PART_HEADER 256 // multipart/byteranges part header
+#define COPY_CHUNK (64 * 1024) // copy buffer taken from the request arena
+#define SPLICE_CHUNK (64 * 1024)
+
+#ifndef DEFAULT_SEND_MODE
+#define DEFAULT_SEND_MODE SEND_MODE_SENDFILE
+#endif
+
+// Set once by main before any worker threads start, read-only afterwards
+static int send_mode = DEFAULT_SEND_MODE;
+static file_cache_t *file_cache = NULL;
+static fd_cache_t *fd_cache = NULL;
+static const pack_t *asset_pack = NULL;
+
+// Overrides file_cache for the calling thread, see http_set_thread_file_cache
+static __thread file_cache_t *thread_file_cache = NULL;
+// Scratch space for the calling thread's current request, see http_set_thread_arena
+static __thread arena_t *request_arena = NULL;
+
+// Last response written by the calling thread, see http_last_response
+static __thread int last_status = 0;
+static __thread size_t last_bytes = 0;
+
+static void record_response(int status, size_t bytes) {
+    last_status = status;
+    last_bytes = bytes;
+    metrics_record_response(status, bytes);
+}
+
+void http_last_response(int *status, size_t *bytes) {
+    *status = last_status;
+    *bytes = last_bytes;
+}
+
+void http_set_file_cache(file_cache_t *cache) {
+    file_cache = cache;
+}
+
+void http_set_thread_file_cache(file_cache_t *cache) {
+    thread_file_cache = cache;
+}
+
+void http_set_thread_arena(arena_t *arena) {
+    request_arena = arena;
+}
+
+// Get the current request's COPY_CHUNK copy buffer from the calling thread's
+// arena, allocated on first use so a multi-range response shares one
+// Returns the buffer, or NULL if the thread has no arena or it is exhausted
+static char *copy_buffer(void) {
+    static __thread char *buffer = NULL;
+    static __thread unsigned long buffer_request = 0;
+    if (request_arena == NULL) {
+        return NULL;
+    }
+    if (buffer == NULL || buffer_request != request_arena->stats.resets) {
+        buffer = arena_alloc(request_arena, COPY_CHUNK);
+        buffer_request = request_arena->stats.resets;
+    }
+    return buffer;
+}
+
+// The content cache serving the calling thread's requests, or NULL
+static file_cache_t *current_file_cache(void) {
+    return thread_file_cache != NULL ? thread_file_cache : file_cache;
+}
+
+void http_set_fd_cache(fd_cache_t *cache) {
+    fd_cache = cache;
+}
+
+void http_set_pack(const pack_t *pack) {
+    asset_pack = pack;
+}
+
+int http_set_send_mode(const char *mode_name) {
+    if (strcmp(mode_name, "copy") == 0) {
+        send_mode = SEND_MODE_COPY;
+    } else if (strcmp(mode_name, "sendfile") == 0) {
+        send_mode = SEND_MODE_SENDFILE;
+    } else if (strcmp(mode_name, "splice") == 0) {
+        send_mode = SEND_MODE_SPLICE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Write all 'len' bytes of 'data' to fd, retrying on short writes
+static int write_all(int fd, const char *data, size_t len) {
+    size_t total_written = 0;
+    while (total_written < len) {
+        ssize_t bytes_written = write(fd, data + total_written, len - total_written);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+        total_written += bytes_written;
+    }
+    return 0;
+}
+
+// Send every byte described by 'iov', retrying on short writes. Modifies iov.
+// flags: MSG_MORE when the body follows in a separate call, so the kernel
+//        holds the header back and puts it in the same packet as the body
+static int send_all(int fd, struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    while (iovcnt > 0) {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t bytes_written = sendmsg(fd, &msg, flags);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendmsg");
+            return -1;
+        }
+        // skip past the buffers that were fully written
+        while (iovcnt > 0 && (size_t) bytes_written >= iov->iov_len) {
+            bytes_written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytes_written;
+            iov->iov_len -= bytes_written;
+        }
+    }
+    return 0;
+}
+
+// Send 'count' bytes of file starting at 'offset' through a user-space buffer.
+// This is the original read/write loop and the fallback for the zero-copy paths.
+// The buffer comes from the request arena when there is one, a stack buffer
+// of BUFSIZE would cost a read and a write per 512 bytes.
+static int copy_file_body(int fd, int file, off_t offset, size_t count) {
+    char stack_buf[BUFSIZE];
+    char *buf = copy_buffer();
+    size_t buf_size = COPY_CHUNK;
+    if (buf == NULL) {
+        buf = stack_buf;
+        buf_size = sizeof(stack_buf);
+    }
+    while (count > 0) {
+        size_t chunk = count < buf_size ? count : buf_size;
+        ssize_t bytes_read = pread(file, buf, chunk, offset);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            return -1;
+        }
+        if (bytes_read == 0) {
+            // the file shrank underneath us and the header promised more,
+            // the connection has to be closed rather than reused
+            fprintf(stderr, "copy_file_body: file ended %zu bytes short\n", count);
+            return -1;
+        }
+        if (write_all(fd, buf, bytes_read) == -1) {
+            return -1;
+        }
+        offset += bytes_read;
+        count -= bytes_read;
+    }
+    return 0;
+}
+
+// Send the file body with sendfile(2), which moves pages from the page cache
+// straight into the socket. Falls back to copying if the kernel refuses.
+static int sendfile_file_body(int fd, int file, off_t offset, size_t count) {
+    while (count > 0) {
+        ssize_t bytes_sent = sendfile(fd, file, &offset, count);
+        if (bytes_sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                // offset was advanced past whatever was already sent
+                return copy_file_body(fd, file, offset, count);
+            }
+            perror("sendfile");
+            return -1;
+        }
+        if (bytes_sent == 0) {
+            fprintf(stderr, "sendfile_file_body: file ended %zu bytes short\n", count);
+            return -1; // shrank, as in copy_file_body
+        }
+        count -= bytes_sent;
+    }
+    return 0;
+}
+
+// Send the file body with splice(2) through an intermediate pipe. Useful where
+// sendfile is unavailable for the file type. Falls back to copying if the
+// first splice into the pipe is rejected.
+static int splice_file_body(int fd, int file, off_t offset, size_t count) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        perror("pipe");
+        return copy_file_body(fd, file, offset, count);
+    }
+
+    int ret_val = 0;
+    while (count > 0) {
+        size_t chunk = count < SPLICE_CHUNK ? count : SPLICE_CHUNK;
+        ssize_t in_pipe = splice(file, &offset, pipe_fds[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                ret_val = copy_file_body(fd, file, offset, count);
+                break;
+            }
+            perror("splice");
+            ret_val = -1;
+            break;
+        }
+        if (in_pipe == 0) {
+            fprintf(stderr, "splice_file_body: file ended %zu bytes short\n", count);
+            ret_val = -1; // shrank, as in copy_file_body
+            break;
+        }
+
+        // drain everything we just put into the pipe before refilling it
+        ssize_t drained = 0;
+        while (drained < in_pipe) {
+            ssize_t out = splice(pipe_fds[0], NULL, fd, NULL, in_pipe - drained, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("splice");
+                ret_val = -1;
+                break;
+            }
+            drained += out;
+        }
+        if (ret_val == -1) {
+            break;
+        }
+        count -= in_pipe;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return ret_val;
+}
+
+// Send 'count' bytes of file starting at 'offset' using the configured send mode
+static int send_file_body(int fd, int file, off_t offset, size_t count) {
+    switch (send_mode) {
+    case SEND_MODE_SENDFILE:
+        return sendfile_file_body(fd, file, offset, count);
+    case SEND_MODE_SPLICE:
+        return splice_file_body(fd, file, offset, count);
+    default:
+        return copy_file_body(fd, file, offset, count);
+    }
+}
 
 const char *get_mime_type(const char *file_extension) {
-    if (strcmp(".txt", file_extension) == 0) {
-        return "text/plain";
-    } else if (strcmp(".html", file_extension) == 0) {
-        return "text/html";
-    } else if (strcmp(".jpg", file_extension) == 0) {
-        return "image/jpeg";
-    } else if (strcmp(".png", file_extension) == 0) {
-        return "image/png";
-    } else if (strcmp(".pdf", file_extension) == 0) {
-        return "application/pdf";
+    // the bucket's displacement leads to the only slot the extension can be in
+    uint32_t bucket = mime_hash(file_extension, 0) & (MIME_BUCKETS - 1);
+    uint32_t slot = mime_hash(file_extension, mime_displacement[bucket]) & (MIME_TABLE_SIZE - 1);
+    if (mime_table[slot].extension != NULL && strcmp(mime_table[slot].extension, file_extension) == 0) {
+        return mime_table[slot].type;
     }
+    return NULL;
+}
+
+void http_conn_init(http_conn_t *conn, int fd) {
+    conn->fd = fd;
+    conn->len = 0;
+    conn->consumed = 0;
+    conn->scanned = 0;
+}
 
+size_t http_conn_pending(const http_conn_t *conn) {
+    return conn->len - conn->consumed;
+}
+
+int http_slice_equals(const http_slice_t *slice, const char *str) {
+    size_t len = strlen(str);
+    return slice->len == len && strncasecmp(slice->data, str, len) == 0;
+}
+
+// Returns 1 if a comma separated header value such as "keep-alive, Upgrade"
+// contains 'token' (case-insensitive), 0 otherwise
+static int slice_has_token(const http_slice_t *slice, const char *token) {
+    size_t token_len = strlen(token);
+    const char *p = slice->data;
+    const char *end = slice->data + slice->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *item = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) {
+            item_end--;
+        }
+        if ((size_t) (item_end - item) == token_len && strncasecmp(item, token, token_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const http_slice_t *http_get_header(const http_request_t *request, const char *name) {
+    for (int i = 0; i < request->n_headers; i++) {
+        if (http_slice_equals(&request->headers[i].name, name)) {
+            return &request->headers[i].value;
+        }
+    }
     return NULL;
 }
 
-int read_http_request(int fd, char *resource_name) {
-    char buf[BUFSIZE];
-    char *token;
-    char *resource_token;
+// Split the next space-delimited token off the request line
+// Returns 0 on success or -1 if the token is empty
+static int next_token(const char **p, const char *end, char delim, http_slice_t *token) {
+    const char *start = *p;
+    const char *stop = memchr(start, delim, end - start);
+    if (stop == NULL) {
+        stop = end;
+    }
+    if (stop == start) {
+        return -1;
+    }
+    token->data = start;
+    token->len = stop - start;
+    *p = stop < end ? stop + 1 : stop;
+    return 0;
+}
 
-    // make a copy of fd
-    int fd_copy = dup(fd);
-    if (fd_copy == -1) {
-        perror("dup");
+// Parse a complete request header in place. 'end' points just past the blank
+// line. Every slice in 'request' points into the header bytes.
+// Returns 0 on success or -1 if the request is malformed or has too many headers
+static int parse_request(const char *start, const char *end, http_request_t *request) {
+    // request line: METHOD SP PATH SP VERSION CRLF
+    const char *line_end = memmem(start, end - start, "\r\n", 2);
+    const char *p = start;
+    if (next_token(&p, line_end, ' ', &request->method) == -1 ||
+        next_token(&p, line_end, ' ', &request->path) == -1 ||
+        next_token(&p, line_end, ' ', &request->version) == -1 || p != line_end) {
         return -1;
     }
+    if (request->version.len < 5 || strncmp(request->version.data, "HTTP/", 5) != 0) {
+        return -1;
+    }
+
+    // header lines: NAME ":" OWS VALUE OWS CRLF, until the empty line
+    request->n_headers = 0;
+    p = line_end + 2;
+    while (1) {
+        line_end = memmem(p, end - p, "\r\n", 2);
+        if (line_end == p) {
+            break;
+        }
+        if (request->n_headers == MAX_HEADERS) {
+            return -1;
+        }
+        const char *colon = memchr(p, ':', line_end - p);
+        if (colon == NULL || colon == p) {
+            return -1;
+        }
+        http_header_t *header = &request->headers[request->n_headers++];
+        header->name.data = p;
+        header->name.len = colon - p;
+
+        const char *value = colon + 1;
+        const char *value_end = line_end;
+        while (value < value_end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            value_end--;
+        }
+        header->value.data = value;
+        header->value.len = value_end - value;
+
+        p = line_end + 2;
+    }
+
+    // HTTP/1.1 connections are persistent unless the client says otherwise
+    request->keep_alive = http_slice_equals(&request->version, "HTTP/1.1");
+    const http_slice_t *connection = http_get_header(request, "Connection");
+    if (connection != NULL) {
+        if (slice_has_token(connection, "close")) {
+            request->keep_alive = 0;
+        } else if (slice_has_token(connection, "keep-alive")) {
+            request->keep_alive = 1;
+        }
+    }
+    return 0;
+}
+
+int http_parse_buffered(http_conn_t *conn, http_request_t *request) {
+    // Drop the previous request but keep any pipelined bytes that followed it
+    if (conn->consumed > 0) {
+        memmove(conn->buf, conn->buf + conn->consumed, conn->len - conn->consumed);
+        conn->len -= conn->consumed;
+        conn->consumed = 0;
+        conn->scanned = 0;
+    }
+
+    // Only rescan the bytes that arrived since the last attempt, backing
+    // up in case the terminator straddles two reads
+    size_t from = conn->scanned > 3 ? conn->scanned - 3 : 0;
+    char *terminator = memmem(conn->buf + from, conn->len - from, "\r\n\r\n", 4);
+    if (terminator != NULL) {
+        const char *end = terminator + 4;
+        conn->consumed = end - conn->buf;
+        if (parse_request(conn->buf, end, request) == -1) {
+            return HTTP_BAD_REQUEST;
+        }
+        return 0;
+    }
+    conn->scanned = conn->len;
+
+    if (conn->len == MAX_REQUEST_HEADER) {
+        return HTTP_HEADER_TOO_LARGE;
+    }
+    return HTTP_NEED_MORE;
+}
+
+int read_http_request(http_conn_t *conn, http_request_t *request) {
+    while (1) {
+        int result = http_parse_buffered(conn, request);
+        if (result != HTTP_NEED_MORE) {
+            return result;
+        }
+
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, MAX_REQUEST_HEADER - conn->len, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recv");
+            return -1;
+        }
+        if (n == 0) {
+            // a peer closing between requests is the normal end of a connection
+            if (conn->len == 0) {
+                return HTTP_CONN_CLOSED;
+            }
+            return -1;
+        }
+        conn->len += n;
+    }
+}
 
-    FILE *socket_stream = fdopen(fd_copy, "r");
-    if (socket_stream == NULL) {
-        perror("fdopen");
-        close(fd_copy);
+// Returns 1 if a request path is absolute and has no ".." segment, so it
+// can't lead out of the served directory, 0 otherwise
+static int path_is_safe(const http_slice_t *path) {
+    if (path->len == 0 || path->data[0] != '/') {
+        return 0;
+    }
+    const char *end = path->data + path->len;
+    for (const char *segment = path->data + 1; segment <= end; segment++) {
+        const char *slash = memchr(segment, '/', end - segment);
+        const char *segment_end = slash != NULL ? slash : end;
+        if (segment_end - segment == 2 && segment[0] == '.' && segment[1] == '.') {
+            return 0;
+        }
+        segment = segment_end;
+    }
+    return 1;
+}
+
+int http_resolve_path(const http_request_t *request, const char *serve_dir, char *resource_path, size_t size) {
+    if (!path_is_safe(&request->path)) {
+        return HTTP_BAD_REQUEST;
+    }
+    int len = snprintf(resource_path, size, "%s%.*s", serve_dir, (int) request->path.len, request->path.data);
+    if (len < 0 || (size_t) len >= size) {
         return -1;
     }
+    return 0;
+}
 
-    // Disable the usual stdio buffering
-    if (setvbuf(socket_stream, NULL, _IONBF, 0) != 0) {
-        perror("setvbuf");
-        fclose(socket_stream);
+int http_request_ready(int fd, size_t *scanned) {
+    char buf[MAX_REQUEST_HEADER];
+    ssize_t n = recv(fd, buf, MAX_REQUEST_HEADER, MSG_PEEK | MSG_DONTWAIT);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+    if (n == 0) {
         return -1;
     }
+    // like http_parse_buffered, only search what arrived since the last
+    // peek, backing up in case the terminator straddles two of them
+    size_t from = 0;
+    if (scanned != NULL && *scanned > 3 && *scanned <= (size_t) n) {
+        from = *scanned - 3;
+    }
+    if (memmem(buf + from, n - from, "\r\n\r\n", 4) != NULL) {
+        return 1;
+    }
+    if (scanned != NULL) {
+        *scanned = n;
+    }
+    // a full buffer without the blank line will never fit, the reader
+    // answers that with a 431
+    return n == MAX_REQUEST_HEADER ? 1 : 0;
+}
 
-    // Keep consuming lines until we find an empty line
-    while (fgets(buf, BUFSIZE, socket_stream) != NULL) {
-        if (strcmp(buf, "\r\n") == 0) {
-            break;
-        } else {
-            // if its not the last line of the request, can run the same logic on all lines
-            token = strtok(buf, " ");
+// Compressed representations get the coding appended to the file's ETag
+static int format_encoded_etag(char *buf, size_t size, const struct stat *file_info, int encoding) {
+    long long mtime_ns = file_info->st_mtim.tv_sec * 1000000000LL + file_info->st_mtim.tv_nsec;
+    int len = snprintf(buf, size, "\"%lx-%lx-%llx%s%s\"", (unsigned long) file_info->st_ino,
+                       (unsigned long) file_info->st_size, mtime_ns, encoding != ENCODING_IDENTITY ? "-" : "",
+                       encoding != ENCODING_IDENTITY ? compress_encoding_name(encoding) : "");
+    return len < (int) size ? len : -1;
+}
+
+int http_format_etag(char *buf, size_t size, const struct stat *file_info) {
+    return format_encoded_etag(buf, size, file_info, ENCODING_IDENTITY);
+}
+
+#define HTTP_DATE_FORMAT "%a, %d %b %Y %H:%M:%S GMT"
+#define HTTP_DATE_LEN 64
+
+// Format a time as an HTTP date such as "Wed, 26 Apr 2023 00:00:49 GMT"
+// Returns 0 on success or -1 on error
+static int format_http_date(char *buf, size_t size, time_t when) {
+    struct tm tm;
+    if (gmtime_r(&when, &tm) == NULL || strftime(buf, size, HTTP_DATE_FORMAT, &tm) == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Parse an HTTP date, the only format RFC 9110 asks senders to use
+// Returns 0 on success or -1 if 'slice' is not a valid date
+static int parse_http_date(const http_slice_t *slice, time_t *when) {
+    char date[HTTP_DATE_LEN];
+    if (slice->len >= sizeof(date)) {
+        return -1;
+    }
+    memcpy(date, slice->data, slice->len);
+    date[slice->len] = '\0';
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, HTTP_DATE_FORMAT, &tm);
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+    *when = timegm(&tm);
+    return 0;
+}
+
+// Returns 1 if 'item' is 'etag' or one of its compressed variants
+static int etag_matches_variant(const char *item, size_t item_len, const char *etag, size_t etag_len) {
+    // compare up to the closing quote, then whatever suffix follows
+    if (item_len < etag_len || memcmp(item, etag, etag_len - 1) != 0) {
+        return 0;
+    }
+    const char *rest = item + etag_len - 1;
+    size_t rest_len = item_len - (etag_len - 1);
+    if (rest_len == 1 && *rest == '"') {
+        return 1;
+    }
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        const char *name = compress_encoding_name(encoding);
+        size_t name_len = strlen(name);
+        if (rest_len == name_len + 2 && rest[0] == '-' && memcmp(rest + 1, name, name_len) == 0 &&
+            rest[rest_len - 1] == '"') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns 1 if a comma separated If-None-Match value lists 'etag', one of
+// its compressed variants, or is "*", 0 otherwise. The comparison is weak, a
+// W/ prefix is ignored.
+static int etag_list_matches(const http_slice_t *list, const char *etag, size_t etag_len) {
+    const char *p = list->data;
+    const char *end = list->data + list->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *item = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) {
+            item_end--;
+        }
+        if (item_end - item == 1 && *item == '*') {
+            return 1;
+        }
+        if (item_end - item > 2 && strncmp(item, "W/", 2) == 0) {
+            item += 2;
+        }
+        if (etag_matches_variant(item, item_end - item, etag, etag_len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-            // error check strtok
-            if (token == NULL) {
-                perror("strtok");
-                fclose(socket_stream);
-                return -1;
+int http_not_modified(const http_request_t *request, const struct stat *file_info) {
+    if (request == NULL) {
+        return 0;
+    }
+    const http_slice_t *if_none_match = http_get_header(request, "If-None-Match");
+    if (if_none_match != NULL) {
+        char etag[HTTP_ETAG_LEN];
+        int etag_len = http_format_etag(etag, sizeof(etag), file_info);
+        return etag_len != -1 && etag_list_matches(if_none_match, etag, etag_len);
+    }
+    const http_slice_t *if_modified_since = http_get_header(request, "If-Modified-Since");
+    time_t since;
+    if (if_modified_since != NULL && parse_http_date(if_modified_since, &since) == 0) {
+        return file_info->st_mtim.tv_sec <= since;
+    }
+    return 0;
+}
+
+const char *http_content_type(const char *resource_path) {
+    // only a dot in the last path component starts an extension
+    const char *extension = strrchr(resource_path, '.');
+    const char *slash = strrchr(resource_path, '/');
+    const char *content_type = NULL;
+    if (extension != NULL && (slash == NULL || extension > slash)) {
+        content_type = get_mime_type(extension);
+    }
+    return content_type != NULL ? content_type : HTTP_DEFAULT_CONTENT_TYPE;
+}
+
+// The 200 header for either representation of a file. Types that may be
+// sent compressed carry Vary so shared caches keep the codings apart.
+static int format_file_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info,
+                              int encoding, off_t content_length) {
+    const char *content_type = http_content_type(resource_path);
+    char etag[HTTP_ETAG_LEN];
+    char last_modified[HTTP_DATE_LEN];
+    if (format_encoded_etag(etag, sizeof(etag), file_info, encoding) == -1 ||
+        format_http_date(last_modified, sizeof(last_modified), file_info->st_mtim.tv_sec) == -1) {
+        return -1;
+    }
+
+    char content_encoding[32] = "";
+    if (encoding != ENCODING_IDENTITY) {
+        snprintf(content_encoding, sizeof(content_encoding), "Content-Encoding: %s\r\n",
+                 compress_encoding_name(encoding));
+    }
+    int len = snprintf(buf, size, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n%sContent-Length: %ld\r\n%s"
+                       "Last-Modified: %s\r\nETag: %s\r\n",
+                       content_type, content_encoding, (long) content_length,
+                       compress_eligible(content_type) ? "Vary: Accept-Encoding\r\n" : "", last_modified, etag);
+    if (len < 0 || (size_t) len >= size) {
+        return -1;
+    }
+    return len;
+}
+
+int http_format_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info) {
+    return format_file_header(buf, size, resource_path, file_info, ENCODING_IDENTITY, file_info->st_size);
+}
+
+int http_format_encoded_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info,
+                               int encoding, off_t body_len) {
+    return format_file_header(buf, size, resource_path, file_info, encoding, body_len);
+}
+
+// Parse the q parameter of one Accept-Encoding item, 1 if it has none
+static double accept_quality(const char *params, const char *end) {
+    const char *q = params;
+    while (q < end && (q = memchr(q, ';', end - q)) != NULL) {
+        q++;
+        while (q < end && (*q == ' ' || *q == '\t')) {
+            q++;
+        }
+        if (end - q >= 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+            char value[8];
+            size_t len = end - q - 2 < sizeof(value) - 1 ? end - q - 2 : sizeof(value) - 1;
+            memcpy(value, q + 2, len);
+            value[len] = '\0';
+            return atof(value);
+        }
+    }
+    return 1;
+}
+
+int http_preferred_encoding(const http_request_t *request, int candidates) {
+    const http_slice_t *accept = request != NULL ? http_get_header(request, "Accept-Encoding") : NULL;
+    if (accept == NULL || candidates == 0) {
+        return ENCODING_IDENTITY;
+    }
+    double quality[COMPRESS_N_ENCODINGS + 1] = {0};
+    int listed[COMPRESS_N_ENCODINGS + 1] = {0};
+    double wildcard = 0;
+    const char *p = accept->data;
+    const char *end = accept->data + accept->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *item = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *name_end = item;
+        while (name_end < p && *name_end != ';' && *name_end != ' ' && *name_end != '\t') {
+            name_end++;
+        }
+        http_slice_t name = {item, name_end - item};
+        double q = accept_quality(name_end, p);
+        if (http_slice_equals(&name, "*")) {
+            wildcard = q;
+        }
+        for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+            if (http_slice_equals(&name, compress_encoding_name(encoding)) ||
+                (encoding == ENCODING_GZIP && http_slice_equals(&name, "x-gzip"))) {
+                quality[encoding] = q;
+                listed[encoding] = 1;
             }
+        }
+    }
+
+    int best = ENCODING_IDENTITY;
+    double best_quality = 0;
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        double q = listed[encoding] ? quality[encoding] : wildcard;
+        // ties go to the later, better compressing, encoding
+        if ((candidates & (1 << encoding)) && q > 0 && q >= best_quality) {
+            best = encoding;
+            best_quality = q;
+        }
+    }
+    return best;
+}
+
+int http_negotiate_encoding(const http_request_t *request, const char *resource_path,
+                            const struct stat *file_info, fd_cache_entry_t *opened, int can_compress,
+                            http_sibling_t *sibling) {
+    sibling->fd = -1;
+    sibling->owned = 0;
+    const char *content_type = http_content_type(resource_path);
+    if (request == NULL || !compress_eligible(content_type) ||
+        http_get_header(request, "Accept-Encoding") == NULL) {
+        return ENCODING_IDENTITY;
+    }
 
-            // At the beginning of the request, after GET, next strtok will give the resource name
-            if (strcmp(token, "GET") == 0) {
-                resource_token = strtok(NULL, " ");
+    // a precompressed sibling that is at least as new as the file wins,
+    // it was usually made at the highest level; the fd cache finds them
+    // once per version of the file, without it they are stat'ed
+    const fd_cache_sibling_t *cached = opened != NULL ? fd_cache_get_siblings(opened) : NULL;
+    int siblings = 0;
+    struct stat found[COMPRESS_N_ENCODINGS + 1];
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        char path[BUFSIZE];
+        if (cached != NULL) {
+            if (cached[encoding - 1].fd != -1) {
+                siblings |= 1 << encoding;
+            }
+        } else if (snprintf(path, sizeof(path), "%s%s", resource_path, compress_suffix(encoding)) <
+                       (int) sizeof(path) &&
+                   stat(path, &found[encoding]) == 0 && S_ISREG(found[encoding].st_mode) &&
+                   found[encoding].st_mtim.tv_sec >= file_info->st_mtim.tv_sec) {
+            siblings |= 1 << encoding;
+        }
+    }
+    int encoding = http_preferred_encoding(request, siblings);
+    if (encoding != ENCODING_IDENTITY && cached != NULL) {
+        sibling->fd = cached[encoding - 1].fd;
+        sibling->info = cached[encoding - 1].info;
+        return encoding;
+    }
+    if (encoding != ENCODING_IDENTITY) {
+        char path[BUFSIZE];
+        snprintf(path, sizeof(path), "%s%s", resource_path, compress_suffix(encoding));
+        sibling->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (sibling->fd != -1 && fstat(sibling->fd, &sibling->info) == 0) {
+            sibling->owned = 1;
+            return encoding;
+        }
+        if (sibling->fd != -1) {
+            close(sibling->fd);
+        }
+        sibling->fd = -1; // removed since we looked
+    }
+
+    if (!can_compress) {
+        return ENCODING_IDENTITY;
+    }
+    int available = 0;
+    for (encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        if (compress_available(encoding)) {
+            available |= 1 << encoding;
+        }
+    }
+    return http_preferred_encoding(request, available);
+}
 
-                // error check strtok
-                if (resource_token == NULL) {
-                    perror("strtok");
-                    fclose(socket_stream);
-                    return -1;
+// Final header line, which depends on the request rather than the file
+const char *http_connection_line(int keep_alive) {
+    return keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+}
+
+static const char *status_reason(int status) {
+    switch (status) {
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 414:
+        return "URI Too Long";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Error";
+    }
+}
+
+int http_format_not_modified(char *buf, size_t size, const struct stat *file_info, int keep_alive) {
+    char etag[HTTP_ETAG_LEN];
+    char last_modified[HTTP_DATE_LEN];
+    if (http_format_etag(etag, sizeof(etag), file_info) == -1 ||
+        format_http_date(last_modified, sizeof(last_modified), file_info->st_mtim.tv_sec) == -1) {
+        return -1;
+    }
+    int len = snprintf(buf, size, "HTTP/1.1 304 Not Modified\r\nLast-Modified: %s\r\nETag: %s\r\n%s",
+                       last_modified, etag, http_connection_line(keep_alive));
+    return len < (int) size ? len : -1;
+}
+
+// Answer a conditional request whose copy is still current
+static int write_not_modified(int fd, const struct stat *file_info, int keep_alive) {
+    char http_response[BUFSIZE];
+    int len = http_format_not_modified(http_response, BUFSIZE, file_info, keep_alive);
+    if (len == -1) {
+        return -1;
+    }
+    record_response(304, len);
+    return write_all(fd, http_response, len);
+}
+
+int http_format_error(char *buf, size_t size, int status, int keep_alive) {
+    int len = snprintf(buf, size, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s",
+                       status, status_reason(status), http_connection_line(keep_alive));
+    return len < (int) size ? len : -1;
+}
+
+int http_format_unavailable(char *buf, size_t size, int retry_after) {
+    int len = snprintf(buf, size, "HTTP/1.1 503 %s\r\nContent-Length: 0\r\nRetry-After: %d\r\n%s",
+                       status_reason(503), retry_after, http_connection_line(0));
+    return len < (int) size ? len : -1;
+}
+
+int write_http_error(int fd, int status, int keep_alive) {
+    char http_response[BUFSIZE];
+    int len = http_format_error(http_response, BUFSIZE, status, keep_alive);
+    record_response(status, len);
+    return write_all(fd, http_response, len);
+}
+
+int write_http_body(int fd, const char *content_type, const char *body, size_t body_len, int keep_alive) {
+    char header[BUFSIZE];
+    int header_len = snprintf(header, BUFSIZE, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s",
+                              content_type, body_len, http_connection_line(keep_alive));
+    if (header_len >= BUFSIZE) {
+        return -1;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_len;
+    iov[1].iov_base = (void *) body;
+    iov[1].iov_len = body_len;
+    record_response(200, header_len + body_len);
+    return send_all(fd, iov, 2, 0);
+}
+
+// Send a cached header and body with a single writev
+static int send_cached_response(int fd, const file_cache_entry_t *entry, int keep_alive) {
+    const char *connection = http_connection_line(keep_alive);
+    struct iovec iov[3];
+    iov[0].iov_base = entry->header;
+    iov[0].iov_len = entry->header_len;
+    iov[1].iov_base = (void *) connection;
+    iov[1].iov_len = strlen(connection);
+    iov[2].iov_base = entry->body;
+    iov[2].iov_len = entry->body_len;
+    record_response(200, iov[0].iov_len + iov[1].iov_len + iov[2].iov_len);
+    return send_all(fd, iov, 3, 0);
+}
+
+// Send a compressed representation: the precompressed sibling if
+// http_negotiate_encoding found one, otherwise the cache's compressed copy of
+// the entry's body. Returns 0 on success, -1 on error, or 1 if there turned
+// out to be nothing to send and the caller should fall back to identity.
+static int write_encoded(int fd, file_cache_entry_t *entry, const char *resource_path,
+                         const struct stat *file_info, int encoding, const http_sibling_t *sibling, int keep_alive) {
+    const char *connection = http_connection_line(keep_alive);
+    struct iovec iov[3];
+    iov[1].iov_base = (void *) connection;
+    iov[1].iov_len = strlen(connection);
+
+    if (sibling->fd == -1) {
+        const file_cache_variant_t *variant = file_cache_get_variant(current_file_cache(), entry, encoding);
+        if (variant == NULL) {
+            return 1;
+        }
+        iov[0].iov_base = variant->header;
+        iov[0].iov_len = variant->header_len;
+        iov[2].iov_base = variant->body;
+        iov[2].iov_len = variant->body_len;
+        record_response(200, iov[0].iov_len + iov[1].iov_len + iov[2].iov_len);
+        return send_all(fd, iov, 3, 0);
+    }
+
+    char header[BUFSIZE];
+    int header_len = http_format_encoded_header(header, sizeof(header), resource_path, file_info, encoding,
+                                                sibling->info.st_size);
+    if (header_len == -1) {
+        return 1;
+    }
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_len;
+    if (send_all(fd, iov, 2, sibling->info.st_size > 0 ? MSG_MORE : 0) == -1 ||
+        send_file_body(fd, sibling->fd, 0, sibling->info.st_size) == -1) {
+        return -1;
+    }
+    record_response(200, iov[0].iov_len + iov[1].iov_len + sibling->info.st_size);
+    return 0;
+}
+
+// Read a decimal byte position. Returns the position, or -1 if there are no
+// digits or the number overflows.
+static off_t parse_position(const char **p, const char *end) {
+    off_t value = 0;
+    const char *start = *p;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        if (value > (LLONG_MAX - 9) / 10) {
+            return -1;
+        }
+        value = value * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p == start ? -1 : value;
+}
+
+// Returns 1 if an If-Range validator names the current version of the file,
+// 0 otherwise. ETags must match strongly and dates exactly.
+static int if_range_matches(const http_slice_t *validator, const struct stat *file_info) {
+    if (validator->len > 0 && validator->data[0] == '"') {
+        char etag[HTTP_ETAG_LEN];
+        int etag_len = http_format_etag(etag, sizeof(etag), file_info);
+        return etag_len != -1 && validator->len == (size_t) etag_len &&
+               memcmp(validator->data, etag, etag_len) == 0;
+    }
+    time_t date;
+    return parse_http_date(validator, &date) == 0 && date == file_info->st_mtim.tv_sec;
+}
+
+int http_parse_ranges(const http_request_t *request, const struct stat *file_info,
+                      http_range_t *ranges, int max_ranges) {
+    const http_slice_t *range = request != NULL ? http_get_header(request, "Range") : NULL;
+    if (range == NULL || range->len < 6 || strncasecmp(range->data, "bytes=", 6) != 0) {
+        return 0;
+    }
+    const http_slice_t *if_range = http_get_header(request, "If-Range");
+    if (if_range != NULL && !if_range_matches(if_range, file_info)) {
+        return 0; // the client's partial copy is outdated, send everything
+    }
+
+    off_t size = file_info->st_size;
+    const char *p = range->data + 6;
+    const char *end = range->data + range->len;
+    int n_specs = 0;
+    int n_ranges = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        off_t first;
+        off_t last;
+        if (*p == '-') {
+            // suffix range: the last N bytes
+            p++;
+            off_t suffix = parse_position(&p, end);
+            if (suffix == -1) {
+                return 0;
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = suffix > 0 ? size - 1 : -1;
+        } else {
+            first = parse_position(&p, end);
+            if (first == -1 || p == end || *p != '-') {
+                return 0;
+            }
+            p++;
+            last = size - 1;
+            if (p < end && *p >= '0' && *p <= '9') {
+                last = parse_position(&p, end);
+                if (last == -1 || last < first) {
+                    return 0;
                 }
-                
-                // concatentate strings and error check
-                if (strcat(resource_name, resource_token) == NULL) {
-                    perror("strcat");
-                    fclose(socket_stream);
-                    return -1;
+                if (last >= size) {
+                    last = size - 1;
                 }
             }
         }
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p < end && *p != ',') {
+            return 0;
+        }
+        n_specs++;
+        if (first >= size || last < first) {
+            continue; // unsatisfiable on its own, the others may still be served
+        }
+        if (n_ranges == max_ranges) {
+            return 0; // too many pieces to be worth it, send the whole file
+        }
+        ranges[n_ranges].first = first;
+        ranges[n_ranges].last = last;
+        n_ranges++;
+    }
+    if (n_specs == 0) {
+        return 0;
+    }
+    return n_ranges > 0 ? n_ranges : -1;
+}
+
+int http_format_range_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info,
+                             const http_range_t *range, int keep_alive) {
+    const char *content_type = http_content_type(resource_path);
+    char etag[HTTP_ETAG_LEN];
+    char last_modified[HTTP_DATE_LEN];
+    if (http_format_etag(etag, sizeof(etag), file_info) == -1 ||
+        format_http_date(last_modified, sizeof(last_modified), file_info->st_mtim.tv_sec) == -1) {
+        return -1;
+    }
+    // the same Vary as the 200, the resource has compressed representations
+    int len = snprintf(buf, size, "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nContent-Length: %lld\r\n"
+                       "Content-Range: bytes %lld-%lld/%lld\r\n%sLast-Modified: %s\r\nETag: %s\r\n%s",
+                       content_type, (long long) (range->last - range->first + 1), (long long) range->first,
+                       (long long) range->last, (long long) file_info->st_size,
+                       compress_eligible(content_type) ? "Vary: Accept-Encoding\r\n" : "", last_modified, etag,
+                       http_connection_line(keep_alive));
+    return len < (int) size ? len : -1;
+}
+
+int http_format_range_not_satisfiable(char *buf, size_t size, off_t file_size, int keep_alive) {
+    int len = snprintf(buf, size, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\n"
+                       "Content-Length: 0\r\n%s", (long long) file_size, http_connection_line(keep_alive));
+    return len < (int) size ? len : -1;
+}
+
+// Send one piece of the body, from the cached copy or else from the file
+static int send_body_range(int fd, const file_cache_entry_t *entry, int file, off_t offset, size_t count,
+                           int flags) {
+    if (entry != NULL && entry->body != NULL) {
+        struct iovec iov;
+        iov.iov_base = entry->body + offset;
+        iov.iov_len = count;
+        return send_all(fd, &iov, 1, flags);
+    }
+    return send_file_body(fd, file, offset, count);
+}
+
+// Answer a Range request with a 206: a single range as is, several as a
+// multipart/byteranges body whose part headers are all formatted up front so
+// the Content-Length is known. Only the requested bytes are read and sent.
+static int write_ranges(int fd, const file_cache_entry_t *entry, int file, const char *resource_path,
+                        const struct stat *file_info, const http_range_t *ranges, int n_ranges, int keep_alive) {
+    char header[BUFSIZE];
+    if (n_ranges == 1) {
+        int header_len = http_format_range_header(header, sizeof(header), resource_path, file_info, &ranges[0],
+                                                  keep_alive);
+        if (header_len == -1) {
+            return -1;
+        }
+        size_t count = ranges[0].last - ranges[0].first + 1;
+        struct iovec iov;
+        iov.iov_base = header;
+        iov.iov_len = header_len;
+        if (send_all(fd, &iov, 1, MSG_MORE) == -1 ||
+            send_body_range(fd, entry, file, ranges[0].first, count, 0) == -1) {
+            return -1;
+        }
+        record_response(206, header_len + count);
+        return 0;
     }
 
-    if (fclose(socket_stream) != 0) {
-        perror("fclose");
+    const char *content_type = http_content_type(resource_path);
+    char etag[HTTP_ETAG_LEN];
+    char last_modified[HTTP_DATE_LEN];
+    if (http_format_etag(etag, sizeof(etag), file_info) == -1 ||
+        format_http_date(last_modified, sizeof(last_modified), file_info->st_mtim.tv_sec) == -1) {
         return -1;
     }
+    // the boundary only has to be absent from the parts, a per-version
+    // value made of hex digits keeps it out of their headers
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%016llx%08lx",
+             (long long) file_info->st_mtim.tv_sec * 1000000000LL + file_info->st_mtim.tv_nsec,
+             (unsigned long) file_info->st_ino);
 
+    char parts[HTTP_MAX_RANGES][RANGE_PART_HEADER];
+    int part_len[HTTP_MAX_RANGES];
+    char trailer[64];
+    size_t content_length = 0;
+    for (int i = 0; i < n_ranges; i++) {
+        part_len[i] = snprintf(parts[i], RANGE_PART_HEADER, "\r\n--%s\r\nContent-Type: %s\r\n"
+                               "Content-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary, content_type,
+                               (long long) ranges[i].first, (long long) ranges[i].last,
+                               (long long) file_info->st_size);
+        if (part_len[i] >= RANGE_PART_HEADER) {
+            return -1;
+        }
+        content_length += part_len[i] + (ranges[i].last - ranges[i].first + 1);
+    }
+    int trailer_len = snprintf(trailer, sizeof(trailer), "\r\n--%s--\r\n", boundary);
+    content_length += trailer_len;
+
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\n"
+                              "Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %zu\r\n"
+                              "%sLast-Modified: %s\r\nETag: %s\r\n%s", boundary, content_length,
+                              compress_eligible(content_type) ? "Vary: Accept-Encoding\r\n" : "",
+                              last_modified, etag, http_connection_line(keep_alive));
+    if (header_len >= (int) sizeof(header)) {
+        return -1;
+    }
+
+    // everything but the trailer is corked so parts share packets
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = header_len;
+    if (send_all(fd, &iov, 1, MSG_MORE) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < n_ranges; i++) {
+        iov.iov_base = parts[i];
+        iov.iov_len = part_len[i];
+        if (send_all(fd, &iov, 1, MSG_MORE) == -1 ||
+            send_body_range(fd, entry, file, ranges[i].first, ranges[i].last - ranges[i].first + 1,
+                            MSG_MORE) == -1) {
+            return -1;
+        }
+    }
+    iov.iov_base = trailer;
+    iov.iov_len = trailer_len;
+    if (send_all(fd, &iov, 1, 0) == -1) {
+        return -1;
+    }
+    record_response(206, header_len + content_length);
     return 0;
 }
 
-int write_http_response(int fd, const char *resource_path) {
+// Answer a Range request that can't be satisfied
+static int write_range_not_satisfiable(int fd, off_t file_size, int keep_alive) {
     char http_response[BUFSIZE];
-    char buf[BUFSIZE];
-    if (access(resource_path, F_OK) == 0) {
+    int len = http_format_range_not_satisfiable(http_response, BUFSIZE, file_size, keep_alive);
+    if (len == -1) {
+        return -1;
+    }
+    record_response(416, len);
+    return write_all(fd, http_response, len);
+}
+
+// Answer from the asset pack. The entry is viewed as a cache entry whose
+// header and body live in the mapping, so conditional, range and compressed
+// responses go through the same code as cached files.
+static int write_pack_response(int fd, const http_request_t *request, int keep_alive) {
+    long long start = metrics_now_us();
+    const pack_entry_t *packed = pack_lookup(asset_pack, request->path.data, request->path.len);
+    if (packed == NULL) {
+        metrics_record_stat(metrics_now_us() - start);
+        return write_http_error(fd, 404, keep_alive);
+    }
+    file_cache_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = (char *) pack_data(asset_pack, &packed->name);
+    entry.header = (char *) pack_data(asset_pack, &packed->header);
+    entry.header_len = packed->header.len;
+    entry.body = (char *) pack_data(asset_pack, &packed->body);
+    entry.body_len = packed->body.len;
+    struct stat file_info;
+    memset(&file_info, 0, sizeof(file_info));
+    file_info.st_ino = packed->ino;
+    file_info.st_size = packed->size;
+    file_info.st_mtim.tv_sec = packed->mtime_sec;
+    file_info.st_mtim.tv_nsec = packed->mtime_nsec;
+
+    http_range_t ranges[HTTP_MAX_RANGES];
+    int n_ranges = 0;
+    int not_modified = http_not_modified(request, &file_info);
+    if (!not_modified) {
+        n_ranges = http_parse_ranges(request, &file_info, ranges, HTTP_MAX_RANGES);
+    }
+    long long found = metrics_now_us();
+    metrics_record_stat(found - start);
+
+    int ret_val;
+    if (not_modified) {
+        ret_val = write_not_modified(fd, &file_info, keep_alive);
+    } else if (n_ranges == -1) {
+        ret_val = write_range_not_satisfiable(fd, file_info.st_size, keep_alive);
+    } else if (n_ranges > 0) {
+        ret_val = write_ranges(fd, &entry, -1, entry.path, &file_info, ranges, n_ranges, keep_alive);
+    } else {
+        // mkpack stored a compressed copy of each coding that paid off
+        int candidates = 0;
+        for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+            if (packed->encoded_body[encoding - 1].len > 0) {
+                candidates |= 1 << encoding;
+            }
+        }
+        int encoding = http_preferred_encoding(request, candidates);
+        if (encoding != ENCODING_IDENTITY) {
+            entry.header = (char *) pack_data(asset_pack, &packed->encoded_header[encoding - 1]);
+            entry.header_len = packed->encoded_header[encoding - 1].len;
+            entry.body = (char *) pack_data(asset_pack, &packed->encoded_body[encoding - 1]);
+            entry.body_len = packed->encoded_body[encoding - 1].len;
+        }
+        ret_val = send_cached_response(fd, &entry, keep_alive);
+    }
+    metrics_record_send(metrics_now_us() - found);
+    return ret_val;
+}
+
+int write_http_response(int fd, const http_request_t *request, const char *resource_path, int keep_alive) {
+    if (asset_pack != NULL && request != NULL) {
+        return write_pack_response(fd, request, keep_alive);
+    }
+
+    char http_response[BUFSIZE];
+    int file = -1;
+    struct stat file_info;
+    file_cache_entry_t *entry = NULL;
+    fd_cache_entry_t *opened = NULL;
+    file_cache_t *cache = current_file_cache();
+    long long start = metrics_now_us();
+
+    if (fd_cache != NULL) {
+        // an open descriptor and current stat, a hash lookup on a hit
+        if (fd_cache_get(fd_cache, resource_path, &opened) == -1) {
+            // file doesnt exist
+            metrics_record_stat(metrics_now_us() - start);
+            return write_http_error(fd, 404, keep_alive);
+        }
+        file = opened->fd;
+        file_info = opened->info;
+        if (cache != NULL) {
+            entry = file_cache_get_open(cache, resource_path, file, &file_info);
+        }
+    } else if (cache != NULL) {
+        if (file_cache_get(cache, resource_path, &entry, &file, &file_info) == -1) {
+            // file doesnt exist
+            metrics_record_stat(metrics_now_us() - start);
+            return write_http_error(fd, 404, keep_alive);
+        }
+    } else if (stat(resource_path, &file_info) != 0) {
+        // file doesnt exist
+        metrics_record_stat(metrics_now_us() - start);
+        return write_http_error(fd, 404, keep_alive);
+    }
+
+    // the client's copy is current, or it asked for bytes that don't
+    // exist: answer without opening the file
+    http_range_t ranges[HTTP_MAX_RANGES];
+    int n_ranges = 0;
+    int not_modified = http_not_modified(request, &file_info);
+    if (!not_modified) {
+        n_ranges = http_parse_ranges(request, &file_info, ranges, HTTP_MAX_RANGES);
+    }
+    if (not_modified || n_ranges == -1) {
+        metrics_record_stat(metrics_now_us() - start);
+        if (entry != NULL) {
+            file_cache_release(entry);
+        }
+        if (opened != NULL) {
+            fd_cache_release(opened);
+        } else if (file != -1) {
+            close(file);
+        }
+        if (not_modified) {
+            return write_not_modified(fd, &file_info, keep_alive);
+        }
+        return write_range_not_satisfiable(fd, file_info.st_size, keep_alive);
+    }
+
+    if (cache == NULL && opened == NULL) {
         // file exists
-        int file = open(resource_path, O_RDONLY);
+        file = open(resource_path, O_RDONLY);
         if(file == -1) {
             perror("open");
             return -1;
         }
 
         // get file size
-        struct stat file_info;
         if(fstat(file, &file_info) == -1) {
             perror("fstat");
-            return -1;
-        }
-        int content_length = file_info.st_size;
-
-        int bytes_written;
-        int bytes_read;
-
-        // get file type
-        const char *extension = strrchr(resource_path, '.');
-        if (extension == NULL) {
-            perror("strrchr");
-            close(file);
-            return -1;
-        }
-        const char *content_type = get_mime_type(extension);
-        if (content_type == NULL) {
-            printf("error getting content type for http repsonse");
             close(file);
             return -1;
         }
+    }
 
-        // constructs http_response header
-        sprintf(http_response, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n", content_type, content_length);
+    long long found = metrics_now_us();
+    metrics_record_stat(found - start);
 
-        // write http_response header
-        bytes_written = write(fd, http_response, strlen(http_response));
+    // whole-file responses go out compressed if the client accepts a coding
+    // we have; ranges always refer to the identity bytes
+    http_sibling_t sibling = {.fd = -1};
+    int encoding = ENCODING_IDENTITY;
+    if (n_ranges == 0) {
+        encoding = http_negotiate_encoding(request, resource_path, &file_info, opened,
+                                           entry != NULL && entry->body != NULL, &sibling);
+    }
 
-        if (bytes_written < 0) {
-            perror("write");
-            close(file);
-            return -1;
+    int ret_val = 1;
+    if (encoding != ENCODING_IDENTITY) {
+        ret_val = write_encoded(fd, entry, resource_path, &file_info, encoding, &sibling, keep_alive);
+    }
+    if (sibling.owned) {
+        close(sibling.fd);
+    }
+    if (ret_val != 1) {
+        // sent compressed, or failed trying
+    } else if (n_ranges > 0) {
+        ret_val = write_ranges(fd, entry, file, resource_path, &file_info, ranges, n_ranges, keep_alive);
+    } else if (entry != NULL && entry->body != NULL) {
+        // cache hit (or freshly loaded), served straight from memory
+        ret_val = send_cached_response(fd, entry, keep_alive);
+    } else {
+        // stream the file from the descriptor, using the cached header if
+        // there is one
+        struct iovec iov[2];
+        ret_val = 0;
+        if (entry != NULL) {
+            iov[0].iov_base = entry->header;
+            iov[0].iov_len = entry->header_len;
+        } else {
+            int header_len = http_format_header(http_response, BUFSIZE, resource_path, &file_info);
+            if (header_len == -1) {
+                fprintf(stderr, "write_http_response: header for %s doesn't fit\n", resource_path);
+                ret_val = -1;
+            }
+            iov[0].iov_base = http_response;
+            iov[0].iov_len = header_len;
         }
+        const char *connection = http_connection_line(keep_alive);
+        iov[1].iov_base = (void *) connection;
+        iov[1].iov_len = strlen(connection);
+        size_t header_bytes = iov[0].iov_len + iov[1].iov_len;
 
-        // read file data and write to TCP fd in chunks
-        while((bytes_read = read(file, buf, BUFSIZE)) > 0) {
-            if(bytes_read == -1) {
-                perror("read");
-                close(file);
-                return -1;
-            }
-            int total_written = 0;
-            while(total_written < bytes_read) {
-                bytes_written = write(fd, buf, bytes_read - total_written);
-                if(bytes_written < 0) {
-                    perror("write");
-                    close(file);
-                    return -1;
-                }
-                total_written += bytes_written;
-            }
+        // write http_response header, corked so it leaves with the first
+        // body bytes, then send the file data to the TCP fd
+        if (ret_val == 0 && (send_all(fd, iov, 2, file_info.st_size > 0 ? MSG_MORE : 0) == -1 ||
+                             send_file_body(fd, file, 0, file_info.st_size) == -1)) {
+            ret_val = -1;
         }
-    } else {
-        // file doesnt exist
-        strcpy(http_response, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
-        
-        if(write(fd, http_response, strlen(http_response)) < 0) {
-            perror("write");
-            return -1;
+        if (ret_val == 0) {
+            record_response(200, header_bytes + file_info.st_size);
         }
     }
-    
-    return 0;
+    metrics_record_send(metrics_now_us() - found);
+
+    if (entry != NULL) {
+        file_cache_release(entry);
+    }
+    if (opened != NULL) {
+        fd_cache_release(opened);
+    } else if (file != -1 && close(file) == -1) {
+        perror("close");
+        return -1;
+    }
+    return ret_val;
 }
@@ -1,20 +1,364 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "arena.h"
+#include "fd_cache.h"
+#include "file_cache.h"
+#include "pack.h"
+
+// Strategies for moving a file body onto the client socket
+#define SEND_MODE_COPY 0     // read()/write() through a user-space buffer
+#define SEND_MODE_SENDFILE 1 // sendfile(2), zero-copy from the page cache
+#define SEND_MODE_SPLICE 2   // splice(2) through a pipe, zero-copy
+
+/*
+ * Select how write_http_response sends file bodies. Must be called before any
+ * worker threads start. The build-time default is DEFAULT_SEND_MODE.
+ * mode_name: One of "copy", "sendfile" or "splice"
+ * Returns 0 on success or -1 if the mode name is not recognized
+ */
+int http_set_send_mode(const char *mode_name);
+
+/*
+ * Serve files through an in-memory content cache. Must be called before any
+ * worker threads start. Passing NULL (the default) reads every file from disk.
+ */
+void http_set_file_cache(file_cache_t *cache);
+
+/*
+ * Serve the calling thread's requests through 'cache' instead of the one
+ * given to http_set_file_cache, so threads on one NUMA node can share a
+ * cache whose memory is on that node. NULL goes back to the shared one.
+ */
+void http_set_thread_file_cache(file_cache_t *cache);
+
+/*
+ * Give the calling thread an arena for per-request scratch space such as
+ * the copy buffer of the copy send mode. The owner resets it once each
+ * response is written. Without one (NULL, the default) small stack
+ * buffers are used.
+ */
+void http_set_thread_arena(arena_t *arena);
+
+/*
+ * Keep served files open in a descriptor cache invalidated by inotify, so a
+ * request for a known file makes no stat, open or close call. Works with or
+ * without the content cache. Must be called before any worker threads
+ * start; NULL (the default) opens the file for every request.
+ */
+void http_set_fd_cache(fd_cache_t *cache);
+
+/*
+ * Serve every file from an asset pack instead of the directory: requests are
+ * looked up by path in the pack's index and answered from the mapping, with
+ * no filesystem calls. Must be called before any worker threads start.
+ */
+void http_set_pack(const pack_t *pack);
+
+// Sent for files whose extension is missing or not in the MIME table
+#define HTTP_DEFAULT_CONTENT_TYPE "application/octet-stream"
+
+/*
+ * Get the MIME type for a file extension such as ".html". The table is
+ * generated from mime.types at build time as a perfect hash, so a lookup
+ * costs two hashes and a single strcmp whatever the extension.
+ * Returns the type, or NULL if the extension is not recognized
+ */
+const char *get_mime_type(const char *file_extension);
+
+// Room for a quoted ETag as formatted by http_format_etag
+#define HTTP_ETAG_LEN 64
+
+/*
+ * Format the ETag of a version of a file. It changes whenever the file's
+ * inode, size or modification time does.
+ * Returns the length of the ETag, quotes included, or -1 if it doesn't fit
+ */
+int http_format_etag(char *buf, size_t size, const struct stat *file_info);
+
+/*
+ * Format the start of a 200 response for a file: the status line,
+ * Content-Type, Content-Length, Last-Modified and ETag. The Connection line
+ * and the blank line ending the header are not included.
+ * buf: Buffer to format into
+ * size: Size of 'buf' in bytes
+ * resource_path: Path to the file, its extension determines the Content-Type
+ * file_info: The file's stat information, for its size and version
+ * Returns the length of the formatted header, or -1 if it doesn't fit
+ */
+int http_format_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info);
+
+/*
+ * Returns the MIME type of a file going by its extension, or
+ * HTTP_DEFAULT_CONTENT_TYPE if it has none or it is not recognized
+ */
+const char *http_content_type(const char *resource_path);
+
+/*
+ * Format the start of a 200 response carrying a compressed copy of a file,
+ * like http_format_header but with Content-Encoding, the compressed length
+ * and an ETag that names the coding
+ * encoding: ENCODING_GZIP or ENCODING_BR
+ * body_len: Length of the compressed body in bytes
+ * Returns the length of the formatted header, or -1 on error
+ */
+int http_format_encoded_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info,
+                               int encoding, off_t body_len);
+
+// Largest request header we are willing to wait for
+#define MAX_REQUEST_HEADER 8192
+#define MAX_HEADERS 32
+
+// Returned by read_http_request when the peer closed before sending a request
+#define HTTP_CONN_CLOSED 1
+// Returned by read_http_request for requests that deserve an error response
+#define HTTP_BAD_REQUEST 2      // malformed or more than MAX_HEADERS headers
+#define HTTP_HEADER_TOO_LARGE 3 // no end of header within MAX_REQUEST_HEADER bytes
+// Returned by http_parse_buffered when the header hasn't fully arrived yet
+#define HTTP_NEED_MORE 4
+
+// A view of bytes inside a connection's receive buffer. Not NUL-terminated.
+typedef struct {
+    const char *data;
+    size_t len;
+} http_slice_t;
+
+typedef struct {
+    http_slice_t name;
+    http_slice_t value;
+} http_header_t;
+
+// A parsed request. All slices point into the http_conn_t it was read from
+// and stay valid until the next read_http_request on that connection.
+typedef struct {
+    http_slice_t method;
+    http_slice_t path;
+    http_slice_t version;
+    http_header_t headers[MAX_HEADERS];
+    int n_headers;
+    int keep_alive; // 1 if the client wants the connection kept open
+} http_request_t;
+
+// Per-connection receive buffer. Bytes read past the end of one request
+// (pipelined requests) stay here for the next read_http_request.
+typedef struct {
+    int fd;
+    size_t len;      // bytes currently in buf
+    size_t consumed; // bytes belonging to the request most recently returned
+    size_t scanned;  // bytes already searched for the end of the header
+    char buf[MAX_REQUEST_HEADER];
+} http_conn_t;
+
+/*
+ * Prepare an empty receive buffer for a newly accepted socket
+ */
+void http_conn_init(http_conn_t *conn, int fd);
+
+/*
+ * Get the number of bytes already buffered past the last request returned,
+ * i.e. the start of a pipelined request
+ */
+size_t http_conn_pending(const http_conn_t *conn);
+
+/*
+ * Parse the next request out of bytes already in the connection's buffer,
+ * without reading from the socket. For callers that do their own I/O: when
+ * HTTP_NEED_MORE is returned, append more bytes at conn->buf + conn->len,
+ * add their count to conn->len and call again.
+ * conn: The connection's buffer
+ * request: Filled in on success, pointing into conn's buffer
+ * Returns 0 on success, HTTP_NEED_MORE, HTTP_BAD_REQUEST or
+ * HTTP_HEADER_TOO_LARGE
+ */
+int http_parse_buffered(http_conn_t *conn, http_request_t *request);
+
+/*
+ * Read the next HTTP request from a connection. Data is received in large
+ * chunks and parsed in place, so a request may arrive split across any
+ * number of reads. The request line and headers are returned as slices.
+ * conn: The connection to read from
+ * request: Filled in on success
+ * Returns 0 on success, HTTP_CONN_CLOSED if the client closed the connection
+ * cleanly before sending anything, HTTP_BAD_REQUEST or HTTP_HEADER_TOO_LARGE
+ * if the request violates the parser's limits, or -1 on error
+ */
+int read_http_request(http_conn_t *conn, http_request_t *request);
+
 /*
- * Read an HTTP request from an active TCP connection socket
+ * Find a request header by name (case-insensitive)
+ * Returns the header's value, or NULL if the request doesn't have it
+ */
+const http_slice_t *http_get_header(const http_request_t *request, const char *name);
+
+/*
+ * Returns 1 if 'slice' equals 'str' ignoring case, 0 otherwise
+ */
+int http_slice_equals(const http_slice_t *slice, const char *str);
+
+/*
+ * Build the file system path for a request's target
+ * request: A request returned by read_http_request
+ * serve_dir: Directory the server is serving files from
+ * resource_path: Set to serve_dir followed by the request path
+ * size: Size of 'resource_path' in bytes
+ * Returns 0 on success, HTTP_BAD_REQUEST if the request path doesn't start
+ * with '/' or has a ".." segment that could lead out of serve_dir, or -1 if
+ * the path doesn't fit
+ */
+int http_resolve_path(const http_request_t *request, const char *serve_dir, char *resource_path, size_t size);
+
+/*
+ * Check without blocking or consuming anything whether a complete request
+ * header is waiting in a socket's receive buffer.
+ * fd: The socket's file descriptor
+ * scanned: Bytes already searched by earlier calls for the same request,
+ *          updated so the next call only searches new ones. NULL searches
+ *          everything.
+ * Returns 1 if a request is ready for read_http_request, including a header
+ * that exceeds MAX_REQUEST_HEADER and will be answered with a 431, 0 if more
+ * data is needed, or -1 if the peer hung up or an error occurred
+ */
+int http_request_ready(int fd, size_t *scanned);
+
+/*
+ * Check a request's If-None-Match and If-Modified-Since headers against a
+ * file. If-None-Match wins when both are present, as RFC 9110 requires.
+ * request: The request, or NULL for an unconditional one
+ * file_info: The stat information of the file that would be sent
+ * Returns 1 if the client's copy is current and a 304 should be sent, 0 otherwise
+ */
+int http_not_modified(const http_request_t *request, const struct stat *file_info);
+
+/*
+ * Format a bodyless 304 Not Modified response for a file, repeating the
+ * validators the 200 response would have carried
+ * Returns the length of the response, or -1 if it doesn't fit in 'size'
+ */
+int http_format_not_modified(char *buf, size_t size, const struct stat *file_info, int keep_alive);
+
+// Most byte ranges one response will carry. Requests for more get the
+// whole file, which also stops tiny ranges from multiplying the work.
+#define HTTP_MAX_RANGES 16
+
+// One satisfiable byte range, both ends inclusive and inside the file
+typedef struct {
+    off_t first;
+    off_t last;
+} http_range_t;
+
+/*
+ * Parse a request's Range header against the file it selects, honoring
+ * If-Range. Malformed headers and units other than bytes are ignored, as
+ * RFC 9110 allows.
+ * request: The request, or NULL
+ * file_info: The stat information of the requested file
+ * ranges: Filled in with the satisfiable ranges, in request order
+ * max_ranges: Size of 'ranges'
+ * Returns the number of ranges to send, 0 to send the whole file, or -1 if
+ * no requested range overlaps the file and a 416 should be sent
+ */
+int http_parse_ranges(const http_request_t *request, const struct stat *file_info,
+                      http_range_t *ranges, int max_ranges);
+
+/*
+ * Format the complete header of a 206 response carrying a single range
+ * Returns the length of the header, or -1 if it doesn't fit
+ */
+int http_format_range_header(char *buf, size_t size, const char *resource_path, const struct stat *file_info,
+                             const http_range_t *range, int keep_alive);
+
+/*
+ * Format a 416 Range Not Satisfiable response for a file of 'file_size' bytes
+ * Returns the length of the response, or -1 if it doesn't fit in 'size'
+ */
+int http_format_range_not_satisfiable(char *buf, size_t size, off_t file_size, int keep_alive);
+
+/*
+ * Returns the encoding the client prefers among those in 'candidates' (a bit
+ * per encoding, 1 << ENCODING_GZIP and so on) going by its Accept-Encoding,
+ * or ENCODING_IDENTITY if it accepts none of them
+ */
+int http_preferred_encoding(const http_request_t *request, int candidates);
+
+// The precompressed sibling http_negotiate_encoding chose to send
+typedef struct {
+    int fd;           // -1 if the body doesn't come from a sibling
+    struct stat info;
+    int owned;        // 1 if the caller closes fd, 0 if the fd cache entry holds it
+} http_sibling_t;
+
+/*
+ * Choose the content coding of a whole-file response from the request's
+ * Accept-Encoding, honouring q-values. A precompressed sibling (the path with
+ * .br or .gz appended, no older than the file) is preferred; otherwise the
+ * body is compressed on the fly if 'can_compress' and the server was built
+ * with the coding. Files whose type is already compressed are sent as is.
+ * opened: The file's fd cache entry, whose siblings are used instead of
+ *     probing the filesystem, or NULL
+ * sibling: Set to the sibling to send, fd -1 if there is none
+ * Returns ENCODING_IDENTITY, ENCODING_GZIP or ENCODING_BR
+ */
+int http_negotiate_encoding(const http_request_t *request, const char *resource_path,
+                            const struct stat *file_info, fd_cache_entry_t *opened, int can_compress,
+                            http_sibling_t *sibling);
+
+/*
+ * Write an HTTP/1.1 response to an active TCP connection socket
  * fd: The socket's file descriptor
- * resource_name: Set to the name of the requested resource on success
+ * request: The request being answered, for its conditional headers. May be NULL.
+ * resource_path: The path to the requested resource in the server's file system,
+ *                unused with a pack (see http_set_pack), which goes by the
+ *                request's path
+ * keep_alive: Whether to announce that the connection stays open afterwards
  * Returns 0 on success or -1 on error
  */
-int read_http_request(int fd, char *resource_name);
+int write_http_response(int fd, const http_request_t *request, const char *resource_path, int keep_alive);
 
 /*
- * Write an HTTP response to an active TCP connection socket
+ * Write a bodyless error response such as 404 Not Found
  * fd: The socket's file descriptor
- * resource_path: The path to the requested resource in the server's file system
+ * status: The HTTP status code
+ * keep_alive: Whether to announce that the connection stays open afterwards
  * Returns 0 on success or -1 on error
  */
-int write_http_response(int fd, const char *resource_path);
+int write_http_error(int fd, int status, int keep_alive);
+
+/*
+ * Format the bodyless error response that write_http_error would send
+ * Returns the length of the response, or -1 if it doesn't fit in 'size'
+ */
+int http_format_error(char *buf, size_t size, int status, int keep_alive);
+
+/*
+ * Format the 503 Service Unavailable response sent to a shed connection,
+ * which asks the client to retry after 'retry_after' seconds and closes
+ * Returns the length of the response, or -1 if it doesn't fit in 'size'
+ */
+int http_format_unavailable(char *buf, size_t size, int retry_after);
+
+/*
+ * The Connection header line plus the blank line that ends a response header
+ */
+const char *http_connection_line(int keep_alive);
+
+/*
+ * Write a 200 response whose body was generated by the server rather than
+ * read from a file, such as the metrics page
+ * fd: The socket's file descriptor
+ * content_type: Value of the Content-Type header
+ * body: The response body
+ * body_len: Length of 'body' in bytes
+ * keep_alive: Whether to announce that the connection stays open afterwards
+ * Returns 0 on success or -1 on error
+ */
+int write_http_body(int fd, const char *content_type, const char *body, size_t body_len, int keep_alive);
+
+/*
+ * Get the status code and size (header included) of the last response the
+ * calling thread wrote with one of the write_http functions, for logging
+ */
+void http_last_response(int *status, size_t *bytes);
 
 #endif // HTTP_H
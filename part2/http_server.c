@@ -1,104 +1,646 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "access_log.h"
+#include "admission.h"
+#include "arena.h"
+#include "deadline.h"
 #include "connection_queue.h"
+#include "fd_cache.h"
+#include "file_cache.h"
+#include "handoff.h"
 #include "http.h"
+#include "metrics.h"
+#include "pack.h"
+#include "reactor.h"
+#include "topology.h"
+#include "uring_engine.h"
 
 #define BUFSIZE 512
-#define LISTEN_QUEUE_LEN 5
+#define METRICS_BUFSIZE 4096
+#define LISTEN_QUEUE_LEN 5 // defaults, see -b, -n and -q
 #define N_THREADS 5
 
+// How the main thread accepts connections and feeds the worker pool
+#define ENGINE_THREADS 0 // blocking accept(), workers block reading the request
+#define ENGINE_EPOLL 1   // epoll reactor, workers only get fully arrived requests
+#define ENGINE_URING 2   // one io_uring thread per group does all the I/O, no workers
+
+#define DEFAULT_KEEP_ALIVE_TIMEOUT 5 // seconds
+#define DEFAULT_MAX_REQUESTS 100     // per connection
+#define RESTART_BACKOFF_MS 1000      // before restarting a worker process that died right away
+#define DEFAULT_DRAIN_SECS 10        // for queued and in-flight requests once the server stops
+#define DRAIN_IDLE_GRACE_MS 500      // for a kept-alive client's request already on its way
+#define WAKE_INTERVAL_MS 100         // between signals to an acceptor thread that won't stop
+
+// Elastic pool (-N): how often the monitor looks at the queue, and the
+// defaults for when it adds a worker or lets an idle one go
+#define ELASTIC_SAMPLE_MS 10
+#define DEFAULT_GROW_DEPTH 4       // connections waiting
+#define DEFAULT_GROW_WAIT_MS 50    // queue non-empty for this long
+#define DEFAULT_IDLE_RETIRE 30     // seconds
+
+#define WORKER_FREE 0    // slot never used
+#define WORKER_RUNNING 1
+#define WORKER_EXITED 2  // retired, waiting to be joined
+
+struct server_group;
+
+// One slot in a group's worker pool
+typedef struct {
+    pthread_t thread;
+    int state;
+    int id;                    // metrics slot, unique across all groups
+    struct server_group *group;
+} worker_slot_t;
+
+// A listening socket together with the connection queue and worker pool it
+// feeds. Normally there is a single group whose acceptor is the main thread.
+// With -a N there are N groups on SO_REUSEPORT sockets bound to the same
+// port, each with its own acceptor thread, so the kernel spreads incoming
+// connections and no accept loop or queue lock is shared between them.
+typedef struct server_group {
+    int index;
+    int listen_fd;
+    connection_queue_t queue;
+    reactor_t reactor;
+    reactor_t *active_reactor; // &reactor for ENGINE_EPOLL, NULL otherwise
+    pthread_t acceptor;
+    worker_slot_t *pool;       // max_threads slots
+    int n_workers;             // workers running, protected by pool_lock
+    int n_idle;                // workers waiting in connection_dequeue
+    pthread_mutex_t pool_lock;
+    pthread_t monitor;         // grows the pool in elastic mode
+    int monitor_started;
+    int cpu;                   // core the acceptor is pinned to, or -1
+    int node;                  // NUMA node of that core
+    cpu_set_t node_cpus;       // allowed cores on the node, for the other threads
+    file_cache_t *cache;       // content cache its threads serve from, or NULL
+} server_group_t;
+
 int keep_going = 1;
 const char *serve_dir;
+int engine = ENGINE_THREADS;
+int keep_alive_timeout_ms = DEFAULT_KEEP_ALIVE_TIMEOUT * 1000;
+int max_requests_per_conn = DEFAULT_MAX_REQUESTS;
+size_t cache_budget = FILE_CACHE_DEFAULT_BUDGET; // 0 disables the content cache
+int verbose = 0;
+file_cache_t cache;
+int max_open_files = FD_CACHE_DEFAULT_ENTRIES; // 0 opens files per request
+fd_cache_t fd_cache;
+int fd_cache_started = 0;
+pack_t pack;
+int use_pack = 0; // serve_dir names an asset pack rather than a directory
+#define QUEUE_MUTEX 0
+#define QUEUE_LOCKFREE 1 // lock-free MPMC ring
+#define QUEUE_STEALING 2 // per-worker deques with work stealing
+
+int queue_type = QUEUE_MUTEX;
+int steal_policy = STEAL_ROUND_ROBIN;
+size_t queue_capacity = CAPACITY;
+int listen_backlog = LISTEN_QUEUE_LEN;
+int min_threads = N_THREADS;  // workers per group, always running
+int max_threads = 0;          // above min_threads makes the pool elastic
+int grow_depth = DEFAULT_GROW_DEPTH;
+int grow_wait_ms = DEFAULT_GROW_WAIT_MS;
+int idle_retire_ms = DEFAULT_IDLE_RETIRE * 1000;
+const char *access_log_path = NULL; // no access log unless -L is given
+int access_log_flush_ms = ACCESS_LOG_DEFAULT_FLUSH_MS;
+int max_inflight = 0;         // 0: no admission limit
+int queue_wait_ms = -1;       // -1: acceptors block on a full queue
+int retry_after = ADMISSION_DEFAULT_RETRY_AFTER;
+int header_timeout_ms = DEADLINE_DEFAULT_HEADER_SECS * 1000; // 0: no limit
+int send_timeout_ms = DEADLINE_DEFAULT_SEND_SECS * 1000;     // 0: no limit
+int min_send_rate = 0;        // bytes per second, 0 only requires progress
+int n_acceptors = 0;         // 0: the main thread accepts on a single socket
+int pin_threads = 0;
+cpu_set_t pin_cpus;           // CPUs -C allows, every available one without it
+int pin_cpus_given = 0;
+int process_index = 0;        // which worker process this is in prefork mode
+file_cache_t *node_caches[TOPOLOGY_MAX_NODES]; // per-node content caches, see init_caches
+int n_processes = 0;          // 0: serve from this process, no supervisor
+int drain_timeout_ms = DEFAULT_DRAIN_SECS * 1000;
+long drain_deadline = -1;     // CLOCK_MONOTONIC ms, set once the server stops
+int drain_expired = 0;        // queued connections are shed, in-flight ones cut off
+const char *handoff_path = NULL; // control socket for zero-downtime restarts (-U)
+int control_fd = -1;
+int handed_off = 0;           // a new server has the listening sockets
+int shutdown_pipe[2];        // becomes readable once the server stops, wakes idle workers
 
 void handle_sigint(int signo) {
     keep_going = 0;
 }
 
-void* thread_func(void* arg) {
+// SIGUSR2 only interrupts an acceptor thread's blocking call, see stop_acceptors
+void handle_wakeup(int signo) {
+}
+
+static long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+// When the drain has to be over, counted from the first call after the
+// server stops
+long drain_deadline_ms(void) {
+    long deadline = __atomic_load_n(&drain_deadline, __ATOMIC_ACQUIRE);
+    if (deadline == -1) {
+        long expected = -1;
+        deadline = monotonic_ms() + drain_timeout_ms;
+        if (!__atomic_compare_exchange_n(&drain_deadline, &expected, deadline, 0, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            deadline = expected;
+        }
+    }
+    return deadline;
+}
+
+// Returns the milliseconds left until the drain deadline, 0 once it passed
+int drain_time_left_ms(void) {
+    long left = drain_deadline_ms() - monotonic_ms();
+    return left > 0 ? left : 0;
+}
+
+// The drain ran out of time: cut off the responses still going out, and
+// have workers turn away whatever is still queued with a 503
+void end_drain(void) {
+    if (__atomic_exchange_n(&drain_expired, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (verbose) {
+            fprintf(stderr, "Drain deadline passed, cutting off the remaining connections\n");
+        }
+        deadline_expire_all();
+    }
+}
+
+// Join a thread, giving up after 'timeout_ms'
+// Returns 0 on success, ETIMEDOUT, or another error number
+int join_timed(pthread_t thread, void **thread_result, long timeout_ms) {
+    // pthread_timedjoin_np waits against CLOCK_REALTIME
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_timedjoin_np(thread, thread_result, &deadline);
+}
+
+// Join a worker, ending the drain if it is still busy at the deadline
+// Returns 0 on success or an error number
+int join_within_drain(pthread_t thread) {
+    if (!__atomic_load_n(&drain_expired, __ATOMIC_ACQUIRE)) {
+        int result = join_timed(thread, NULL, drain_time_left_ms());
+        if (result != ETIMEDOUT) {
+            return result;
+        }
+        end_drain();
+    }
+    return pthread_join(thread, NULL);
+}
+
+// Wait for a client to send its next request. Once the server stops a new
+// client is still owed its first response and has until the drain deadline
+// to ask for it. A kept-alive client gets DRAIN_IDLE_GRACE_MS, enough for a
+// request it sent before seeing the connection close.
+// first: Nothing has been answered on the connection yet
+// Returns 1 if the client has data (or hung up), 0 on idle timeout or shutdown
+int wait_for_next_request(int client_fd, int first) {
+    struct pollfd fds[2];
+    fds[0].fd = client_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = shutdown_pipe[0];
+    fds[1].events = POLLIN;
+    int n_fds = 2;
+    int timeout = keep_alive_timeout_ms;
+    while (1) {
+        if (keep_going == 0 && n_fds == 2) {
+            // the shutdown pipe has nothing more to say
+            n_fds = 1;
+            int left = drain_time_left_ms();
+            if (!first && left > DRAIN_IDLE_GRACE_MS) {
+                left = DRAIN_IDLE_GRACE_MS;
+            }
+            timeout = left < timeout ? left : timeout;
+        }
+        int n = poll(fds, n_fds, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return 0;
+        }
+        if (n == 0) {
+            if (n_fds == 2 || first) {
+                metrics_record_timeout(n_fds == 2 ? METRICS_TIMEOUT_IDLE : METRICS_TIMEOUT_DRAIN);
+            }
+            return 0;
+        }
+        if (n_fds == 2 && fds[1].revents != 0) {
+            continue;
+        }
+        return 1;
+    }
+}
+
+// Answer a request for METRICS_PATH with the current totals
+// Returns 0 on success or -1 on error
+int write_metrics(int client_fd, int json, int keep_alive) {
+    char body[METRICS_BUFSIZE];
+    int body_len = metrics_format(body, sizeof(body), json);
+    if (body_len == -1) {
+        return write_http_error(client_fd, 500, keep_alive);
+    }
+    return write_http_body(client_fd, json ? "application/json" : "text/plain",
+                           body, body_len, keep_alive);
+}
+
+// Format a connected client's address for the access log
+void client_address(int client_fd, char *buf, size_t size) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    const char *result = NULL;
+    if (getpeername(client_fd, (struct sockaddr *) &addr, &addr_len) == 0) {
+        if (addr.ss_family == AF_INET) {
+            result = inet_ntop(AF_INET, &((struct sockaddr_in *) &addr)->sin_addr, buf, size);
+        } else if (addr.ss_family == AF_INET6) {
+            result = inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr, buf, size);
+        }
+    }
+    if (result == NULL) {
+        snprintf(buf, size, "-");
+    }
+}
+
+// Queue an access log entry for the response just written
+void log_request(const char *peer, const http_request_t *request, long long start) {
+    if (access_log_enabled()) {
+        int status;
+        size_t bytes;
+        http_last_response(&status, &bytes);
+        access_log_request(peer, request, status, bytes, metrics_now_us() - start);
+    }
+}
+
+// A request is done, give its scratch space back to the worker's arena
+void end_request(arena_t *arena) {
+    if (arena != NULL && arena->used > 0) {
+        arena_reset(arena);
+        metrics_record_pool(METRICS_POOL_ARENA, arena->stats.reserved, arena->stats.high_water);
+    }
+}
+
+// Answer requests on a connection until the client or the keep-alive policy
+// ends it. Pipelined requests that are already buffered are answered back to
+// back. The fd is closed or, in the epoll engine, handed back to the reactor.
+// arena: The worker's per-request scratch space, or NULL
+void serve_connection(server_group_t *group, int client_fd, arena_t *arena) {
+    reactor_t *reactor = group->active_reactor;
+    http_conn_t conn;
+    http_request_t request;
     char resource_name[BUFSIZE];
+    char peer[INET6_ADDRSTRLEN] = "-";
+    deadline_timer_t timer;
+    int served = 0;
+    if (reactor != NULL) {
+        served = reactor_requests_served(reactor, client_fd);
+    }
+    if (access_log_enabled()) {
+        client_address(client_fd, peer, sizeof(peer));
+    }
+    http_conn_init(&conn, client_fd);
+    deadline_timer_init(&timer, client_fd);
+
+    while (1) {
+        // In the threads engine nothing has been read yet, so the same idle
+        // timeout covers the wait for the first request (-k 0 only turns
+        // keep-alive off, the first request is still read)
+        if (reactor == NULL && keep_alive_timeout_ms > 0 && http_conn_pending(&conn) == 0 &&
+            !wait_for_next_request(client_fd, served == 0)) {
+            break;
+        }
+
+        // from here the whole header has to arrive in time, and after it
+        // the response has to keep moving
+        deadline_arm(&timer, DEADLINE_HEADER);
+        long long start = metrics_now_us();
+        int result = read_http_request(&conn, &request);
+        metrics_record_parse(metrics_now_us() - start);
+        deadline_arm(&timer, DEADLINE_SEND);
+        if (result == HTTP_CONN_CLOSED || result == -1) {
+            break;
+        }
+        if (result == HTTP_BAD_REQUEST || result == HTTP_HEADER_TOO_LARGE) {
+            // the rest of the stream can't be trusted, answer and hang up
+            write_http_error(client_fd, result == HTTP_BAD_REQUEST ? 400 : 431, 0);
+            log_request(peer, NULL, start);
+            break;
+        }
+        if (!http_slice_equals(&request.method, "GET")) {
+            write_http_error(client_fd, 501, 0);
+            log_request(peer, &request, start);
+            break;
+        }
+
+        int keep_alive = request.keep_alive;
+        served++;
+        if (served >= max_requests_per_conn || keep_alive_timeout_ms == 0 || keep_going == 0) {
+            keep_alive = 0;
+        }
+
+        int metrics_json = http_slice_equals(&request.path, METRICS_JSON_PATH);
+        if (metrics_json || http_slice_equals(&request.path, METRICS_PATH)) {
+            if (write_metrics(client_fd, metrics_json, keep_alive) == -1) {
+                break;
+            }
+            log_request(peer, &request, start);
+        } else {
+            // gets the correct directory for file requests
+            int resolved = http_resolve_path(&request, serve_dir, resource_name, BUFSIZE);
+            if (resolved != 0) {
+                write_http_error(client_fd, resolved == HTTP_BAD_REQUEST ? 400 : 414, 0);
+                log_request(peer, &request, start);
+                break;
+            } // serve_dir/resource_name
+
+            // failures have already been reported where they happened
+            if (write_http_response(client_fd, &request, resource_name, keep_alive) == -1) {
+                break;
+            }
+            log_request(peer, &request, start);
+        }
+        metrics_record_request(metrics_now_us() - start);
+        end_request(arena);
+        if (!keep_alive) {
+            break;
+        }
+        deadline_disarm(&timer);
+
+        // Answer a pipelined request right away, otherwise let the reactor
+        // hold the idle connection instead of this worker. A partially
+        // buffered request has to be finished here since the reactor only
+        // sees what is still in the socket.
+        if (reactor != NULL && http_conn_pending(&conn) == 0 && http_request_ready(client_fd, NULL) != 1) {
+            admission_leave(); // parked clients don't count against the limit
+            deadline_disarm(&timer);
+            reactor_park(reactor, client_fd, served);
+            return;
+        }
+    }
+
+    end_request(arena); // in case the loop ended mid-request
+    admission_leave();
+    deadline_disarm(&timer);
+    if (close(client_fd) == -1) {
+        perror("close");
+    }
+}
+
+// Called by a worker that has been idle for idle_retire_ms
+// Returns 1 if the worker should exit, 0 if the pool needs it
+int worker_retire(worker_slot_t *slot) {
+    server_group_t *group = slot->group;
+    int retire = 0;
+    pthread_mutex_lock(&group->pool_lock);
+    if (group->n_workers > min_threads) {
+        group->n_workers--;
+        slot->state = WORKER_EXITED;
+        retire = 1;
+        metrics_record_worker_retired();
+    }
+    pthread_mutex_unlock(&group->pool_lock);
+    return retire;
+}
+
+// Take connections off the group's queue and serve them until shutdown, or
+// until the worker retires in elastic mode
+void worker_loop(worker_slot_t *slot, arena_t *arena) {
     int client_fd;
-    connection_queue_t* queue = (connection_queue_t *) arg;
+    server_group_t *group = slot->group;
+    connection_queue_t* queue = &group->queue;
+    int idle_timeout = max_threads > min_threads ? idle_retire_ms : -1;
 
-    // loop until we receive a shutdown
-    // dequeue a client fd, read its http request, and write back http response
-    while(queue->shutdown != 1) {
-        client_fd = connection_dequeue(queue);
+    if (connection_queue_register_worker(queue) == -1) {
+        printf("connection_queue_register_worker error\n");
+        return;
+    }
+
+    // loop until the queue is shut down and empty, so connections still
+    // queued when the server stops are answered rather than dropped
+    // dequeue a client fd, read its http requests, and write back http responses
+    while (1) {
+        __atomic_add_fetch(&group->n_idle, 1, __ATOMIC_RELAXED);
+        client_fd = connection_dequeue_timed(queue, idle_timeout);
+        __atomic_sub_fetch(&group->n_idle, 1, __ATOMIC_RELAXED);
+        long long queue_wait = metrics_connection_dequeued(client_fd);
+        if (client_fd == CONNECTION_QUEUE_TIMEOUT) {
+            if (worker_retire(slot)) {
+                return;
+            }
+            continue;
+        }
         if(client_fd == -1) {
             if ((queue->shutdown) == 0) {
                 printf("connection_dequeue_error\n");
             }
-            return NULL;
+            return;
         }
-
-        // gets the correct directory for file requests
-        if (strcpy(resource_name, serve_dir) == NULL) {
-            perror("strcpy");
-            close(client_fd);
-            return NULL;
+        if (group->active_reactor != NULL) {
+            reactor_queue_space(group->active_reactor);
         }
-        
-        if(read_http_request(client_fd, resource_name) == -1) {
-            perror("read_http");
-            close(client_fd);
-            return NULL;
-        } // serve_dir/resource_name
 
-        if(write_http_response(client_fd, resource_name) == -1) {
-            perror("write_http");
-            close(client_fd);
-            return NULL;
+        // past the drain deadline there is no time left to serve it
+        if (__atomic_load_n(&drain_expired, __ATOMIC_ACQUIRE)) {
+            admission_leave();
+            admission_shed(client_fd, METRICS_SHED_DRAIN);
+            continue;
         }
 
-        if(close(client_fd) == -1) {
-            perror("close");
-            return NULL;
+        // the client has likely given up on a connection this stale, and
+        // serving it only makes the ones behind it wait longer
+        if (admission_expired(queue_wait)) {
+            admission_leave();
+            admission_shed(client_fd, METRICS_SHED_QUEUE_WAIT);
+            continue;
         }
+        serve_connection(group, client_fd, arena);
     }
-    
-    return NULL;
 }
 
-int main(int argc, char **argv) {
-    // First command is directory to serve, second command is port
-    if (argc != 3) {
-        printf("Usage: %s <directory> <port>\n", argv[0]);
-        return 1;
+void* thread_func(void* arg) {
+    worker_slot_t *slot = (worker_slot_t *) arg;
+    metrics_attach(slot->id);
+    access_log_attach(slot->id);
+    http_set_thread_file_cache(slot->group->cache);
+
+    // per-request scratch space, allocated here so it is on this thread's node
+    arena_t arena;
+    int have_arena = arena_init(&arena, ARENA_DEFAULT_CHUNK) == 0;
+    if (have_arena) {
+        http_set_thread_arena(&arena);
+        metrics_record_pool(METRICS_POOL_ARENA, arena.stats.reserved, 0);
     }
-    serve_dir = argv[1];
-    const char *port = argv[2];
 
-    // Initialize thread-safe data struct
-    connection_queue_t queue;
-    if (connection_queue_init(&queue) != 0) {
-        printf("Failed to initialize queue\n");
-        return 1;
+    worker_loop(slot, have_arena ? &arena : NULL);
+
+    if (have_arena) {
+        http_set_thread_arena(NULL);
+        metrics_record_pool(METRICS_POOL_ARENA, 0, arena.stats.high_water);
+        arena_free(&arena);
     }
-    
-    // Catch SIGINT so we can clean up properly
-    struct sigaction sigact;
-    sigact.sa_handler = handle_sigint;
-    if (sigfillset(&sigact.sa_mask) == -1) {
-        perror("sigfillset");
-        connection_queue_free(&queue);
-        return 1;
+    return NULL;
+}
+
+void print_usage(const char *prog_name) {
+    printf("Usage: %s [-s copy|sendfile|splice] [-E threads|epoll|uring] [-k keep_alive_secs] [-r max_requests]\n"
+           "       [-c cache_bytes[K|M|G]] [-f max_open_files] [-a acceptors] [-p] [-C cpu_list] [-Q mutex|lockfree|steal|steal-least [-q capacity]]\n"
+           "       [-P processes | -U control_socket] [-D drain_secs] [-b listen_backlog] [-m max_inflight] [-W queue_wait_ms] [-R retry_after_secs]\n"
+           "       [-H header_secs] [-T send_secs [-M min_bytes_per_sec]] [-n threads [-N max_threads [-G grow_depth] [-w grow_wait_ms] [-i idle_secs]]]\n"
+           "       [-L access_log|- [-F flush_ms]] [-v] <directory|pack> <port>\n", prog_name);
+}
+
+// Parse a byte count with an optional K, M or G suffix
+// Returns 0 on success or -1 if the string is not a valid size
+int parse_size(const char *str, size_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno != 0 || end == str) {
+        return -1;
+    }
+    switch (*end) {
+    case 'G': case 'g':
+        value *= 1024;
+        // fall through
+    case 'M': case 'm':
+        value *= 1024;
+        // fall through
+    case 'K': case 'k':
+        value *= 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0') {
+        return -1;
     }
+    *size = value;
+    return 0;
+}
 
-    sigact.sa_flags = 0; // Note the lack of SA_RESTART
-    if (sigaction(SIGINT, &sigact, NULL) == -1) {
-        perror("sigaction");
-        connection_queue_free(&queue);
-        return 1;
+// Blocking accept loop: hands every new connection straight to the queue,
+// or sheds it if admission control turns it away
+// Returns 0 on a clean stop or 1 on error
+int accept_loop(int sock_fd, connection_queue_t *queue) {
+    while (keep_going != 0) {
+        // Wait to receive a connection request from client
+        int client_fd = accept(sock_fd, NULL, NULL);
+        if (client_fd == -1) {
+            // EINTR from SIGINT on the main thread or the wakeup signal on
+            // an acceptor thread, or EINVAL once main has shut the socket
+            // down to stop an acceptor thread
+            if (errno == EINTR || keep_going == 0) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // a socket taken over from a server running the epoll
+                // engine is non-blocking, wait for the next connection
+                struct pollfd listener = {sock_fd, POLLIN, 0};
+                poll(&listener, 1, -1);
+                continue;
+            }
+            perror("accept");
+            return 1;
+        }
+        
+        if (!admission_enter()) {
+            admission_shed(client_fd, METRICS_SHED_INFLIGHT);
+            continue;
+        }
+
+        // add new client fd to queue. blocks for at most the queue wait
+        // deadline, or for as long as it takes without one
+        metrics_connection_queued(client_fd);
+        int result = connection_enqueue_timed(queue, client_fd, admission_queue_wait_ms());
+        if (result == CONNECTION_QUEUE_TIMEOUT) {
+            admission_leave();
+            admission_shed(client_fd, METRICS_SHED_QUEUE_FULL);
+            continue;
+        }
+        if (result == -1) {
+            admission_leave();
+            close(client_fd);
+            if (queue->shutdown == 0) {
+                printf("Connection_enqueue error\n");
+                return 1;
+            }
+            break;
+        } 
+        
+        // main thread no longer communicates with the new client as in Part 1.
+    }
+    return 0;
+}
+
+// Run a group's accept loop or reactor on the calling thread until shutdown
+// Returns 0 on a clean stop or 1 on error
+int run_acceptor(server_group_t *group) {
+    if (engine == ENGINE_URING) {
+        // the group's first worker slot is free since it starts no workers
+        uring_engine_config_t config;
+        config.serve_dir = serve_dir;
+        config.cache = group->cache;
+        config.fds = fd_cache_started ? &fd_cache : NULL;
+        config.pack = use_pack ? &pack : NULL;
+        config.keep_alive_timeout_ms = keep_alive_timeout_ms;
+        config.max_requests = max_requests_per_conn;
+        config.drain_ms = drain_timeout_ms;
+        config.drain_idle_grace_ms = DRAIN_IDLE_GRACE_MS;
+        config.slot_id = group->index * max_threads;
+        return uring_engine_run(group->listen_fd, &config, &keep_going) == -1 ? 1 : 0;
+    }
+    if (group->active_reactor != NULL) {
+        if (reactor_run(group->active_reactor, &keep_going) == -1) {
+            return 1;
+        }
+        // new clients parked here are owed a response like queued ones
+        return reactor_drain(group->active_reactor, drain_time_left_ms(), DRAIN_IDLE_GRACE_MS) == -1 ? 1 : 0;
     }
+    return accept_loop(group->listen_fd, &group->queue);
+}
+
+void* acceptor_func(void* arg) {
+    server_group_t *group = (server_group_t *) arg;
+    // the only signal an acceptor thread takes, to be woken up
+    sigset_t wakeup;
+    sigemptyset(&wakeup);
+    sigaddset(&wakeup, SIGUSR2);
+    pthread_sigmask(SIG_UNBLOCK, &wakeup, NULL);
+    return (void *) (long) run_acceptor(group);
+}
 
+// Create, bind and listen on a TCP socket for 'port'
+// reuseport: Set SO_REUSEPORT so several sockets can share the port
+// Returns the socket's file descriptor or -1 on error
+int open_listener(const char *port, int reuseport) {
     // Set up hints - we'll take either IPv4 or IPv6, TCP socket type
     struct addrinfo hints;
     memset(&hints, 0, sizeof(hints));
@@ -111,123 +653,1278 @@ int main(int argc, char **argv) {
     int ret_val = getaddrinfo(NULL, port, &hints, &server);
     if (ret_val != 0) {
         fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(ret_val));
-        connection_queue_free(&queue);
-        return 1;
+        return -1;
     }
     // Initialize socket file descriptor
     int sock_fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
     if (sock_fd == -1) {
         perror("socket");
-        connection_queue_free(&queue);
         freeaddrinfo(server);
-        return 1;
+        return -1;
+    }
+    // Allow quick restarts while old connections sit in TIME_WAIT
+    int enable = 1;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1) {
+        perror("setsockopt");
+        freeaddrinfo(server);
+        close(sock_fd);
+        return -1;
+    }
+    if (reuseport && setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+        perror("setsockopt");
+        freeaddrinfo(server);
+        close(sock_fd);
+        return -1;
     }
     // Bind socket to receive at a specific port
     if (bind(sock_fd, server->ai_addr, server->ai_addrlen) == -1) {
         perror("bind");
-        connection_queue_free(&queue);
         freeaddrinfo(server);
         close(sock_fd);
-        return 1;
+        return -1;
     }
     freeaddrinfo(server);
     // Designate socket as a server socket
-    if (listen(sock_fd, LISTEN_QUEUE_LEN) == -1) {
+    if (listen(sock_fd, listen_backlog) == -1) {
         perror("listen");
-        connection_queue_free(&queue);
         close(sock_fd);
-        return 1;
+        return -1;
     }
+    return sock_fd;
+}
 
-    // sigprocmask to block ALL signals, save current mask
-    sigset_t new_mask;
-    sigset_t old_mask;
-    if(sigfillset(&new_mask) == -1) {
-        perror("sigfillset");
-        connection_queue_free(&queue);
-        return 1;
+// Set up a group's queue (and reactor) around an already listening socket
+// Returns 0 on success or -1 on error
+int group_init(server_group_t *group, int index, int listen_fd, int cpu) {
+    memset(group, 0, sizeof(server_group_t));
+    group->index = index;
+    group->listen_fd = listen_fd;
+    group->cpu = cpu;
+    if (cpu >= 0) {
+        group->node = topology_node_of(cpu);
+        topology_node_cpus(group->node, &group->node_cpus);
+        // Among SO_REUSEPORT sockets the kernel prefers the one whose
+        // incoming CPU is the core that took the SYN, so a connection stays
+        // on the core (and node) whose queues received it
+        if (n_acceptors > 0 && setsockopt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+            perror("setsockopt SO_INCOMING_CPU");
+        }
     }
-    if(sigprocmask(SIG_SETMASK, &new_mask, &old_mask) == -1) {
-        perror("sigprocmask");
-        connection_queue_free(&queue);
-        close(sock_fd);
-        return 1;
+
+    group->pool = calloc(max_threads, sizeof(worker_slot_t));
+    if (group->pool == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (int i = 0; i < max_threads; i++) {
+        group->pool[i].id = index * max_threads + i;
+        group->pool[i].group = group;
+    }
+    int result;
+    if ((result = pthread_mutex_init(&group->pool_lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        free(group->pool);
+        return -1;
     }
 
-    // Create thread pool
-    // We want to use a return code and set it for any proceeding error handling 
-    // from here so we can reuse cleanup logic 
-    pthread_t pool[N_THREADS];
+    // Initialize thread-safe data struct
+    if (queue_type == QUEUE_LOCKFREE) {
+        result = connection_queue_init_lockfree(&group->queue, queue_capacity);
+    } else if (queue_type == QUEUE_STEALING) {
+        result = connection_queue_init_stealing(&group->queue, min_threads, queue_capacity, steal_policy);
+    } else {
+        result = connection_queue_init(&group->queue, queue_capacity);
+    }
+    if (result != 0) {
+        printf("Failed to initialize queue\n");
+        pthread_mutex_destroy(&group->pool_lock);
+        free(group->pool);
+        return -1;
+    }
+
+    if (engine == ENGINE_EPOLL) {
+        if (reactor_init(&group->reactor, listen_fd, &group->queue, header_timeout_ms,
+                         keep_alive_timeout_ms) == -1) {
+            printf("Failed to initialize reactor\n");
+            connection_queue_free(&group->queue);
+            pthread_mutex_destroy(&group->pool_lock);
+            free(group->pool);
+            return -1;
+        }
+        group->active_reactor = &group->reactor;
+    }
+    return 0;
+}
+
+// Start one of a group's threads. When the group is pinned the acceptor
+// gets the group's core and every other thread the cores of its node, so
+// workers can spread out without leaving the node their memory is on.
+// Returns 0 on success or -1 on error
+int start_group_thread(server_group_t *group, pthread_t *thread, void *(*func)(void *), void *arg) {
+    pthread_attr_t attr;
     int result;
-    int return_code = 0;
-    for(int i = 0; i< N_THREADS; i++) {
-        if ((result = pthread_create(pool + i, NULL, thread_func, &queue)) != 0) {
-            fprintf(stderr, "pthread_create: %s\n", strerror(result));
-            connection_queue_free(&queue);
-            return 1;
+    if ((result = pthread_attr_init(&attr)) != 0) {
+        fprintf(stderr, "pthread_attr_init: %s\n", strerror(result));
+        return -1;
+    }
+    if (group->cpu >= 0) {
+        cpu_set_t cpus = group->node_cpus;
+        if (thread == &group->acceptor) {
+            CPU_ZERO(&cpus);
+            CPU_SET(group->cpu, &cpus);
+        }
+        if ((result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus)) != 0) {
+            fprintf(stderr, "pthread_attr_setaffinity_np: %s\n", strerror(result));
         }
     }
-    // restore old mask
-    if(sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
-        perror("sigprocmask");
-        keep_going = 0;
-        return_code = 1;
+    result = pthread_create(thread, &attr, func, arg);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(result));
+        return -1;
     }
+    return 0;
+}
 
-    // Accept loop here 
-    while (keep_going != 0) {
-        // Wait to receive a connection request from client
-        int client_fd = accept(sock_fd, NULL, NULL);
-        if (client_fd == -1) {
-            if (errno != EINTR) {
-                perror("accept");
-                return_code = 1;
-                break;
-            } else {
-                break;
-            }
-        }
-        
-        // add new client fd to queue. may block (okay)
-        if(connection_enqueue(&queue, client_fd) == -1) {
-            if (queue.shutdown == 0) {
-                printf("Connection_enqueue error\n");
-                return_code = 1;
-            }
-            break;
-        } 
-        
-        // main thread no longer communicates with the new client as in Part 1.
+// Set up a content cache whose table is allocated and zeroed from 'node',
+// so its pages are placed there
+// Returns the cache, or NULL on error
+file_cache_t *node_cache_create(int node, size_t budget) {
+    cpu_set_t old_cpus;
+    cpu_set_t cpus;
+    topology_node_cpus(node, &cpus);
+    if (sched_getaffinity(0, sizeof(old_cpus), &old_cpus) == -1 ||
+        sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        perror("sched_setaffinity");
+        return NULL;
+    }
+    file_cache_t *node_cache = malloc(sizeof(file_cache_t));
+    if (node_cache == NULL) {
+        perror("malloc");
+    } else if (file_cache_init(node_cache, budget) != 0) {
+        free(node_cache);
+        node_cache = NULL;
     }
+    if (sched_setaffinity(0, sizeof(old_cpus), &old_cpus) == -1) {
+        perror("sched_setaffinity");
+    }
+    return node_cache;
+}
 
-    // Cleanup, even if we had SIGINT: shutdown, wait for threads, free
-    if (connection_queue_shutdown(&queue) == -1) {
-        printf("Connection_queue_shutdown error\n");
-        return_code = 1;
+// Give each group the content cache its threads serve from. Groups pinned
+// to more than one NUMA node get a cache per node, splitting the budget, so
+// hits never read another node's memory. Entries are allocated by the
+// thread that missed, which is on the cache's node. Otherwise all groups
+// share one cache.
+// Returns 0 on success or -1 on error
+int init_caches(server_group_t *groups, int n_groups) {
+    int used[TOPOLOGY_MAX_NODES] = {0};
+    int n_nodes = 0;
+    for (int i = 0; i < n_groups && groups[i].cpu >= 0; i++) {
+        if (!used[groups[i].node]) {
+            used[groups[i].node] = 1;
+            n_nodes++;
+        }
     }
 
-    // wait for threads to terminate
-    for (int i = 0; i < N_THREADS; i++) {
-        int result = pthread_join(pool[i], NULL);
-        if (result != 0) {
-            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
-            for (int j = i + 1; j < N_THREADS; j++) {
-                pthread_join(pool[j], NULL);
+    if (n_nodes <= 1) {
+        if (file_cache_init(&cache, cache_budget) != 0) {
+            return -1;
+        }
+        http_set_file_cache(&cache);
+        for (int i = 0; i < n_groups; i++) {
+            groups[i].cache = &cache;
+        }
+        return 0;
+    }
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+        if (used[node] && (node_caches[node] = node_cache_create(node, cache_budget / n_nodes)) == NULL) {
+            for (int j = 0; j < node; j++) {
+                if (node_caches[j] != NULL) {
+                    file_cache_free(node_caches[j]);
+                    free(node_caches[j]);
+                    node_caches[j] = NULL;
+                }
             }
-            return_code = 1;
+            return -1;
         }
     }
+    for (int i = 0; i < n_groups; i++) {
+        groups[i].cache = node_caches[groups[i].node];
+    }
+    return 0;
+}
 
-    if (connection_queue_free(&queue) == -1) {
-        printf("Connection_queue_free error\n");
-        return_code = 1;
-    } 
+void report_file_cache(const char *name, file_cache_t *file_cache) {
+    file_cache_stats_t stats;
+    if (file_cache_get_stats(file_cache, &stats) == 0) {
+        fprintf(stderr, "%s: %lu hits, %lu misses, %lu evictions, %lu invalidations, %lu compressions, %zu entries, %zu bytes\n",
+                name, stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.compressions, stats.entries,
+                stats.bytes_used);
+    }
+}
 
-    if (close(sock_fd) == -1) {
-        perror("close");
-        return_code = 1;
+// Report the summed counters of the caches set up by init_caches, see
+// metrics_set_cache_source
+void file_cache_counts(metrics_cache_counts_t *counts) {
+    file_cache_t *file_caches[TOPOLOGY_MAX_NODES];
+    int n_caches = 0;
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+        if (node_caches[node] != NULL) {
+            file_caches[n_caches++] = node_caches[node];
+        }
+    }
+    if (n_caches == 0) {
+        file_caches[n_caches++] = &cache;
+    }
+    for (int i = 0; i < n_caches; i++) {
+        file_cache_stats_t stats;
+        if (file_cache_get_stats(file_caches[i], &stats) == 0) {
+            counts->hits += stats.hits;
+            counts->misses += stats.misses;
+            counts->evictions += stats.evictions;
+            counts->invalidations += stats.invalidations;
+        }
     }
+}
 
-    // TODO Complete the rest of this function
-    return return_code;
-}
\ No newline at end of file
+// Report the descriptor cache's counters, see metrics_set_cache_source
+void fd_cache_counts(metrics_cache_counts_t *counts) {
+    fd_cache_stats_t stats;
+    if (fd_cache_get_stats(&fd_cache, &stats) == 0) {
+        counts->hits = stats.hits;
+        counts->misses = stats.misses;
+        counts->evictions = stats.evictions;
+        counts->invalidations = stats.invalidations;
+    }
+}
+
+// Free the caches set up by init_caches
+// Returns 0 on success or -1 on error
+int free_caches(void) {
+    int return_code = 0;
+    int per_node = 0;
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+        if (node_caches[node] == NULL) {
+            continue;
+        }
+        per_node = 1;
+        if (verbose) {
+            char name[32];
+            snprintf(name, sizeof(name), "file cache (node %d)", node);
+            report_file_cache(name, node_caches[node]);
+        }
+        if (file_cache_free(node_caches[node]) == -1) {
+            return_code = -1;
+        }
+        free(node_caches[node]);
+        node_caches[node] = NULL;
+    }
+    if (!per_node) {
+        if (verbose) {
+            report_file_cache("file cache", &cache);
+        }
+        if (file_cache_free(&cache) == -1) {
+            return_code = -1;
+        }
+    }
+    return return_code;
+}
+
+// Start one more worker in a free (or retired) slot of the group's pool
+// Returns 0 on success, 1 if the pool is already at max_threads, or -1 on error
+int group_add_worker(server_group_t *group) {
+    pthread_mutex_lock(&group->pool_lock);
+    worker_slot_t *slot = NULL;
+    for (int i = 0; i < max_threads && slot == NULL; i++) {
+        if (group->pool[i].state != WORKER_RUNNING) {
+            slot = &group->pool[i];
+        }
+    }
+    if (slot == NULL || group->n_workers >= max_threads) {
+        pthread_mutex_unlock(&group->pool_lock);
+        return 1;
+    }
+    if (slot->state == WORKER_EXITED) {
+        // it has already left thread_func, this doesn't block for long
+        int result = pthread_join(slot->thread, NULL);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+        }
+        slot->state = WORKER_FREE;
+    }
+    if (start_group_thread(group, &slot->thread, thread_func, slot) == -1) {
+        pthread_mutex_unlock(&group->pool_lock);
+        return -1;
+    }
+    slot->state = WORKER_RUNNING;
+    group->n_workers++;
+    metrics_record_worker_started();
+    pthread_mutex_unlock(&group->pool_lock);
+    return 0;
+}
+
+// Elastic pool: add a worker whenever connections pile up in the queue (at
+// least grow_depth waiting) or sit there too long (queue not drained for
+// grow_wait_ms) while no worker is free to take them. Idle workers retire
+// themselves in thread_func.
+void* monitor_func(void* arg) {
+    server_group_t *group = (server_group_t *) arg;
+    struct pollfd stop;
+    stop.fd = shutdown_pipe[0];
+    stop.events = POLLIN;
+    long backlog_since = -1;
+
+    while (keep_going != 0 && group->queue.shutdown == 0) {
+        int n = poll(&stop, 1, ELASTIC_SAMPLE_MS);
+        if (n != 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break; // shutdown_pipe became readable
+        }
+
+        int depth = connection_queue_length(&group->queue);
+        if (depth == 0) {
+            backlog_since = -1;
+            continue;
+        }
+        long now = monotonic_ms();
+        if (backlog_since == -1) {
+            backlog_since = now;
+        }
+        int idle = __atomic_load_n(&group->n_idle, __ATOMIC_RELAXED);
+        if (idle < depth && (depth >= grow_depth || now - backlog_since >= grow_wait_ms)) {
+            if (group_add_worker(group) == -1) {
+                printf("Failed to grow worker pool\n");
+            }
+            backlog_since = now; // give the new worker a chance before growing again
+        }
+    }
+    return NULL;
+}
+
+// Shut down a group's queue, wait for its workers to drain it and free
+// everything it owns
+// Returns 0 on success or 1 on error
+int group_stop(server_group_t *group) {
+    int return_code = 0;
+    if (connection_queue_shutdown(&group->queue) == -1) {
+        printf("Connection_queue_shutdown error\n");
+        return_code = 1;
+    }
+
+    // wait for threads to terminate, the monitor first so the pool stops
+    // changing, then every worker including retired ones not yet joined.
+    // Workers answer what is still queued before they exit, for as long as
+    // the drain deadline allows.
+    if (group->monitor_started) {
+        int result = pthread_join(group->monitor, NULL);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+            return_code = 1;
+        }
+    }
+    for (int i = 0; i < max_threads; i++) {
+        if (group->pool[i].state == WORKER_FREE) {
+            continue;
+        }
+        int result = join_within_drain(group->pool[i].thread);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+            return_code = 1;
+        }
+    }
+    pthread_mutex_destroy(&group->pool_lock);
+    free(group->pool);
+
+    // left only if no worker was running to take them, still owed an answer
+    int client_fd;
+    while ((client_fd = connection_dequeue_timed(&group->queue, 0)) >= 0) {
+        admission_leave();
+        admission_shed(client_fd, METRICS_SHED_DRAIN);
+    }
+
+    // workers may have parked connections right up until they exited
+    if (group->active_reactor != NULL && reactor_free(group->active_reactor) == -1) {
+        printf("Reactor_free error\n");
+        return_code = 1;
+    }
+
+    if (connection_queue_free(&group->queue) == -1) {
+        printf("Connection_queue_free error\n");
+        return_code = 1;
+    } 
+
+    if (close(group->listen_fd) == -1) {
+        perror("close");
+        return_code = 1;
+    }
+    return return_code;
+}
+
+// The listening sockets a new server can take over
+typedef struct {
+    const int *fds;
+    int n_fds;
+} handoff_sockets_t;
+
+// Close the control socket, so a server started from now on finds the port
+// in use rather than waiting for sockets nobody will send
+void close_control_socket(void) {
+    if (control_fd == -1) {
+        return;
+    }
+    close(control_fd);
+    control_fd = -1;
+    // after a handoff the path is the new server's
+    if (!__atomic_load_n(&handed_off, __ATOMIC_ACQUIRE)) {
+        unlink(handoff_path);
+    }
+}
+
+// Wait on the control socket for a new server, hand it the listening
+// sockets and stop this one, which then drains and exits while the new one
+// accepts on the same sockets
+void* handoff_func(void* arg) {
+    handoff_sockets_t *sockets = (handoff_sockets_t *) arg;
+    struct pollfd control;
+    control.fd = control_fd;
+    control.events = POLLIN;
+    while (keep_going != 0) {
+        int n = poll(&control, 1, WAKE_INTERVAL_MS);
+        if (n == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (n <= 0 || keep_going == 0) {
+            continue; // the sockets may already be shut down
+        }
+        if (handoff_give(control_fd, sockets->fds, sockets->n_fds) == 0) {
+            __atomic_store_n(&handed_off, 1, __ATOMIC_RELEASE);
+            fprintf(stderr, "Handed the listening sockets to a new server, draining\n");
+            kill(getpid(), SIGINT);
+            break;
+        }
+    }
+    close_control_socket();
+    return NULL;
+}
+
+// Wake every acceptor thread out of accept(), epoll_wait() or
+// io_uring_enter() and wait for it to finish its drain. Shutting the
+// listening socket down is what normally does it, and turns away new
+// connections from then on. After a handoff the sockets are the new
+// server's as well, so the threads are interrupted with SIGUSR2 instead,
+// again and again since one may be just about to block.
+// Returns 0 on success or 1 if an acceptor failed
+int stop_acceptors(server_group_t *groups, int n_started) {
+    int handed = __atomic_load_n(&handed_off, __ATOMIC_ACQUIRE);
+    for (int g = 0; g < n_started && !handed; g++) {
+        shutdown(groups[g].listen_fd, SHUT_RDWR);
+    }
+    int return_code = 0;
+    for (int g = 0; g < n_started; g++) {
+        void *acceptor_result;
+        int result;
+        do {
+            if (handed) {
+                pthread_kill(groups[g].acceptor, SIGUSR2);
+            }
+            result = join_timed(groups[g].acceptor, &acceptor_result, WAKE_INTERVAL_MS);
+        } while (result == ETIMEDOUT);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+            return_code = 1;
+        } else if (acceptor_result != NULL) {
+            return_code = 1;
+        }
+    }
+    return return_code;
+}
+
+// Serve on sockets that are already listening, one per group, until SIGINT:
+// start every group's workers and acceptor, then shut them down and free
+// everything. This is all of the server in a single process, and what each
+// worker process runs in prefork mode. The sockets are closed on return.
+// Returns the process exit code
+int run_server(int *listen_fds, int n_groups) {
+    server_group_t *groups = calloc(n_groups, sizeof(server_group_t));
+    if (groups == NULL) {
+        perror("calloc");
+        for (int i = 0; i < n_groups; i++) {
+            close(listen_fds[i]);
+        }
+        return 1;
+    }
+    for (int i = 0; i < n_groups; i++) {
+        int cpu = pin_threads ? topology_group_cpu(process_index * n_groups + i) : -1;
+        if (group_init(&groups[i], i, listen_fds[i], cpu) == -1) {
+            for (int j = i; j < n_groups; j++) {
+                close(listen_fds[j]);
+            }
+            for (int j = 0; j < i; j++) {
+                group_stop(&groups[j]);
+            }
+            free(groups);
+            return 1;
+        }
+        if (verbose && cpu >= 0) {
+            fprintf(stderr, "group %d: acceptor on cpu %d, other threads on node %d (%d cpus)\n", i, cpu,
+                    groups[i].node, CPU_COUNT(&groups[i].node_cpus));
+        }
+    }
+
+    // Idle keep-alive workers poll this alongside their client
+    if (pipe(shutdown_pipe) == -1) {
+        perror("pipe");
+        for (int i = 0; i < n_groups; i++) {
+            group_stop(&groups[i]);
+        }
+        free(groups);
+        return 1;
+    }
+
+    // Hot files are served from memory, one cache per NUMA node in use
+    if (cache_budget > 0 && init_caches(groups, n_groups) == -1) {
+        printf("Failed to initialize file cache\n");
+        for (int i = 0; i < n_groups; i++) {
+            group_stop(&groups[i]);
+        }
+        free(groups);
+        return 1;
+    }
+    if (cache_budget > 0) {
+        metrics_set_cache_source(METRICS_CACHE_FILE, file_cache_counts);
+    }
+
+    // Shared by all workers, known files stay open and their stat current
+    // without a syscall per request
+    if (max_open_files > 0 && !use_pack) {
+        if (fd_cache_init(&fd_cache, max_open_files) == 0) {
+            fd_cache_started = 1;
+            http_set_fd_cache(&fd_cache);
+            metrics_set_cache_source(METRICS_CACHE_FD, fd_cache_counts);
+        } else {
+            fprintf(stderr, "Open file cache unavailable, opening files per request\n");
+        }
+    }
+
+    // One counter slot per worker, read back through METRICS_PATH
+    if (metrics_init(n_groups * max_threads) == -1) {
+        printf("Failed to initialize metrics\n");
+        for (int i = 0; i < n_groups; i++) {
+            group_stop(&groups[i]);
+        }
+        free(groups);
+        return 1;
+    }
+
+    // sigprocmask to block ALL signals, save current mask
+    sigset_t new_mask;
+    sigset_t old_mask;
+    if(sigfillset(&new_mask) == -1) {
+        perror("sigfillset");
+        return 1;
+    }
+    if(sigprocmask(SIG_SETMASK, &new_mask, &old_mask) == -1) {
+        perror("sigprocmask");
+        return 1;
+    }
+
+    // We want to use a return code and set it for any proceeding error handling 
+    // from here so we can reuse cleanup logic 
+    int return_code = 0;
+
+    // The log's writer thread starts with every signal blocked, like the workers
+    if (access_log_path != NULL &&
+        access_log_start(access_log_path, n_groups * max_threads, access_log_flush_ms) == -1) {
+        printf("Failed to start access log\n");
+        keep_going = 0;
+        return_code = 1;
+    }
+
+    // Stalled peers are cut off by a watchdog rather than holding workers
+    if (return_code == 0 && deadline_start(header_timeout_ms, send_timeout_ms, min_send_rate) == -1) {
+        printf("Failed to start deadline watchdog\n");
+        keep_going = 0;
+        return_code = 1;
+    }
+
+    // Create thread pools (and acceptor threads)
+    int n_acceptors_started = 0;
+    for (int g = 0; g < n_groups && return_code == 0; g++) {
+        server_group_t *group = &groups[g];
+        // the io_uring engine serves every connection on the acceptor thread
+        for(int i = 0; i < min_threads && engine != ENGINE_URING; i++) {
+            if (group_add_worker(group) != 0) {
+                keep_going = 0;
+                return_code = 1;
+                break;
+            }
+        }
+        if (return_code == 0 && max_threads > min_threads && engine != ENGINE_URING) {
+            if (start_group_thread(group, &group->monitor, monitor_func, group) == -1) {
+                keep_going = 0;
+                return_code = 1;
+                break;
+            }
+            group->monitor_started = 1;
+        }
+        if (return_code == 0 && n_acceptors > 0) {
+            if (start_group_thread(group, &group->acceptor, acceptor_func, group) == -1) {
+                keep_going = 0;
+                return_code = 1;
+                break;
+            }
+            n_acceptors_started++;
+        }
+    }
+
+    // A new server started with the same -U path takes the listening
+    // sockets over through this thread
+    pthread_t handoff_thread;
+    int handoff_started = 0;
+    handoff_sockets_t sockets = {listen_fds, n_groups};
+    if (return_code == 0 && control_fd != -1) {
+        int result = pthread_create(&handoff_thread, NULL, handoff_func, &sockets);
+        if (result != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(result));
+            keep_going = 0;
+            return_code = 1;
+        } else {
+            handoff_started = 1;
+        }
+    }
+
+    // Accept loop here 
+    if (return_code == 0 && n_acceptors == 0) {
+        // restore old mask so SIGINT interrupts accept()
+        if(sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
+            perror("sigprocmask");
+            keep_going = 0;
+            return_code = 1;
+        } else {
+            // the main thread is group 0's acceptor, pinned only now so the
+            // helper threads started above didn't inherit the single core
+            if (groups[0].cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(groups[0].cpu, &cpus);
+                int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+                if (result != 0) {
+                    fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(result));
+                }
+            }
+            return_code = run_acceptor(&groups[0]);
+        }
+    } else {
+        // acceptor threads do the work, sleep until SIGINT with it unblocked
+        while (keep_going != 0) {
+            sigsuspend(&old_mask);
+        }
+        if(sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
+            perror("sigprocmask");
+            return_code = 1;
+        }
+
+        if (stop_acceptors(groups, n_acceptors_started) != 0) {
+            return_code = 1;
+        }
+    }
+
+    // it stops within WAKE_INTERVAL_MS of the shutdown, and must be gone
+    // before the sockets it could hand over are closed
+    if (handoff_started) {
+        int result = pthread_join(handoff_thread, NULL);
+        if (result != 0) {
+            fprintf(stderr, "pthread_join failed: %s\n", strerror(result));
+            return_code = 1;
+        }
+    }
+
+    // Cleanup, even if we had SIGINT: shutdown, wait for threads, free
+    if (write(shutdown_pipe[1], "x", 1) == -1) {
+        perror("write");
+        return_code = 1;
+    }
+    for (int g = 0; g < n_groups; g++) {
+        if (group_stop(&groups[g]) != 0) {
+            return_code = 1;
+        }
+    }
+    free(groups);
+
+    if (deadline_stop() == -1) {
+        return_code = 1;
+    }
+
+    // every worker has exited, so this flushes the last entries
+    if (access_log_enabled()) {
+        if (access_log_stop() == -1) {
+            return_code = 1;
+        }
+        if (verbose) {
+            fprintf(stderr, "access log: %lu entries dropped\n", access_log_dropped());
+        }
+    }
+
+    close(shutdown_pipe[0]);
+    close(shutdown_pipe[1]);
+
+    if (cache_budget > 0 && free_caches() == -1) {
+        printf("File_cache_free error\n");
+        return_code = 1;
+    }
+
+    if (fd_cache_started) {
+        fd_cache_stats_t stats;
+        if (verbose && fd_cache_get_stats(&fd_cache, &stats) == 0) {
+            fprintf(stderr, "fd cache: %lu hits, %lu misses, %lu evictions, %lu invalidations, %zu entries\n",
+                    stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.entries);
+        }
+        if (fd_cache_free(&fd_cache) == -1) {
+            printf("Fd_cache_free error\n");
+            return_code = 1;
+        }
+    }
+
+    char metrics_text[METRICS_BUFSIZE];
+    if (verbose && metrics_format(metrics_text, sizeof(metrics_text), 0) != -1) {
+        fputs(metrics_text, stderr);
+    }
+    metrics_free();
+    return return_code;
+}
+
+// A worker process in prefork mode
+typedef struct {
+    pid_t pid;          // 0 while waiting to be restarted
+    long started_ms;
+    long restart_ms;    // when to start it again after it died
+} child_slot_t;
+
+// Fork a worker process that runs the whole server. With acceptor threads
+// each process opens its own SO_REUSEPORT sockets: an acceptor is stopped by
+// shutting its socket down, which would stop every process sharing it.
+// index: Which process this is, so pinned processes take different cores
+// port: Port to listen on when the process opens its own sockets
+// run_mask: Signal mask the child should run with
+// Returns the child's pid, or -1 on error
+pid_t spawn_worker_process(int index, const char *port, int *listen_fds, int n_groups, const sigset_t *run_mask) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        process_index = index;
+        signal(SIGCHLD, SIG_DFL);
+        if (sigprocmask(SIG_SETMASK, run_mask, NULL) == -1) {
+            perror("sigprocmask");
+            exit(1);
+        }
+        for (int i = 0; i < n_groups && n_acceptors > 0; i++) {
+            listen_fds[i] = open_listener(port, 1);
+            if (listen_fds[i] == -1) {
+                exit(1);
+            }
+        }
+        exit(run_server(listen_fds, n_groups));
+    }
+    return pid;
+}
+
+// Describe how a worker process ended, for the supervisor's messages
+void describe_exit(int status, char *buf, size_t size) {
+    if (WIFSIGNALED(status)) {
+        snprintf(buf, size, "was killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+    } else {
+        snprintf(buf, size, "exited with status %d", WEXITSTATUS(status));
+    }
+}
+
+// Prefork mode: run n_processes copies of the server on the listening
+// sockets opened here, so a crash takes down one process instead of the
+// whole server and no allocator or lock is shared between them. The
+// kernel hands each connection to whichever process accepts first. A
+// process that dies is started again, after RESTART_BACKOFF_MS if it died
+// right after starting so a process that can't come up isn't forked in a
+// tight loop. SIGINT is passed on to every process and the supervisor
+// waits for all of them to finish their own shutdown.
+// Returns the process exit code
+int supervise(const char *port, int *listen_fds, int n_groups) {
+    child_slot_t *children = calloc(n_processes, sizeof(child_slot_t));
+    if (children == NULL) {
+        perror("calloc");
+        for (int i = 0; i < n_groups; i++) {
+            close(listen_fds[i]);
+        }
+        return 1;
+    }
+
+    // SIGINT and SIGCHLD stay blocked and are taken with sigtimedwait, so a
+    // child exiting between two checks is never missed
+    sigset_t wait_mask;
+    sigset_t old_mask;
+    sigemptyset(&wait_mask);
+    sigaddset(&wait_mask, SIGINT);
+    sigaddset(&wait_mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &wait_mask, &old_mask) == -1) {
+        perror("sigprocmask");
+        for (int i = 0; i < n_groups; i++) {
+            close(listen_fds[i]);
+        }
+        free(children);
+        return 1;
+    }
+
+    // the sockets opened by main only showed the port can be bound, a
+    // SO_REUSEPORT socket left open here would be handed connections that
+    // nobody accepts
+    if (n_acceptors > 0) {
+        for (int i = 0; i < n_groups; i++) {
+            close(listen_fds[i]);
+        }
+    }
+
+    int return_code = 0;
+    for (int i = 0; i < n_processes; i++) {
+        children[i].pid = spawn_worker_process(i, port, listen_fds, n_groups, &old_mask);
+        children[i].started_ms = monotonic_ms();
+        if (children[i].pid == -1) {
+            children[i].pid = 0;
+            keep_going = 0;
+            return_code = 1;
+            break;
+        }
+    }
+
+    while (keep_going != 0) {
+        // reap every process that died and schedule its restart
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < n_processes; i++) {
+                if (children[i].pid != pid) {
+                    continue;
+                }
+                long now = monotonic_ms();
+                char how[64];
+                describe_exit(status, how, sizeof(how));
+                fprintf(stderr, "Worker process %d %s, restarting\n", (int) pid, how);
+                children[i].pid = 0;
+                children[i].restart_ms = now;
+                if (now - children[i].started_ms < RESTART_BACKOFF_MS) {
+                    children[i].restart_ms = now + RESTART_BACKOFF_MS;
+                }
+            }
+        }
+
+        long next_restart = -1;
+        for (int i = 0; i < n_processes; i++) {
+            if (children[i].pid != 0) {
+                continue;
+            }
+            long now = monotonic_ms();
+            if (children[i].restart_ms <= now) {
+                pid = spawn_worker_process(i, port, listen_fds, n_groups, &old_mask);
+                children[i].started_ms = now;
+                if (pid != -1) {
+                    children[i].pid = pid;
+                    continue;
+                }
+                children[i].restart_ms = now + RESTART_BACKOFF_MS; // fork failed, try again later
+            }
+            if (next_restart == -1 || children[i].restart_ms < next_restart) {
+                next_restart = children[i].restart_ms;
+            }
+        }
+
+        struct timespec timeout;
+        if (next_restart != -1) {
+            long wait_ms = next_restart - monotonic_ms();
+            if (wait_ms < 0) {
+                wait_ms = 0;
+            }
+            timeout.tv_sec = wait_ms / 1000;
+            timeout.tv_nsec = (wait_ms % 1000) * 1000000L;
+        }
+        int signo = sigtimedwait(&wait_mask, NULL, next_restart != -1 ? &timeout : NULL);
+        if (signo == SIGINT) {
+            keep_going = 0;
+        } else if (signo == -1 && errno != EAGAIN && errno != EINTR) {
+            perror("sigtimedwait");
+            keep_going = 0;
+            return_code = 1;
+        }
+    }
+
+    // pass the shutdown on, each process drains and stops on its own
+    for (int i = 0; i < n_processes; i++) {
+        if (children[i].pid != 0 && kill(children[i].pid, SIGINT) == -1) {
+            perror("kill");
+        }
+    }
+    for (int i = 0; i < n_processes; i++) {
+        if (children[i].pid == 0) {
+            continue;
+        }
+        int status;
+        while (waitpid(children[i].pid, &status, 0) == -1) {
+            if (errno != EINTR) {
+                perror("waitpid");
+                return_code = 1;
+                break;
+            }
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            char how[64];
+            describe_exit(status, how, sizeof(how));
+            fprintf(stderr, "Worker process %d %s\n", (int) children[i].pid, how);
+            return_code = 1;
+        }
+    }
+    free(children);
+
+    for (int i = 0; i < n_groups && n_acceptors == 0; i++) {
+        close(listen_fds[i]);
+    }
+    if (sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
+        perror("sigprocmask");
+        return_code = 1;
+    }
+    return return_code;
+}
+
+int main(int argc, char **argv) {
+    // Options first, then directory to serve and port
+    int opt;
+    while ((opt = getopt(argc, argv, "s:E:k:r:c:f:a:pC:P:U:D:Q:q:b:m:W:R:H:T:M:n:N:G:w:i:L:F:v")) != -1) {
+        switch (opt) {
+        case 's':
+            if (http_set_send_mode(optarg) == -1) {
+                fprintf(stderr, "Unknown send mode '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'E':
+            if (strcmp(optarg, "threads") == 0) {
+                engine = ENGINE_THREADS;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                engine = ENGINE_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                engine = ENGINE_URING;
+            } else {
+                fprintf(stderr, "Unknown engine '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            keep_alive_timeout_ms = atoi(optarg) * 1000;
+            if (keep_alive_timeout_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            max_requests_per_conn = atoi(optarg);
+            if (max_requests_per_conn < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (parse_size(optarg, &cache_budget) == -1) {
+                fprintf(stderr, "Invalid cache size '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            max_open_files = atoi(optarg);
+            if (max_open_files < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'a':
+            n_acceptors = atoi(optarg);
+            if (n_acceptors < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            pin_threads = 1;
+            break;
+        case 'C':
+            if (topology_parse_cpulist(optarg, &pin_cpus) == -1) {
+                fprintf(stderr, "Invalid CPU list '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            pin_cpus_given = 1;
+            pin_threads = 1;
+            break;
+        case 'P':
+            n_processes = atoi(optarg);
+            if (n_processes < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'U':
+            handoff_path = optarg;
+            break;
+        case 'D':
+            drain_timeout_ms = atoi(optarg) * 1000;
+            if (drain_timeout_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'Q':
+            if (strcmp(optarg, "mutex") == 0) {
+                queue_type = QUEUE_MUTEX;
+            } else if (strcmp(optarg, "lockfree") == 0) {
+                queue_type = QUEUE_LOCKFREE;
+            } else if (strcmp(optarg, "steal") == 0) {
+                queue_type = QUEUE_STEALING;
+                steal_policy = STEAL_ROUND_ROBIN;
+            } else if (strcmp(optarg, "steal-least") == 0) {
+                queue_type = QUEUE_STEALING;
+                steal_policy = STEAL_LEAST_LOADED;
+            } else {
+                fprintf(stderr, "Unknown queue type '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'q':
+            if (atoi(optarg) < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            queue_capacity = atoi(optarg);
+            break;
+        case 'b':
+            listen_backlog = atoi(optarg);
+            if (listen_backlog < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            max_inflight = atoi(optarg);
+            if (max_inflight < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'W':
+            queue_wait_ms = atoi(optarg);
+            if (queue_wait_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'R':
+            retry_after = atoi(optarg);
+            if (retry_after < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'H':
+            header_timeout_ms = atoi(optarg) * 1000;
+            if (header_timeout_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            send_timeout_ms = atoi(optarg) * 1000;
+            if (send_timeout_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'M':
+            min_send_rate = atoi(optarg);
+            if (min_send_rate < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            min_threads = atoi(optarg);
+            if (min_threads < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'N':
+            max_threads = atoi(optarg);
+            if (max_threads < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'G':
+            grow_depth = atoi(optarg);
+            if (grow_depth < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w':
+            grow_wait_ms = atoi(optarg);
+            if (grow_wait_ms < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'i':
+            idle_retire_ms = atoi(optarg) * 1000;
+            if (idle_retire_ms < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'L':
+            access_log_path = optarg;
+            break;
+        case 'F':
+            access_log_flush_ms = atoi(optarg);
+            if (access_log_flush_ms < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    serve_dir = argv[optind];
+    const char *port = argv[optind + 1];
+
+    // a regular file in place of the directory is an asset pack from mkpack,
+    // mapped once here so requests need no path syscalls
+    struct stat serve_info;
+    if (stat(serve_dir, &serve_info) == 0 && S_ISREG(serve_info.st_mode)) {
+        if (pack_open(&pack, serve_dir) == -1) {
+            return 1;
+        }
+        use_pack = 1;
+        cache_budget = 0; // nothing left to cache
+        http_set_pack(&pack);
+    }
+
+    if (max_threads < min_threads) {
+        max_threads = min_threads; // fixed-size pool
+    }
+    if (admission_init(max_inflight, queue_wait_ms, retry_after) == -1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (pin_threads && topology_init(pin_cpus_given ? &pin_cpus : NULL) == -1) {
+        return 1;
+    }
+    if (engine == ENGINE_URING && !uring_engine_supported()) {
+        fprintf(stderr, "io_uring is not available, using the threads engine\n");
+        engine = ENGINE_THREADS;
+    }
+    if (handoff_path != NULL && n_processes > 0) {
+        // the supervisor would have to pass the sockets on to new children
+        fprintf(stderr, "A control socket (-U) can't be used with worker processes (-P)\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (max_threads > min_threads && queue_type == QUEUE_STEALING) {
+        // the deques are sized to the worker count when the queue is created
+        fprintf(stderr, "An elastic pool (-N) can't be used with a work-stealing queue\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Catch SIGINT so we can clean up properly
+    struct sigaction sigact;
+    sigact.sa_handler = handle_sigint;
+    if (sigfillset(&sigact.sa_mask) == -1) {
+        perror("sigfillset");
+        return 1;
+    }
+
+    sigact.sa_flags = 0; // Note the lack of SA_RESTART
+    if (sigaction(SIGINT, &sigact, NULL) == -1) {
+        perror("sigaction");
+        return 1;
+    }
+    sigact.sa_handler = handle_wakeup;
+    if (sigaction(SIGUSR2, &sigact, NULL) == -1) {
+        perror("sigaction");
+        return 1;
+    }
+
+    // One group accepting on the main thread, or one SO_REUSEPORT socket and
+    // acceptor thread per group
+    int n_groups = n_acceptors > 0 ? n_acceptors : 1;
+    int *listen_fds = calloc(n_groups, sizeof(int));
+    if (listen_fds == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    // With a control socket, take the sockets over from a server already
+    // running there rather than binding new ones
+    int taken = 0;
+    if (handoff_path != NULL) {
+        taken = handoff_take(handoff_path, listen_fds, n_groups);
+        if (taken == -1) {
+            free(listen_fds);
+            return 1;
+        }
+        if (taken > 0) {
+            fprintf(stderr, "Took over %d listening sockets from the running server\n", taken);
+        }
+    }
+    for (int i = 0; i < n_groups && taken == 0; i++) {
+        listen_fds[i] = open_listener(port, n_acceptors > 0);
+        if (listen_fds[i] == -1) {
+            for (int j = 0; j < i; j++) {
+                close(listen_fds[j]);
+            }
+            free(listen_fds);
+            return 1;
+        }
+    }
+    if (handoff_path != NULL && (control_fd = handoff_listen(handoff_path)) == -1) {
+        for (int i = 0; i < n_groups; i++) {
+            close(listen_fds[i]);
+        }
+        free(listen_fds);
+        return 1;
+    }
+
+    int return_code = n_processes > 0 ? supervise(port, listen_fds, n_groups) : run_server(listen_fds, n_groups);
+    free(listen_fds);
+    close_control_socket(); // in case the server never got as far as serving
+
+    if (use_pack && pack_close(&pack) == -1) {
+        return_code = 1;
+    }
+
+    // TODO Complete the rest of this function
+    return return_code;
+}
@@ -0,0 +1,457 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Closed-loop HTTP load generator for http_server. Each client thread keeps
+// exactly one request in flight, picking files from a weighted mix, and
+// records every request's latency in its own histogram.
+
+#define DEFAULT_CLIENTS 8
+#define DEFAULT_DURATION 10 // seconds
+#define MAX_FILES 1024
+#define PATH_LEN 256
+#define REQUEST_BUFSIZE 512
+#define RESPONSE_BUFSIZE 65536
+#define RECV_TIMEOUT 5 // seconds before a stalled request counts as an error
+
+// Latency histogram in microseconds: exact below 64us, then 32 linear
+// sub-buckets per power of two (about 3% resolution) up to 2^40us
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT 40
+#define HIST_BUCKETS (2 * HIST_SUB + HIST_MAX_SHIFT * HIST_SUB)
+
+typedef struct {
+    char path[PATH_LEN];
+    unsigned int weight;
+} mix_entry_t;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    unsigned long requests;   // complete responses
+    unsigned long errors;     // connect/send/recv failures and malformed responses
+    unsigned long not_ok;     // complete responses with a status other than 200
+    unsigned long connects;
+    unsigned long long bytes; // response bytes, headers included
+    unsigned long hist[HIST_BUCKETS];
+} client_t;
+
+const char *host;
+struct addrinfo *server;
+int keep_alive = 1;
+mix_entry_t mix[MAX_FILES];
+int n_files = 0;
+unsigned long total_weight = 0;
+volatile int stop = 0;
+
+static long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static int hist_index(unsigned long long value) {
+    if (value < 2 * HIST_SUB) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    if (shift > HIST_MAX_SHIFT) {
+        return HIST_BUCKETS - 1;
+    }
+    return 2 * HIST_SUB + (shift - 1) * HIST_SUB + (int) ((value >> shift) - HIST_SUB);
+}
+
+// Largest value that falls in bucket 'index'
+static unsigned long long hist_value(int index) {
+    if (index < 2 * HIST_SUB) {
+        return index;
+    }
+    int shift = (index - 2 * HIST_SUB) / HIST_SUB + 1;
+    unsigned long long sub = (index - 2 * HIST_SUB) % HIST_SUB + HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Value at quantile q (0..1) of a histogram holding 'count' samples
+static unsigned long long hist_percentile(const unsigned long *hist, unsigned long count, double q) {
+    unsigned long target = (unsigned long) (q * count);
+    if (target >= count) {
+        target = count - 1;
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+// Pick a file from the mix according to its weight
+static const char *pick_path(unsigned int *seed) {
+    unsigned long ticket = rand_r(seed) % total_weight;
+    for (int i = 0; i < n_files; i++) {
+        if (ticket < mix[i].weight) {
+            return mix[i].path;
+        }
+        ticket -= mix[i].weight;
+    }
+    return mix[n_files - 1].path;
+}
+
+static int add_file(const char *path, unsigned int weight) {
+    if (n_files == MAX_FILES || weight == 0) {
+        return -1;
+    }
+    if (snprintf(mix[n_files].path, PATH_LEN, "%s", path) >= PATH_LEN) {
+        return -1;
+    }
+    mix[n_files].weight = weight;
+    n_files++;
+    total_weight += weight;
+    return 0;
+}
+
+// Every regular file in 'dir', equally weighted
+// Returns 0 on success or -1 on error
+int load_dir_mix(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror("opendir");
+        return -1;
+    }
+    struct dirent *entry;
+    char full_path[PATH_LEN * 2];
+    while ((entry = readdir(d)) != NULL) {
+        struct stat info;
+        snprintf(full_path, sizeof(full_path), "%s/%s", dir, entry->d_name);
+        if (stat(full_path, &info) == -1 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        if (add_file(entry->d_name, 1) == -1) {
+            fprintf(stderr, "Too many files or name too long: %s\n", entry->d_name);
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+// A mix file has one "<weight> <path>" line per file, '#' starts a comment
+// Returns 0 on success or -1 on error
+int load_mix_file(const char *mix_file) {
+    FILE *f = fopen(mix_file, "r");
+    if (f == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    char line[PATH_LEN + 32];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char path[PATH_LEN];
+        unsigned int weight;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        if (sscanf(line, "%u %255s", &weight, path) != 2 || add_file(path, weight) == -1) {
+            fprintf(stderr, "%s:%d: expected '<weight> <path>'\n", mix_file, line_no);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int open_connection(void) {
+    int fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+    if (fd == -1) {
+        return -1;
+    }
+    struct timeval timeout = { RECV_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, server->ai_addr, server->ai_addrlen) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Find a header's value in a NUL-terminated response header block
+static const char *find_header(const char *headers, const char *name) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(headers, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            return line + name_len + 1 + strspn(line + name_len + 1, " \t");
+        }
+    }
+    return NULL;
+}
+
+// Read one complete response
+// Returns the status code, or -1 if the connection failed or the response is
+// malformed. *reusable says if the server keeps the connection open.
+static int read_response(int fd, char *buf, unsigned long long *bytes, int *reusable) {
+    size_t len = 0;
+    char *header_end = NULL;
+    while (header_end == NULL) {
+        if (len == RESPONSE_BUFSIZE - 1) {
+            return -1;
+        }
+        ssize_t n = recv(fd, buf + len, RESPONSE_BUFSIZE - 1 - len, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        len += n;
+        buf[len] = '\0';
+        header_end = strstr(buf, "\r\n\r\n");
+    }
+    *header_end = '\0';
+
+    int status;
+    if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    const char *content_length = find_header(buf, "Content-Length");
+    if (content_length == NULL) {
+        return -1;
+    }
+    const char *connection = find_header(buf, "Connection");
+    *reusable = connection == NULL || strncasecmp(connection, "close", 5) != 0;
+
+    size_t header_len = header_end + 4 - buf;
+    unsigned long long body_len = strtoull(content_length, NULL, 10);
+    size_t buffered = len - header_len;
+    if (buffered > body_len) {
+        return -1; // we never pipeline, so nothing may follow the body
+    }
+    unsigned long long body_left = body_len - buffered;
+    while (body_left > 0) {
+        size_t want = body_left < RESPONSE_BUFSIZE ? body_left : RESPONSE_BUFSIZE;
+        ssize_t n = recv(fd, buf, want, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        body_left -= n;
+    }
+    *bytes += header_len + body_len;
+    return status;
+}
+
+void *client_func(void *arg) {
+    client_t *client = (client_t *) arg;
+    unsigned int seed = (unsigned int) now_us() ^ (client->id * 2654435761U);
+    char request[REQUEST_BUFSIZE];
+    char *buf = malloc(RESPONSE_BUFSIZE);
+    if (buf == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    int fd = -1;
+
+    while (!stop) {
+        const char *path = pick_path(&seed);
+        int request_len = snprintf(request, sizeof(request),
+                                   "GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                                   path, host, keep_alive ? "keep-alive" : "close");
+
+        long long start = now_us();
+        if (fd == -1) {
+            fd = open_connection();
+            if (fd == -1) {
+                client->errors++;
+                usleep(1000); // don't spin if the server is down
+                continue;
+            }
+            client->connects++;
+        }
+
+        int reusable = 0;
+        int status = -1;
+        if (send_all(fd, request, request_len) == 0) {
+            status = read_response(fd, buf, &client->bytes, &reusable);
+        }
+        if (status == -1) {
+            client->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        client->hist[hist_index(now_us() - start)]++;
+        client->requests++;
+        if (status != 200) {
+            client->not_ok++;
+        }
+        if (!keep_alive || !reusable) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+void print_usage(const char *prog_name) {
+    printf("Usage: %s [-c clients] [-d seconds] [-K] [-D directory | -m mix_file] <host> <port>\n"
+           "  -c  concurrent connections, each with one request in flight (default %d)\n"
+           "  -d  test duration in seconds (default %d)\n"
+           "  -K  new connection for every request instead of keep-alive\n"
+           "  -D  request every file in this directory equally often (default server_files)\n"
+           "  -m  weighted file mix, one '<weight> <path>' line per file\n",
+           prog_name, DEFAULT_CLIENTS, DEFAULT_DURATION);
+}
+
+int main(int argc, char **argv) {
+    int n_clients = DEFAULT_CLIENTS;
+    int duration = DEFAULT_DURATION;
+    const char *dir = "server_files";
+    const char *mix_file = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:KD:m:")) != -1) {
+        switch (opt) {
+        case 'c':
+            n_clients = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'K':
+            keep_alive = 0;
+            break;
+        case 'D':
+            dir = optarg;
+            break;
+        case 'm':
+            mix_file = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || n_clients < 1 || duration < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    host = argv[optind];
+    const char *port = argv[optind + 1];
+
+    if ((mix_file != NULL ? load_mix_file(mix_file) : load_dir_mix(dir)) == -1) {
+        return 1;
+    }
+    if (n_files == 0) {
+        fprintf(stderr, "No files to request\n");
+        return 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int ret_val = getaddrinfo(host, port, &hints, &server);
+    if (ret_val != 0) {
+        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(ret_val));
+        return 1;
+    }
+
+    client_t *clients = calloc(n_clients, sizeof(client_t));
+    if (clients == NULL) {
+        perror("calloc");
+        freeaddrinfo(server);
+        return 1;
+    }
+    long long start = now_us();
+    int n_started = 0;
+    for (int i = 0; i < n_clients; i++) {
+        clients[i].id = i;
+        int result = pthread_create(&clients[i].thread, NULL, client_func, &clients[i]);
+        if (result != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(result));
+            break;
+        }
+        n_started++;
+    }
+    if (n_started == n_clients) {
+        sleep(duration);
+    }
+    stop = 1;
+
+    // merge the per-client counters
+    client_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(clients[i].thread, NULL);
+        total.requests += clients[i].requests;
+        total.errors += clients[i].errors;
+        total.not_ok += clients[i].not_ok;
+        total.connects += clients[i].connects;
+        total.bytes += clients[i].bytes;
+        for (int j = 0; j < HIST_BUCKETS; j++) {
+            total.hist[j] += clients[i].hist[j];
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    free(clients);
+    freeaddrinfo(server);
+    if (n_started != n_clients) {
+        return 1;
+    }
+
+    printf("%d clients, %s, %d files, %.2fs\n", n_clients,
+           keep_alive ? "keep-alive" : "connection per request", n_files, elapsed);
+    printf("requests: %lu (%lu not 200), errors: %lu, connections: %lu\n",
+           total.requests, total.not_ok, total.errors, total.connects);
+    printf("throughput: %.1f req/s, %.2f MB/s\n",
+           total.requests / elapsed, total.bytes / elapsed / (1024 * 1024));
+    if (total.requests > 0) {
+        printf("latency: p50 %lluus, p90 %lluus, p99 %lluus, p999 %lluus\n",
+               hist_percentile(total.hist, total.requests, 0.50),
+               hist_percentile(total.hist, total.requests, 0.90),
+               hist_percentile(total.hist, total.requests, 0.99),
+               hist_percentile(total.hist, total.requests, 0.999));
+    }
+    return total.errors > 0 || total.requests == 0 ? 2 : 0;
+}
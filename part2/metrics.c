@@ -0,0 +1,359 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+static const int tracked_statuses[METRICS_N_STATUSES - 1] = {
+    200, 206, 304, 400, 404, 414, 416, 431, 501, 503
+};
+
+static const char *shed_reasons[METRICS_N_SHED_REASONS] = {"inflight", "queue_full", "queue_wait", "drain"};
+static const char *timeout_reasons[METRICS_N_TIMEOUTS] = {"idle", "header", "send", "drain"};
+static const char *pool_names[METRICS_N_POOLS] = {"arena", "conn", "buffer"};
+static const char *cache_names[METRICS_N_CACHES] = {"file", "fd"};
+
+static metrics_slot_t *slots = NULL;
+static int n_slots = 0;
+static long long *queued_at = NULL; // enqueue time by fd
+static long long start_us;
+// Sheds and timeouts are also seen by acceptor and watchdog threads, which
+// have no slot, so these are shared and counted with atomic adds
+static unsigned long shed[METRICS_N_SHED_REASONS];
+static unsigned long timeouts[METRICS_N_TIMEOUTS];
+static unsigned long workers_started;
+static unsigned long workers_retired;
+static metrics_cache_source_t cache_sources[METRICS_N_CACHES];
+
+// Slot of the calling worker, NULL for threads that don't record
+static __thread metrics_slot_t *my_slot = NULL;
+
+// Only the owning thread writes a slot, so a relaxed load and store is enough
+// and no read-modify-write is needed. Readers may see a slightly stale value.
+#define SLOT_ADD(field, value) __atomic_store_n(&(field), (field) + (value), __ATOMIC_RELAXED)
+#define SLOT_SET(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+long long metrics_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static int hist_index(long long value) {
+    if (value < 2 * METRICS_HIST_SUB) {
+        return value < 0 ? 0 : value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - METRICS_HIST_SUB_BITS;
+    if (shift > METRICS_HIST_MAX_SHIFT) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+    return 2 * METRICS_HIST_SUB + (shift - 1) * METRICS_HIST_SUB + (int) ((value >> shift) - METRICS_HIST_SUB);
+}
+
+// Largest value that falls in bucket 'index'
+static unsigned long long hist_value(int index) {
+    if (index < 2 * METRICS_HIST_SUB) {
+        return index;
+    }
+    int shift = (index - 2 * METRICS_HIST_SUB) / METRICS_HIST_SUB + 1;
+    unsigned long long sub = (index - 2 * METRICS_HIST_SUB) % METRICS_HIST_SUB + METRICS_HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+static unsigned long hist_count(const unsigned long *hist) {
+    unsigned long count = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        count += hist[i];
+    }
+    return count;
+}
+
+// Value at quantile q (0..1), or 0 for an empty histogram
+static unsigned long long hist_percentile(const unsigned long *hist, double q) {
+    unsigned long count = hist_count(hist);
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long target = (unsigned long) (q * count);
+    if (target >= count) {
+        target = count - 1;
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(METRICS_HIST_BUCKETS - 1);
+}
+
+int metrics_init(int slot_count) {
+    slots = calloc(slot_count, sizeof(metrics_slot_t));
+    queued_at = calloc(METRICS_MAX_FDS, sizeof(long long));
+    if (slots == NULL || queued_at == NULL) {
+        perror("calloc");
+        free(slots);
+        free(queued_at);
+        slots = NULL;
+        queued_at = NULL;
+        return -1;
+    }
+    n_slots = slot_count;
+    start_us = metrics_now_us();
+    return 0;
+}
+
+void metrics_attach(int id) {
+    if (slots != NULL && id >= 0 && id < n_slots) {
+        my_slot = &slots[id];
+    }
+}
+
+void metrics_connection_queued(int fd) {
+    if (queued_at != NULL && fd >= 0 && fd < METRICS_MAX_FDS) {
+        // the queue hand-off orders this store before the worker's load
+        __atomic_store_n(&queued_at[fd], metrics_now_us(), __ATOMIC_RELAXED);
+    }
+}
+
+long long metrics_connection_dequeued(int fd) {
+    if (my_slot == NULL || fd < 0 || fd >= METRICS_MAX_FDS) {
+        return -1;
+    }
+    long long queued = __atomic_load_n(&queued_at[fd], __ATOMIC_RELAXED);
+    if (queued == 0) {
+        return -1;
+    }
+    long long wait = metrics_now_us() - queued;
+    SLOT_ADD(my_slot->queue_wait_hist[hist_index(wait)], 1);
+    return wait;
+}
+
+void metrics_record_shed(int reason) {
+    __atomic_add_fetch(&shed[reason], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_record_timeout(int reason) {
+    __atomic_add_fetch(&timeouts[reason], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_record_worker_started(void) {
+    __atomic_add_fetch(&workers_started, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_record_worker_retired(void) {
+    __atomic_add_fetch(&workers_retired, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_record_parse(long long us) {
+    if (my_slot != NULL) {
+        SLOT_ADD(my_slot->parse_us, us);
+    }
+}
+
+void metrics_record_stat(long long us) {
+    if (my_slot != NULL) {
+        SLOT_ADD(my_slot->stat_us, us);
+    }
+}
+
+void metrics_record_send(long long us) {
+    if (my_slot != NULL) {
+        SLOT_ADD(my_slot->send_us, us);
+    }
+}
+
+void metrics_record_pool(int pool, size_t reserved, size_t high_water) {
+    if (my_slot != NULL) {
+        SLOT_SET(my_slot->pool_reserved[pool], reserved);
+        SLOT_SET(my_slot->pool_high_water[pool], high_water);
+    }
+}
+
+void metrics_record_response(int status, size_t bytes) {
+    if (my_slot == NULL) {
+        return;
+    }
+    int index = METRICS_N_STATUSES - 1;
+    for (int i = 0; i < METRICS_N_STATUSES - 1; i++) {
+        if (tracked_statuses[i] == status) {
+            index = i;
+            break;
+        }
+    }
+    SLOT_ADD(my_slot->statuses[index], 1);
+    SLOT_ADD(my_slot->bytes_sent, bytes);
+}
+
+void metrics_record_request(long long us) {
+    if (my_slot != NULL) {
+        SLOT_ADD(my_slot->requests, 1);
+        SLOT_ADD(my_slot->latency_hist[hist_index(us)], 1);
+    }
+}
+
+void metrics_set_cache_source(int cache, metrics_cache_source_t source) {
+    cache_sources[cache] = source;
+}
+
+// Add a slot's counters into 'total'
+static void sum_slot(metrics_slot_t *total, metrics_slot_t *slot) {
+    total->requests += __atomic_load_n(&slot->requests, __ATOMIC_RELAXED);
+    total->bytes_sent += __atomic_load_n(&slot->bytes_sent, __ATOMIC_RELAXED);
+    total->parse_us += __atomic_load_n(&slot->parse_us, __ATOMIC_RELAXED);
+    total->stat_us += __atomic_load_n(&slot->stat_us, __ATOMIC_RELAXED);
+    total->send_us += __atomic_load_n(&slot->send_us, __ATOMIC_RELAXED);
+    for (int i = 0; i < METRICS_N_STATUSES; i++) {
+        total->statuses[i] += __atomic_load_n(&slot->statuses[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < METRICS_N_POOLS; i++) {
+        total->pool_reserved[i] += __atomic_load_n(&slot->pool_reserved[i], __ATOMIC_RELAXED);
+        total->pool_high_water[i] += __atomic_load_n(&slot->pool_high_water[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        total->queue_wait_hist[i] += __atomic_load_n(&slot->queue_wait_hist[i], __ATOMIC_RELAXED);
+        total->latency_hist[i] += __atomic_load_n(&slot->latency_hist[i], __ATOMIC_RELAXED);
+    }
+}
+
+// snprintf onto the end of buf, tracking the length in *len
+// Returns 0 on success or -1 if the text does not fit
+static int append(char *buf, size_t size, size_t *len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+    if (n < 0 || (size_t) n >= size - *len) {
+        return -1;
+    }
+    *len += n;
+    return 0;
+}
+
+static int format_hist_text(char *buf, size_t size, size_t *len, const char *name, const unsigned long *hist) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (int i = 0; i < 4; i++) {
+        if (append(buf, size, len, "%s{quantile=\"%g\"} %llu\n", name, quantiles[i],
+                   hist_percentile(hist, quantiles[i])) == -1) {
+            return -1;
+        }
+    }
+    return append(buf, size, len, "%s_count %lu\n", name, hist_count(hist));
+}
+
+static int format_hist_json(char *buf, size_t size, size_t *len, const char *name, const unsigned long *hist) {
+    return append(buf, size, len, "\"%s\":{\"count\":%lu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu}",
+                  name, hist_count(hist), hist_percentile(hist, 0.5), hist_percentile(hist, 0.9),
+                  hist_percentile(hist, 0.99), hist_percentile(hist, 0.999));
+}
+
+int metrics_format(char *buf, size_t size, int json) {
+    if (size == 0) {
+        return -1;
+    }
+    buf[0] = '\0';
+    metrics_slot_t *total = calloc(1, sizeof(metrics_slot_t));
+    if (total == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (int i = 0; i < n_slots; i++) {
+        sum_slot(total, &slots[i]);
+    }
+    long long uptime = (metrics_now_us() - start_us) / 1000000;
+    metrics_cache_counts_t caches[METRICS_N_CACHES];
+    memset(caches, 0, sizeof(caches));
+    for (int i = 0; i < METRICS_N_CACHES; i++) {
+        if (cache_sources[i] != NULL) {
+            cache_sources[i](&caches[i]);
+        }
+    }
+
+    unsigned long started = __atomic_load_n(&workers_started, __ATOMIC_RELAXED);
+    unsigned long retired = __atomic_load_n(&workers_retired, __ATOMIC_RELAXED);
+
+    size_t len = 0;
+    int result = 0;
+    if (json) {
+        result |= append(buf, size, &len, "{\"uptime_seconds\":%lld,\"workers\":%d,\"workers_running\":%lu,"
+                         "\"workers_started\":%lu,\"workers_retired\":%lu,\"requests\":%lu,\"bytes_sent\":%llu,"
+                         "\"responses\":{", uptime, n_slots, started - retired, started, retired, total->requests,
+                         total->bytes_sent);
+        for (int i = 0; i < METRICS_N_STATUSES - 1; i++) {
+            result |= append(buf, size, &len, "\"%d\":%lu,", tracked_statuses[i], total->statuses[i]);
+        }
+        result |= append(buf, size, &len, "\"other\":%lu},\"shed\":{", total->statuses[METRICS_N_STATUSES - 1]);
+        for (int i = 0; i < METRICS_N_SHED_REASONS; i++) {
+            result |= append(buf, size, &len, "%s\"%s\":%lu", i > 0 ? "," : "", shed_reasons[i],
+                             __atomic_load_n(&shed[i], __ATOMIC_RELAXED));
+        }
+        result |= append(buf, size, &len, "},\"timeouts\":{");
+        for (int i = 0; i < METRICS_N_TIMEOUTS; i++) {
+            result |= append(buf, size, &len, "%s\"%s\":%lu", i > 0 ? "," : "", timeout_reasons[i],
+                             __atomic_load_n(&timeouts[i], __ATOMIC_RELAXED));
+        }
+        result |= append(buf, size, &len, "},\"pools\":{");
+        for (int i = 0; i < METRICS_N_POOLS; i++) {
+            result |= append(buf, size, &len, "%s\"%s\":{\"reserved_bytes\":%llu,\"high_water_bytes\":%llu}",
+                             i > 0 ? "," : "", pool_names[i], total->pool_reserved[i], total->pool_high_water[i]);
+        }
+        result |= append(buf, size, &len, "},\"caches\":{");
+        for (int i = 0; i < METRICS_N_CACHES; i++) {
+            result |= append(buf, size, &len, "%s\"%s\":{\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu,"
+                             "\"invalidations\":%lu}", i > 0 ? "," : "", cache_names[i], caches[i].hits,
+                             caches[i].misses, caches[i].evictions, caches[i].invalidations);
+        }
+        result |= append(buf, size, &len, "},\"time_us\":{\"parse\":%llu,\"stat\":%llu,\"send\":%llu},",
+                         total->parse_us, total->stat_us, total->send_us);
+        result |= format_hist_json(buf, size, &len, "queue_wait_us", total->queue_wait_hist);
+        result |= append(buf, size, &len, ",");
+        result |= format_hist_json(buf, size, &len, "latency_us", total->latency_hist);
+        result |= append(buf, size, &len, "}\n");
+    } else {
+        result |= append(buf, size, &len, "uptime_seconds %lld\nworkers %d\nworkers_running %lu\n"
+                         "workers_started_total %lu\nworkers_retired_total %lu\nrequests_total %lu\n"
+                         "bytes_sent_total %llu\n", uptime, n_slots, started - retired, started, retired,
+                         total->requests, total->bytes_sent);
+        for (int i = 0; i < METRICS_N_STATUSES - 1; i++) {
+            result |= append(buf, size, &len, "responses_total{status=\"%d\"} %lu\n", tracked_statuses[i], total->statuses[i]);
+        }
+        result |= append(buf, size, &len, "responses_total{status=\"other\"} %lu\n"
+                         "parse_us_total %llu\nstat_us_total %llu\nsend_us_total %llu\n",
+                         total->statuses[METRICS_N_STATUSES - 1], total->parse_us, total->stat_us, total->send_us);
+        for (int i = 0; i < METRICS_N_SHED_REASONS; i++) {
+            result |= append(buf, size, &len, "shed_total{reason=\"%s\"} %lu\n", shed_reasons[i],
+                             __atomic_load_n(&shed[i], __ATOMIC_RELAXED));
+        }
+        for (int i = 0; i < METRICS_N_TIMEOUTS; i++) {
+            result |= append(buf, size, &len, "timeouts_total{reason=\"%s\"} %lu\n", timeout_reasons[i],
+                             __atomic_load_n(&timeouts[i], __ATOMIC_RELAXED));
+        }
+        for (int i = 0; i < METRICS_N_POOLS; i++) {
+            result |= append(buf, size, &len, "pool_reserved_bytes{pool=\"%s\"} %llu\n"
+                             "pool_high_water_bytes{pool=\"%s\"} %llu\n", pool_names[i], total->pool_reserved[i],
+                             pool_names[i], total->pool_high_water[i]);
+        }
+        for (int i = 0; i < METRICS_N_CACHES; i++) {
+            result |= append(buf, size, &len, "cache_hits_total{cache=\"%s\"} %lu\n"
+                             "cache_misses_total{cache=\"%s\"} %lu\ncache_evictions_total{cache=\"%s\"} %lu\n"
+                             "cache_invalidations_total{cache=\"%s\"} %lu\n", cache_names[i], caches[i].hits,
+                             cache_names[i], caches[i].misses, cache_names[i], caches[i].evictions,
+                             cache_names[i], caches[i].invalidations);
+        }
+        result |= format_hist_text(buf, size, &len, "queue_wait_us", total->queue_wait_hist);
+        result |= format_hist_text(buf, size, &len, "latency_us", total->latency_hist);
+    }
+    free(total);
+    return result == 0 ? (int) len : -1;
+}
+
+void metrics_free(void) {
+    free(slots);
+    free(queued_at);
+    slots = NULL;
+    queued_at = NULL;
+    n_slots = 0;
+}
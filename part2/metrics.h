@@ -0,0 +1,172 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+// Requests for this path are answered with the server's metrics instead of
+// a file. METRICS_JSON_PATH returns the same numbers as JSON.
+#define METRICS_PATH "/__stats"
+#define METRICS_JSON_PATH "/__stats.json"
+
+// Histograms are in microseconds: exact below 32us, then 16 linear
+// sub-buckets per power of two (about 6% resolution) up to about 2^36us
+#define METRICS_HIST_SUB_BITS 4
+#define METRICS_HIST_SUB (1 << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_MAX_SHIFT 32
+#define METRICS_HIST_BUCKETS (2 * METRICS_HIST_SUB + METRICS_HIST_MAX_SHIFT * METRICS_HIST_SUB)
+
+// Statuses with their own counter, anything else is counted as "other"
+#define METRICS_N_STATUSES 11
+
+// Why a connection was answered with a 503 instead of being served
+#define METRICS_SHED_INFLIGHT 0   // too many connections already in flight
+#define METRICS_SHED_QUEUE_FULL 1 // no room in the connection queue in time
+#define METRICS_SHED_QUEUE_WAIT 2 // waited in the queue past the deadline
+#define METRICS_SHED_DRAIN 3      // still queued when the shutdown drain ran out of time
+#define METRICS_N_SHED_REASONS 4
+
+// Which deadline a connection missed when it was dropped
+#define METRICS_TIMEOUT_IDLE 0   // no new request on a kept-alive connection
+#define METRICS_TIMEOUT_HEADER 1 // request header not complete in time
+#define METRICS_TIMEOUT_SEND 2   // response stalled or sent too slowly
+#define METRICS_TIMEOUT_DRAIN 3  // still in progress when the shutdown drain ran out of time
+#define METRICS_N_TIMEOUTS 4
+
+// Per-thread memory pools, see arena.h and slab.h
+#define METRICS_POOL_ARENA 0  // request scratch space
+#define METRICS_POOL_CONN 1   // io_uring connection state
+#define METRICS_POOL_BUFFER 2 // io_uring file chunk buffers
+#define METRICS_N_POOLS 3
+
+// Caches whose counters are reported, see metrics_set_cache_source
+#define METRICS_CACHE_FILE 0 // file contents, summed over per-node caches
+#define METRICS_CACHE_FD 1   // open descriptors and stat results
+#define METRICS_N_CACHES 2
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+} metrics_cache_counts_t;
+
+// Fills in a cache's current counters when metrics are formatted
+typedef void (*metrics_cache_source_t)(metrics_cache_counts_t *counts);
+
+#define METRICS_PAD_SIZE 64
+// Queue wait is only tracked for descriptors below this
+#define METRICS_MAX_FDS 65536
+
+// Counters owned by one worker thread. Only that thread writes them, with
+// plain relaxed stores, so recording never takes a lock or bounces a cache
+// line between workers. Readers sum every slot when metrics are requested.
+typedef struct {
+    unsigned long requests;
+    unsigned long long bytes_sent;
+    unsigned long statuses[METRICS_N_STATUSES];
+    unsigned long long parse_us; // reading and parsing request headers
+    unsigned long long stat_us;  // finding the file (cache lookup or stat/open)
+    unsigned long long send_us;  // writing the header and body
+    unsigned long queue_wait_hist[METRICS_HIST_BUCKETS];
+    unsigned long latency_hist[METRICS_HIST_BUCKETS]; // request read to response sent
+    unsigned long long pool_reserved[METRICS_N_POOLS];   // bytes held by the thread's pools
+    unsigned long long pool_high_water[METRICS_N_POOLS]; // most bytes in use at once
+    char pad[METRICS_PAD_SIZE];
+} metrics_slot_t;
+
+/*
+ * Allocate one slot per worker thread. Must be called before any worker
+ * threads start. Until then every recording function does nothing.
+ * n_slots: Number of worker threads that will call metrics_attach
+ * Returns 0 on success or -1 on error
+ */
+int metrics_init(int n_slots);
+
+/*
+ * Bind the calling thread to slot 'id' (0 <= id < n_slots). Only one running
+ * thread may use a slot at a time, a slot's counts survive across threads.
+ */
+void metrics_attach(int id);
+
+/*
+ * Current CLOCK_MONOTONIC time in microseconds
+ */
+long long metrics_now_us(void);
+
+/*
+ * Note that a connection was just put on the connection queue, and, once a
+ * worker takes it, how long it waited there. metrics_connection_dequeued
+ * returns the wait in microseconds, or -1 if it wasn't tracked.
+ */
+void metrics_connection_queued(int fd);
+long long metrics_connection_dequeued(int fd);
+
+/*
+ * Count a connection turned away for METRICS_SHED_* 'reason'. Unlike the
+ * other recording functions this may be called from any thread.
+ */
+void metrics_record_shed(int reason);
+
+/*
+ * Count a connection dropped for missing METRICS_TIMEOUT_* deadline
+ * 'reason'. May be called from any thread.
+ */
+void metrics_record_timeout(int reason);
+
+/*
+ * Count a worker thread started, or retired by the elastic pool. May be
+ * called from any thread.
+ */
+void metrics_record_worker_started(void);
+void metrics_record_worker_retired(void);
+
+/*
+ * Add time spent in one phase of answering a request, in microseconds
+ */
+void metrics_record_parse(long long us);
+void metrics_record_stat(long long us);
+void metrics_record_send(long long us);
+
+/*
+ * Count a response with 'status' of 'bytes' bytes, header included
+ */
+void metrics_record_response(int status, size_t bytes);
+
+/*
+ * Record the latency of a complete request, in microseconds
+ */
+void metrics_record_request(long long us);
+
+/*
+ * Publish the state of one of the calling thread's memory pools, replacing
+ * what it reported before
+ * pool: One of METRICS_POOL_*
+ * reserved: Bytes the pool holds from the system
+ * high_water: Most bytes it has had in use at once
+ */
+void metrics_record_pool(int pool, size_t reserved, size_t high_water);
+
+/*
+ * Report a cache's counters through 'source', which is called on every
+ * metrics_format. Caches keep their own counters under their own locks, so
+ * they are asked rather than recorded into slots. A cache without a source
+ * reports zeros. Must be called before any worker threads start.
+ * cache: One of METRICS_CACHE_*
+ */
+void metrics_set_cache_source(int cache, metrics_cache_source_t source);
+
+/*
+ * Sum every slot and format the totals and latency percentiles.
+ * buf: Buffer to format into
+ * size: Size of 'buf' in bytes
+ * json: 1 for a JSON object, 0 for "name value" lines
+ * Returns the length of the formatted text, or -1 if it does not fit
+ */
+int metrics_format(char *buf, size_t size, int json);
+
+/*
+ * Deallocates the slots. No worker thread may still be recording.
+ */
+void metrics_free(void);
+
+#endif // METRICS_H
@@ -0,0 +1,188 @@
+// Build-time generator for the MIME type table used by get_mime_type.
+// Reads a mime.types style file ("type ext ext ...") and writes a C header
+// with a hash-and-displace perfect hash over the extensions: a first hash
+// picks a bucket, the bucket's displacement seeds a second hash that picks the
+// slot, and every extension has a slot of its own, so a lookup is two hashes
+// and one strcmp.
+// Usage: mime_gen mime.types > mime_table.h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mime_hash.h"
+
+#define LINE_LEN 512
+#define MAX_ENTRIES 4096
+#define MAX_DISPLACEMENT 100000
+
+typedef struct {
+    char *extension; // with the leading '.', as get_mime_type is called
+    char *type;
+    uint32_t bucket;
+} mime_entry_t;
+
+static mime_entry_t entries[MAX_ENTRIES];
+static int n_entries = 0;
+
+static unsigned next_pow2(unsigned n) {
+    unsigned p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// Returns 0 on success or -1 on error
+static int read_types(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    char line[LINE_LEN];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        char *save;
+        char *type = strtok_r(line, " \t\r\n", &save);
+        if (type == NULL) {
+            continue;
+        }
+        char *ext;
+        while ((ext = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (n_entries == MAX_ENTRIES) {
+                fprintf(stderr, "mime_gen: more than %d extensions\n", MAX_ENTRIES);
+                fclose(file);
+                return -1;
+            }
+            for (int i = 0; i < n_entries; i++) {
+                if (strcmp(entries[i].extension + 1, ext) == 0) {
+                    fprintf(stderr, "mime_gen: extension '%s' listed twice\n", ext);
+                    fclose(file);
+                    return -1;
+                }
+            }
+            mime_entry_t *entry = &entries[n_entries++];
+            entry->extension = malloc(strlen(ext) + 2);
+            entry->type = strdup(type);
+            if (entry->extension == NULL || entry->type == NULL) {
+                perror("malloc");
+                fclose(file);
+                return -1;
+            }
+            entry->extension[0] = '.';
+            strcpy(entry->extension + 1, ext);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// Sort buckets by descending size so the crowded ones are placed first
+static uint32_t *bucket_sizes;
+static int compare_buckets(const void *a, const void *b) {
+    uint32_t size_a = bucket_sizes[*(const uint32_t *) a];
+    uint32_t size_b = bucket_sizes[*(const uint32_t *) b];
+    return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s mime.types\n", argv[0]);
+        return 1;
+    }
+    if (read_types(argv[1]) == -1) {
+        return 1;
+    }
+    if (n_entries == 0) {
+        fprintf(stderr, "mime_gen: no extensions in %s\n", argv[1]);
+        return 1;
+    }
+
+    unsigned n_slots = next_pow2(n_entries + n_entries / 4);
+    unsigned n_buckets = next_pow2((n_entries + 1) / 2);
+    uint32_t *displacement = calloc(n_buckets, sizeof(uint32_t));
+    bucket_sizes = calloc(n_buckets, sizeof(uint32_t));
+    uint32_t *order = malloc(n_buckets * sizeof(uint32_t));
+    int *slots = malloc(n_slots * sizeof(int));
+    int *trial = malloc(n_slots * sizeof(int));
+    if (displacement == NULL || bucket_sizes == NULL || order == NULL || slots == NULL || trial == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (unsigned i = 0; i < n_slots; i++) {
+        slots[i] = -1;
+    }
+    for (int i = 0; i < n_entries; i++) {
+        entries[i].bucket = mime_hash(entries[i].extension, 0) & (n_buckets - 1);
+        bucket_sizes[entries[i].bucket]++;
+    }
+    for (unsigned b = 0; b < n_buckets; b++) {
+        order[b] = b;
+    }
+    qsort(order, n_buckets, sizeof(uint32_t), compare_buckets);
+
+    // give each bucket the first displacement that lands all of its
+    // extensions in distinct free slots
+    for (unsigned o = 0; o < n_buckets && bucket_sizes[order[o]] > 0; o++) {
+        uint32_t bucket = order[o];
+        uint32_t d;
+        for (d = 1; d < MAX_DISPLACEMENT; d++) {
+            int placed = 0;
+            int ok = 1;
+            for (int i = 0; i < n_entries && ok; i++) {
+                if (entries[i].bucket != bucket) {
+                    continue;
+                }
+                uint32_t slot = mime_hash(entries[i].extension, d) & (n_slots - 1);
+                if (slots[slot] != -1) {
+                    ok = 0;
+                }
+                for (int j = 0; j < placed && ok; j++) {
+                    if ((uint32_t) trial[j] == slot) {
+                        ok = 0;
+                    }
+                }
+                trial[placed++] = slot;
+            }
+            if (ok) {
+                placed = 0;
+                for (int i = 0; i < n_entries; i++) {
+                    if (entries[i].bucket == bucket) {
+                        slots[trial[placed++]] = i;
+                    }
+                }
+                break;
+            }
+        }
+        if (d == MAX_DISPLACEMENT) {
+            fprintf(stderr, "mime_gen: no perfect hash found\n");
+            return 1;
+        }
+        displacement[bucket] = d;
+    }
+
+    printf("// Generated by mime_gen from %s, do not edit\n\n", argv[1]);
+    printf("#include <stdint.h>\n\n");
+    printf("#define MIME_TABLE_SIZE %u\n", n_slots);
+    printf("#define MIME_BUCKETS %u\n\n", n_buckets);
+    printf("static const uint32_t mime_displacement[MIME_BUCKETS] = {");
+    for (unsigned b = 0; b < n_buckets; b++) {
+        printf("%s%u", b % 12 == 0 ? "\n    " : " ", displacement[b]);
+        if (b + 1 < n_buckets) {
+            printf(",");
+        }
+    }
+    printf("\n};\n\n");
+    printf("static const struct {\n    const char *extension;\n    const char *type;\n} mime_table[MIME_TABLE_SIZE] = {\n");
+    for (unsigned s = 0; s < n_slots; s++) {
+        if (slots[s] != -1) {
+            printf("    [%u] = {\"%s\", \"%s\"},\n", s, entries[slots[s]].extension, entries[slots[s]].type);
+        }
+    }
+    printf("};\n");
+    return 0;
+}
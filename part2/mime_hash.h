@@ -0,0 +1,21 @@
+#ifndef MIME_HASH_H
+#define MIME_HASH_H
+
+#include <stdint.h>
+
+// Hash used by the generated MIME table, shared by mime_gen and http.c.
+// The seed selects one of a family of FNV-1a variants, and the final mix
+// spreads short extensions over the whole 32 bits.
+static inline uint32_t mime_hash(const char *str, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (const char *c = str; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+#endif // MIME_HASH_H
@@ -0,0 +1,160 @@
+// Generated by mime_gen from mime.types, do not edit
+
+#include <stdint.h>
+
+#define MIME_TABLE_SIZE 256
+#define MIME_BUCKETS 128
+
+static const uint32_t mime_displacement[MIME_BUCKETS] = {
+    0, 0, 0, 3, 0, 0, 1, 3, 1, 1, 1, 8,
+    1, 1, 0, 0, 1, 1, 1, 2, 0, 0, 0, 2,
+    0, 2, 1, 0, 0, 1, 0, 1, 1, 0, 3, 3,
+    0, 1, 0, 0, 1, 1, 1, 3, 2, 0, 0, 3,
+    0, 0, 1, 2, 0, 2, 3, 0, 1, 1, 1, 4,
+    1, 0, 0, 1, 0, 1, 0, 1, 2, 1, 0, 1,
+    1, 1, 2, 2, 0, 1, 1, 0, 2, 1, 2, 0,
+    10, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 3,
+    1, 0, 0, 3, 2, 1, 2, 0, 4, 4, 0, 2,
+    0, 0, 3, 0, 1, 1, 0, 7, 3, 3, 1, 0,
+    0, 1, 0, 0, 1, 1, 2, 0
+};
+
+static const struct {
+    const char *extension;
+    const char *type;
+} mime_table[MIME_TABLE_SIZE] = {
+    [3] = {".pgm", "image/x-portable-graymap"},
+    [5] = {".htm", "text/html"},
+    [8] = {".deb", "application/octet-stream"},
+    [9] = {".ics", "text/calendar"},
+    [10] = {".crt", "application/x-x509-ca-cert"},
+    [12] = {".ear", "application/java-archive"},
+    [15] = {".exe", "application/octet-stream"},
+    [22] = {".heic", "image/heic"},
+    [24] = {".sh", "text/x-shellscript"},
+    [25] = {".mkv", "video/x-matroska"},
+    [26] = {".sql", "application/sql"},
+    [29] = {".pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    [31] = {".jpg", "image/jpeg"},
+    [33] = {".tsv", "text/tab-separated-values"},
+    [36] = {".htc", "text/x-component"},
+    [39] = {".bz2", "application/x-bzip2"},
+    [40] = {".png", "image/png"},
+    [42] = {".xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    [43] = {".jfif", "image/jpeg"},
+    [45] = {".m4a", "audio/mp4"},
+    [46] = {".pem", "application/x-x509-ca-cert"},
+    [48] = {".opus", "audio/ogg"},
+    [51] = {".zst", "application/zstd"},
+    [52] = {".ogv", "video/ogg"},
+    [54] = {".ttc", "application/x-font-ttf"},
+    [56] = {".ttf", "font/ttf"},
+    [58] = {".jad", "text/vnd.sun.j2me.app-descriptor"},
+    [59] = {".dmg", "application/octet-stream"},
+    [60] = {".mpeg", "video/mpeg"},
+    [61] = {".weba", "audio/webm"},
+    [63] = {".eot", "application/vnd.ms-fontobject"},
+    [66] = {".log", "text/plain"},
+    [67] = {".ts", "video/mp2t"},
+    [68] = {".gif", "image/gif"},
+    [69] = {".odt", "application/vnd.oasis.opendocument.text"},
+    [71] = {".webmanifest", "application/manifest+json"},
+    [72] = {".tif", "image/tiff"},
+    [74] = {".doc", "application/msword"},
+    [78] = {".md", "text/plain"},
+    [79] = {".o", "application/octet-stream"},
+    [81] = {".eps", "application/postscript"},
+    [82] = {".mpg", "video/mpeg"},
+    [83] = {".svgz", "image/svg+xml"},
+    [86] = {".flac", "audio/flac"},
+    [89] = {".wav", "audio/wav"},
+    [94] = {".docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    [95] = {".midi", "audio/midi"},
+    [96] = {".woff", "font/woff"},
+    [98] = {".a", "application/octet-stream"},
+    [99] = {".cxx", "text/x-c++"},
+    [101] = {".shtml", "text/html"},
+    [103] = {".p7m", "application/pkcs7-mime"},
+    [105] = {".conf", "text/plain"},
+    [107] = {".3gp", "video/3gpp"},
+    [108] = {".ini", "text/plain"},
+    [109] = {".class", "application/octet-stream"},
+    [115] = {".svg", "image/svg+xml"},
+    [123] = {".map", "application/json"},
+    [124] = {".jsonld", "application/ld+json"},
+    [126] = {".7z", "application/x-7z-compressed"},
+    [127] = {".rss", "application/rss+xml"},
+    [130] = {".py", "text/x-python"},
+    [131] = {".xls", "application/vnd.ms-excel"},
+    [134] = {".rar", "application/vnd.rar"},
+    [135] = {".mid", "audio/midi"},
+    [136] = {".ppm", "image/x-portable-pixmap"},
+    [137] = {".woff2", "font/woff2"},
+    [138] = {".mjs", "application/javascript"},
+    [140] = {".avi", "video/x-msvideo"},
+    [141] = {".csv", "text/csv"},
+    [142] = {".run", "application/x-sh"},
+    [143] = {".txt", "text/plain"},
+    [144] = {".tex", "application/x-tex"},
+    [145] = {".ppt", "application/vnd.ms-powerpoint"},
+    [147] = {".webp", "image/webp"},
+    [149] = {".jpeg", "image/jpeg"},
+    [150] = {".mkd", "text/markdown"},
+    [151] = {".iso", "application/octet-stream"},
+    [152] = {".xz", "application/x-xz"},
+    [156] = {".gz", "application/gzip"},
+    [157] = {".img", "application/octet-stream"},
+    [161] = {".ps", "application/postscript"},
+    [162] = {".pbm", "image/x-portable-bitmap"},
+    [164] = {".ico", "image/x-icon"},
+    [165] = {".webm", "video/webm"},
+    [168] = {".jpe", "image/jpeg"},
+    [169] = {".mov", "video/quicktime"},
+    [170] = {".msi", "application/octet-stream"},
+    [173] = {".jar", "application/java-archive"},
+    [176] = {".cc", "text/x-c++"},
+    [177] = {".hpp", "text/x-c++"},
+    [179] = {".js", "application/javascript"},
+    [180] = {".avif", "image/avif"},
+    [181] = {".war", "application/java-archive"},
+    [182] = {".pdf", "application/pdf"},
+    [183] = {".html", "text/html"},
+    [186] = {".tiff", "image/tiff"},
+    [187] = {".zip", "application/zip"},
+    [188] = {".tar", "application/x-tar"},
+    [192] = {".mp3", "audio/mpeg"},
+    [193] = {".odp", "application/vnd.oasis.opendocument.presentation"},
+    [198] = {".ogg", "audio/ogg"},
+    [199] = {".mp4", "video/mp4"},
+    [200] = {".der", "application/x-x509-ca-cert"},
+    [201] = {".ai", "application/postscript"},
+    [203] = {".latex", "application/x-latex"},
+    [205] = {".otf", "font/otf"},
+    [207] = {".oga", "audio/ogg"},
+    [209] = {".c", "text/x-c"},
+    [210] = {".rtf", "application/rtf"},
+    [212] = {".bin", "application/octet-stream"},
+    [213] = {".dll", "application/octet-stream"},
+    [216] = {".rpm", "application/octet-stream"},
+    [217] = {".vtt", "text/vtt"},
+    [218] = {".xml", "text/xml"},
+    [222] = {".h", "text/x-c"},
+    [224] = {".flv", "video/x-flv"},
+    [225] = {".ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    [226] = {".java", "text/x-java-source"},
+    [227] = {".cpp", "text/x-c++"},
+    [231] = {".xhtml", "application/xhtml+xml"},
+    [233] = {".swf", "application/x-shockwave-flash"},
+    [234] = {".css", "text/css"},
+    [235] = {".text", "text/plain"},
+    [236] = {".so", "application/octet-stream"},
+    [237] = {".m4v", "video/mp4"},
+    [238] = {".epub", "application/epub+zip"},
+    [243] = {".bmp", "image/bmp"},
+    [244] = {".json", "application/json"},
+    [245] = {".atom", "application/atom+xml"},
+    [246] = {".markdown", "text/plain"},
+    [248] = {".aac", "audio/aac"},
+    [249] = {".mml", "text/mathml"},
+    [251] = {".wasm", "application/wasm"},
+};
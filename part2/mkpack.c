@@ -0,0 +1,271 @@
+// Build-time tool that bundles a directory into an asset pack for the
+// server (see pack.h). Every regular file is stored with its 200 response
+// header already formatted, and text-like files also with
+// compressed copies, so serving from the pack costs no formatting or
+// compression at run time.
+// Usage: mkpack <directory> <pack>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "compress.h"
+#include "http.h"
+#include "pack.h"
+
+#define HEADER_BUFSIZE 512
+
+typedef struct {
+    char *path;  // on disk
+    char *name;  // request path, relative to the directory
+    struct stat info;
+} pack_file_t;
+
+static pack_file_t *files = NULL;
+static size_t n_files = 0;
+static size_t files_capacity = 0;
+
+// Collect the regular files under 'dir'
+// Returns 0 on success or -1 on error
+static int collect(const char *root, const char *dir) {
+    DIR *stream = opendir(dir);
+    if (stream == NULL) {
+        perror("opendir");
+        return -1;
+    }
+    struct dirent *dirent;
+    while ((dirent = readdir(stream)) != NULL) {
+        if (dirent->d_name[0] == '.') {
+            continue; // ., .. and hidden files
+        }
+        char path[PATH_MAX];
+        struct stat info;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, dirent->d_name) >= (int) sizeof(path) ||
+            stat(path, &info) == -1) {
+            fprintf(stderr, "mkpack: skipping %s/%s\n", dir, dirent->d_name);
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            if (collect(root, path) == -1) {
+                closedir(stream);
+                return -1;
+            }
+            continue;
+        }
+        if (!S_ISREG(info.st_mode)) {
+            fprintf(stderr, "mkpack: skipping %s, not a regular file\n", path);
+            continue;
+        }
+        if (n_files == files_capacity) {
+            files_capacity = files_capacity == 0 ? 64 : files_capacity * 2;
+            pack_file_t *grown = realloc(files, files_capacity * sizeof(pack_file_t));
+            if (grown == NULL) {
+                perror("realloc");
+                closedir(stream);
+                return -1;
+            }
+            files = grown;
+        }
+        pack_file_t *file = &files[n_files++];
+        file->path = strdup(path);
+        file->name = strdup(path + strlen(root)); // keeps the leading '/'
+        file->info = info;
+        if (file->path == NULL || file->name == NULL) {
+            perror("strdup");
+            closedir(stream);
+            return -1;
+        }
+    }
+    closedir(stream);
+    return 0;
+}
+
+// Write 'len' bytes at 'offset'
+// Returns 0 on success or -1 on error
+static int write_at(int fd, const void *data, size_t len, off_t offset) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n == -1) {
+            perror("pwrite");
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Append a blob at *end, aligned to 'align', and describe it in 'blob'
+// Returns 0 on success or -1 on error
+static int append(int fd, const void *data, size_t len, size_t align, uint64_t *end, pack_blob_t *blob) {
+    *end = (*end + align - 1) / align * align;
+    blob->offset = *end;
+    blob->len = len;
+    *end += len;
+    return write_at(fd, data, len, blob->offset);
+}
+
+// Read a whole file into a malloc'd buffer
+// Returns the buffer, or NULL on error
+static char *read_file(const char *path, size_t size) {
+    char *data = malloc(size > 0 ? size : 1);
+    int fd = open(path, O_RDONLY);
+    if (data == NULL || fd == -1) {
+        perror(data == NULL ? "malloc" : "open");
+        free(data);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n <= 0) {
+            fprintf(stderr, "mkpack: %s changed while being read\n", path);
+            free(data);
+            close(fd);
+            return NULL;
+        }
+        done += n;
+    }
+    close(fd);
+    return data;
+}
+
+// Store one file's name, headers and bodies, filling in 'entry'
+// Returns 0 on success or -1 on error
+static int add_file(int fd, const pack_file_t *file, uint64_t *end, pack_entry_t *entry) {
+    const struct stat *info = &file->info;
+    char header[HEADER_BUFSIZE];
+    int header_len = http_format_header(header, sizeof(header), file->path, info);
+    char *body = read_file(file->path, info->st_size);
+    if (header_len == -1 || body == NULL) {
+        free(body);
+        return -1;
+    }
+
+    size_t name_len = strlen(file->name);
+    entry->hash = pack_hash(file->name, name_len);
+    entry->ino = info->st_ino;
+    entry->size = info->st_size;
+    entry->mtime_sec = info->st_mtim.tv_sec;
+    entry->mtime_nsec = info->st_mtim.tv_nsec;
+    if (append(fd, file->name, name_len + 1, 1, end, &entry->name) == -1 ||
+        append(fd, header, header_len, 1, end, &entry->header) == -1 ||
+        append(fd, body, info->st_size, PACK_ALIGN, end, &entry->body) == -1) {
+        free(body);
+        return -1;
+    }
+
+    // compressed copies, kept only when they are smaller
+    int ret_val = 0;
+    if (compress_eligible(http_content_type(file->path))) {
+        for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR && ret_val == 0; encoding++) {
+            char *encoded;
+            size_t encoded_len;
+            if (!compress_available(encoding) ||
+                compress_buffer(encoding, body, info->st_size, &encoded, &encoded_len) == -1) {
+                continue;
+            }
+            if (encoded_len < (size_t) info->st_size) {
+                header_len = http_format_encoded_header(header, sizeof(header), file->path, info, encoding,
+                                                        encoded_len);
+                if (header_len == -1 ||
+                    append(fd, header, header_len, 1, end, &entry->encoded_header[encoding - 1]) == -1 ||
+                    append(fd, encoded, encoded_len, PACK_ALIGN, end, &entry->encoded_body[encoding - 1]) == -1) {
+                    ret_val = -1;
+                }
+            }
+            free(encoded);
+        }
+    }
+    free(body);
+    return ret_val;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <directory> <pack>\n", argv[0]);
+        return 1;
+    }
+    // names are what follows the directory, so they start with '/'
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s", argv[1]);
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') {
+        root[--root_len] = '\0';
+    }
+    if (collect(root, root) == -1) {
+        return 1;
+    }
+
+    // keep the table at most half full so probes stay short
+    pack_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, PACK_MAGIC_LEN);
+    header.n_entries = n_files;
+    header.n_slots = 2;
+    while (header.n_slots < 2 * n_files + 1) {
+        header.n_slots *= 2;
+    }
+    header.entries_offset = sizeof(pack_header_t);
+    header.slots_offset = header.entries_offset + n_files * sizeof(pack_entry_t);
+    pack_entry_t *entries = calloc(n_files > 0 ? n_files : 1, sizeof(pack_entry_t));
+    uint32_t *slots = calloc(header.n_slots, sizeof(uint32_t));
+    if (entries == NULL || slots == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    // write to a temporary file and rename it into place, so a server
+    // starting meanwhile never maps a half-written pack
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[2]) >= (int) sizeof(tmp_path)) {
+        fprintf(stderr, "mkpack: path too long\n");
+        return 1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open");
+        return 1;
+    }
+    uint64_t end = header.slots_offset + header.n_slots * sizeof(uint32_t);
+    for (size_t i = 0; i < n_files; i++) {
+        if (add_file(fd, &files[i], &end, &entries[i]) == -1) {
+            fprintf(stderr, "mkpack: failed to add %s\n", files[i].path);
+            close(fd);
+            unlink(tmp_path);
+            return 1;
+        }
+        uint32_t slot = entries[i].hash & (header.n_slots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (header.n_slots - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    header.size = end;
+
+    if (write_at(fd, &header, sizeof(header), 0) == -1 ||
+        write_at(fd, entries, n_files * sizeof(pack_entry_t), header.entries_offset) == -1 ||
+        write_at(fd, slots, header.n_slots * sizeof(uint32_t), header.slots_offset) == -1 ||
+        ftruncate(fd, end) == -1 || fsync(fd) == -1) {
+        perror("mkpack");
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+    if (close(fd) == -1 || rename(tmp_path, argv[2]) == -1) {
+        perror("mkpack");
+        unlink(tmp_path);
+        return 1;
+    }
+    printf("Packed %zu files from %s into %s (%llu bytes)\n", n_files, root, argv[2], (unsigned long long) end);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pack.h"
+
+// Returns 1 if a blob lies inside the pack, 0 otherwise
+static int blob_in_bounds(const pack_t *pack, const pack_blob_t *blob) {
+    return blob->offset <= pack->size && blob->len <= pack->size - blob->offset;
+}
+
+// Returns 0 if the header, index and every entry's blobs are in bounds, -1
+// otherwise
+static int validate(const pack_t *pack) {
+    const pack_header_t *header = pack->header;
+    if (pack->size < sizeof(pack_header_t) || memcmp(header->magic, PACK_MAGIC, PACK_MAGIC_LEN) != 0 ||
+        header->size != pack->size) {
+        return -1;
+    }
+    if (header->n_slots == 0 || (header->n_slots & (header->n_slots - 1)) != 0 ||
+        header->n_slots <= header->n_entries) {
+        return -1;
+    }
+    pack_blob_t entries = {header->entries_offset, (uint64_t) header->n_entries * sizeof(pack_entry_t)};
+    pack_blob_t slots = {header->slots_offset, (uint64_t) header->n_slots * sizeof(uint32_t)};
+    if (!blob_in_bounds(pack, &entries) || !blob_in_bounds(pack, &slots) ||
+        header->entries_offset % sizeof(uint64_t) != 0 || header->slots_offset % sizeof(uint32_t) != 0) {
+        return -1;
+    }
+
+    const pack_entry_t *entry_table = (const pack_entry_t *) (pack->map + header->entries_offset);
+    for (uint32_t i = 0; i < header->n_entries; i++) {
+        const pack_entry_t *entry = &entry_table[i];
+        if (!blob_in_bounds(pack, &entry->name) || entry->name.len == 0 ||
+            pack->map[entry->name.offset + entry->name.len - 1] != '\0' || !blob_in_bounds(pack, &entry->header) ||
+            !blob_in_bounds(pack, &entry->body)) {
+            return -1;
+        }
+        for (int e = 0; e < COMPRESS_N_ENCODINGS; e++) {
+            if (!blob_in_bounds(pack, &entry->encoded_header[e]) || !blob_in_bounds(pack, &entry->encoded_body[e])) {
+                return -1;
+            }
+        }
+    }
+    const uint32_t *slot_table = (const uint32_t *) (pack->map + header->slots_offset);
+    for (uint32_t i = 0; i < header->n_slots; i++) {
+        if (slot_table[i] > header->n_entries) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int pack_open(pack_t *pack, const char *path) {
+    memset(pack, 0, sizeof(pack_t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if (info.st_size < (off_t) sizeof(pack_header_t)) {
+        fprintf(stderr, "pack_open: %s is not a pack\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // populate up front so the first request for each file doesn't fault
+    pack->size = info.st_size;
+    pack->map = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (pack->map == MAP_FAILED) {
+        perror("mmap");
+        pack->map = NULL;
+        return -1;
+    }
+    pack->header = (const pack_header_t *) pack->map;
+    if (validate(pack) == -1) {
+        fprintf(stderr, "pack_open: %s is not a pack or is damaged\n", path);
+        munmap(pack->map, pack->size);
+        pack->map = NULL;
+        return -1;
+    }
+    pack->entries = (const pack_entry_t *) (pack->map + pack->header->entries_offset);
+    pack->slots = (const uint32_t *) (pack->map + pack->header->slots_offset);
+    return 0;
+}
+
+const pack_entry_t *pack_lookup(const pack_t *pack, const char *name, size_t len) {
+    uint32_t hash = pack_hash(name, len);
+    uint32_t mask = pack->header->n_slots - 1;
+    // linear probing, the table always has an empty slot to stop at
+    for (uint32_t slot = hash & mask; pack->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const pack_entry_t *entry = &pack->entries[pack->slots[slot] - 1];
+        if (entry->hash == hash && entry->name.len == len + 1 &&
+            memcmp(pack_data(pack, &entry->name), name, len) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int pack_close(pack_t *pack) {
+    if (pack->map != NULL && munmap(pack->map, pack->size) == -1) {
+        perror("munmap");
+        return -1;
+    }
+    pack->map = NULL;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "compress.h"
+
+// An asset pack bundles a directory into one file that the server maps at
+// startup, so a request is answered from an index lookup with no path
+// syscalls. mkpack writes it; the layout is
+//   pack_header_t
+//   pack_entry_t[n_entries]
+//   uint32_t slots[n_slots]       hash index, entry number + 1, 0 if empty
+//   names and pre-serialized response headers
+//   bodies, each starting on a PACK_ALIGN boundary
+// All offsets are from the start of the file. The pack is read back on the
+// machine that wrote it, so fields are in native byte order.
+
+#define PACK_MAGIC "HTTPACK1"
+#define PACK_MAGIC_LEN 8
+#define PACK_ALIGN 4096
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;
+} pack_blob_t;
+
+typedef struct {
+    char magic[PACK_MAGIC_LEN];
+    uint32_t n_entries;
+    uint32_t n_slots;        // a power of two
+    uint64_t entries_offset;
+    uint64_t slots_offset;
+    uint64_t size;           // of the whole pack, to catch truncation
+} pack_header_t;
+
+typedef struct {
+    uint32_t hash;           // pack_hash of the name
+    uint32_t reserved;
+    pack_blob_t name;        // request path such as "/index.html", NUL terminated
+    uint64_t ino;            // version of the file the entry was made from,
+    uint64_t size;           // for ETag, Last-Modified and ranges
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    pack_blob_t header;      // status line through ETag, no Connection line
+    pack_blob_t body;
+    // compressed copies by encoding - 1, len 0 if it didn't pay off
+    pack_blob_t encoded_header[COMPRESS_N_ENCODINGS];
+    pack_blob_t encoded_body[COMPRESS_N_ENCODINGS];
+} pack_entry_t;
+
+// FNV-1a over a request path, which isn't NUL terminated in the request
+static inline uint32_t pack_hash(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// A pack mapped into memory
+typedef struct {
+    char *map;
+    size_t size;
+    const pack_header_t *header;
+    const pack_entry_t *entries;
+    const uint32_t *slots;
+} pack_t;
+
+/*
+ * Map a pack read-only and check that every offset in it is in bounds, so
+ * later lookups can trust it
+ * pack: The pack to initialize
+ * path: Path to a file written by mkpack
+ * Returns 0 on success or -1 on error
+ */
+int pack_open(pack_t *pack, const char *path);
+
+/*
+ * Find the entry for a request path
+ * name: Request path such as "/index.html", need not be NUL terminated
+ * len: Length of 'name'
+ * Returns the entry, or NULL if the pack has no such file
+ */
+const pack_entry_t *pack_lookup(const pack_t *pack, const char *name, size_t len);
+
+/*
+ * Returns a pointer to the bytes of a blob inside the mapping
+ */
+static inline const char *pack_data(const pack_t *pack, const pack_blob_t *blob) {
+    return pack->map + blob->offset;
+}
+
+/*
+ * Unmap a pack
+ * Returns 0 on success or -1 on error
+ */
+int pack_close(pack_t *pack);
+
+#endif // PACK_H
@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "admission.h"
+#include "http.h"
+#include "metrics.h"
+#include "reactor.h"
+
+static long long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// The list a parked client is on, by whether it has been answered yet
+static reactor_list_t *parked_list(reactor_t *reactor, int fd) {
+    return reactor->conns[fd].served == 0 ? &reactor->fresh : &reactor->idle;
+}
+
+// Park a client at the tail of its list. Caller holds reactor->lock.
+static void parked_list_append(reactor_t *reactor, int fd) {
+    reactor_conn_t *conn = &reactor->conns[fd];
+    reactor_list_t *list = parked_list(reactor, fd);
+    int timeout_ms = conn->served == 0 ? reactor->first_timeout_ms : reactor->idle_timeout_ms;
+    conn->parked = 1;
+    conn->deadline_ms = timeout_ms > 0 ? now_ms() + timeout_ms : LLONG_MAX;
+    conn->next = -1;
+    conn->prev = list->tail;
+    if (list->tail == -1) {
+        list->head = fd;
+    } else {
+        reactor->conns[list->tail].next = fd;
+    }
+    list->tail = fd;
+}
+
+// Unlink a parked client from its list. Caller holds reactor->lock.
+static void parked_list_remove(reactor_t *reactor, int fd) {
+    reactor_conn_t *conn = &reactor->conns[fd];
+    reactor_list_t *list = parked_list(reactor, fd);
+    if (conn->prev == -1) {
+        list->head = conn->next;
+    } else {
+        reactor->conns[conn->prev].next = conn->next;
+    }
+    if (conn->next == -1) {
+        list->tail = conn->prev;
+    } else {
+        reactor->conns[conn->next].prev = conn->prev;
+    }
+    conn->parked = 0;
+}
+
+// Append a client whose request has arrived to the ready list, to be
+// enqueued once there is room. It is shed if that takes longer than the
+// queue wait deadline.
+static void ready_list_append(reactor_t *reactor, int fd) {
+    reactor_conn_t *conn = &reactor->conns[fd];
+    int wait_ms = admission_queue_wait_ms();
+    conn->ready = 1;
+    conn->deadline_ms = wait_ms >= 0 ? now_ms() + wait_ms : LLONG_MAX;
+    conn->next = -1;
+    conn->prev = reactor->ready_tail;
+    if (reactor->ready_tail == -1) {
+        reactor->ready_head = fd;
+    } else {
+        reactor->conns[reactor->ready_tail].next = fd;
+    }
+    reactor->ready_tail = fd;
+}
+
+// Put a client taken off the ready list back at its head
+static void ready_list_push_front(reactor_t *reactor, int fd) {
+    reactor_conn_t *conn = &reactor->conns[fd];
+    conn->ready = 1;
+    conn->prev = -1;
+    conn->next = reactor->ready_head;
+    if (reactor->ready_head == -1) {
+        reactor->ready_tail = fd;
+    } else {
+        reactor->conns[reactor->ready_head].prev = fd;
+    }
+    reactor->ready_head = fd;
+}
+
+// Take the oldest client off the ready list
+static int ready_list_pop(reactor_t *reactor) {
+    int fd = reactor->ready_head;
+    reactor_conn_t *conn = &reactor->conns[fd];
+    reactor->ready_head = conn->next;
+    if (conn->next == -1) {
+        reactor->ready_tail = -1;
+    } else {
+        reactor->conns[conn->next].prev = -1;
+    }
+    conn->ready = 0;
+    return fd;
+}
+
+int reactor_init(reactor_t *reactor, int listen_fd, connection_queue_t *queue, int first_timeout_ms,
+                 int idle_timeout_ms) {
+    reactor->listen_fd = listen_fd;
+    reactor->queue = queue;
+    reactor->first_timeout_ms = first_timeout_ms;
+    reactor->idle_timeout_ms = idle_timeout_ms;
+    reactor->fresh.head = -1;
+    reactor->fresh.tail = -1;
+    reactor->idle.head = -1;
+    reactor->idle.tail = -1;
+    reactor->ready_head = -1;
+    reactor->ready_tail = -1;
+    reactor->ready_waiting = 0;
+    reactor->accept_resume_ms = 0;
+
+    struct rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == -1) {
+        perror("getrlimit");
+        return -1;
+    }
+    // conns[] is sized so that any fd accept() can return fits
+    reactor->max_fds = fd_limit.rlim_cur;
+    if (fd_limit.rlim_cur == RLIM_INFINITY || fd_limit.rlim_cur > REACTOR_FD_CAP) {
+        reactor->max_fds = REACTOR_FD_CAP;
+    }
+    reactor->conns = calloc(reactor->max_fds, sizeof(reactor_conn_t));
+    if (reactor->conns == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    int result;
+    if ((result = pthread_mutex_init(&reactor->lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        free(reactor->conns);
+        return -1;
+    }
+
+    // accept() must never block the event loop
+    int flags = fcntl(listen_fd, F_GETFL);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        pthread_mutex_destroy(&reactor->lock);
+        free(reactor->conns);
+        return -1;
+    }
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll_fd == -1) {
+        perror("epoll_create1");
+        pthread_mutex_destroy(&reactor->lock);
+        free(reactor->conns);
+        return -1;
+    }
+
+    reactor->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reactor->wake_fd == -1) {
+        perror("eventfd");
+        close(reactor->epoll_fd);
+        pthread_mutex_destroy(&reactor->lock);
+        free(reactor->conns);
+        return -1;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    int result_listen = epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = reactor->wake_fd;
+    if (result_listen == -1 || epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &event) == -1) {
+        perror("epoll_ctl");
+        close(reactor->wake_fd);
+        close(reactor->epoll_fd);
+        pthread_mutex_destroy(&reactor->lock);
+        free(reactor->conns);
+        return -1;
+    }
+
+    return 0;
+}
+
+int reactor_park(reactor_t *reactor, int client_fd, int served) {
+    if (client_fd >= reactor->max_fds) {
+        close(client_fd);
+        return -1;
+    }
+
+    int result;
+    if ((result = pthread_mutex_lock(&reactor->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        close(client_fd);
+        return -1;
+    }
+    reactor->conns[client_fd].served = served;
+    reactor->conns[client_fd].scanned = 0;
+    parked_list_append(reactor, client_fd);
+
+    // Edge-triggered: the request is only peeked at, so level-triggered
+    // notification would fire continuously for a partially received header.
+    // Registering an fd that is already readable still reports one event.
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.fd = client_fd;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
+        perror("epoll_ctl");
+        parked_list_remove(reactor, client_fd);
+        pthread_mutex_unlock(&reactor->lock);
+        close(client_fd);
+        return -1;
+    }
+
+    if ((result = pthread_mutex_unlock(&reactor->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+void reactor_queue_space(reactor_t *reactor) {
+    // pairs with the fence in flush_ready: either the event loop sees the
+    // room this worker made, or this worker sees that it has to wake it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&reactor->ready_waiting, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        if (write(reactor->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("write");
+        }
+    }
+}
+
+int reactor_requests_served(reactor_t *reactor, int client_fd) {
+    if (client_fd >= reactor->max_fds) {
+        return 0;
+    }
+    return reactor->conns[client_fd].served;
+}
+
+// Stop watching a client and close it. Caller holds reactor->lock.
+static void drop_client(reactor_t *reactor, int client_fd) {
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
+    parked_list_remove(reactor, client_fd);
+    close(client_fd);
+    if (reactor->accept_resume_ms != 0) {
+        reactor->accept_resume_ms = 1; // a descriptor was freed, accept again now
+    }
+}
+
+// Stop or start watching the listening socket, which is level-triggered
+// and would report the same pending connection again at once
+static void watch_listener(reactor_t *reactor, int watch) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = watch ? EPOLLIN : 0;
+    event.data.fd = reactor->listen_fd;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, reactor->listen_fd, &event) == -1) {
+        perror("epoll_ctl");
+    }
+}
+
+// Close the clients at the head of 'list' whose deadline has passed,
+// counting each as a 'reason' timeout, and lower *timeout to the time left
+// until the next one expires. Caller holds reactor->lock.
+static void expire_parked(reactor_t *reactor, reactor_list_t *list, int reason, long long now, int *timeout) {
+    while (list->head != -1) {
+        long long deadline = reactor->conns[list->head].deadline_ms;
+        if (deadline > now) {
+            if (deadline != LLONG_MAX && (*timeout == -1 || deadline - now < *timeout)) {
+                *timeout = deadline - now;
+            }
+            return;
+        }
+        drop_client(reactor, list->head);
+        metrics_record_timeout(reason);
+    }
+}
+
+// Close every parked client whose deadline has passed, shed every ready
+// one that waited longer than the queue wait deadline, and return how long
+// epoll_wait may sleep before the next one expires (-1 for no limit)
+static int expire_idle_clients(reactor_t *reactor) {
+    int timeout = -1;
+    long long now = now_ms();
+    while (reactor->ready_head != -1) {
+        long long deadline = reactor->conns[reactor->ready_head].deadline_ms;
+        if (deadline > now) {
+            if (deadline != LLONG_MAX) {
+                timeout = deadline - now;
+            }
+            break;
+        }
+        admission_leave();
+        admission_shed(ready_list_pop(reactor), METRICS_SHED_QUEUE_FULL);
+    }
+    pthread_mutex_lock(&reactor->lock);
+    expire_parked(reactor, &reactor->fresh, METRICS_TIMEOUT_HEADER, now, &timeout);
+    expire_parked(reactor, &reactor->idle, METRICS_TIMEOUT_IDLE, now, &timeout);
+    pthread_mutex_unlock(&reactor->lock);
+    return timeout;
+}
+
+// Accept every pending connection and park it in epoll until its request arrives
+static int accept_clients(reactor_t *reactor) {
+    while (1) {
+        int client_fd = accept(reactor->listen_fd, NULL, NULL);
+        if (client_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // out of descriptors, try again once some clients finish
+                perror("accept");
+                watch_listener(reactor, 0);
+                reactor->accept_resume_ms = now_ms() + REACTOR_ACCEPT_BACKOFF_MS;
+                return 0;
+            }
+            return -1; // EINTR included, let the caller check keep_going
+        }
+        reactor_park(reactor, client_fd, 0);
+    }
+}
+
+// Enqueue clients from the ready list, oldest first, while the queue has
+// room. Never blocks: whoever doesn't fit waits for a worker to wake us.
+// Returns 0 on success or -1 if the queue was shut down or failed
+static int flush_ready(reactor_t *reactor) {
+    int published = 0;
+    while (reactor->ready_head != -1) {
+        // off the list first, once enqueued a worker may park it again
+        int client_fd = ready_list_pop(reactor);
+        int result = connection_enqueue_timed(reactor->queue, client_fd, 0);
+        if (result == CONNECTION_QUEUE_TIMEOUT) {
+            ready_list_push_front(reactor, client_fd);
+            if (published) {
+                return 0;
+            }
+            // a worker making room from now on sees this and wakes us, one
+            // that did just before is caught by trying once more
+            __atomic_store_n(&reactor->ready_waiting, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            published = 1;
+            continue;
+        }
+        if (result == -1) {
+            admission_leave();
+            close(client_fd);
+            return -1;
+        }
+    }
+    __atomic_store_n(&reactor->ready_waiting, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// A worker made room in the queue
+// Returns 0 on success or -1 if the queue was shut down or failed
+static int handle_wake(reactor_t *reactor) {
+    uint64_t count;
+    if (read(reactor->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    return flush_ready(reactor);
+}
+
+// Check whether a parked client's request header has fully arrived and, if
+// so, hand the socket to the worker pool.
+// Returns 0 on success or -1 if the queue was shut down or failed
+static int check_client(reactor_t *reactor, int client_fd) {
+    // Only this thread unparks clients, so the state can't change under us
+    // while we peek without the lock held
+    pthread_mutex_lock(&reactor->lock);
+    int parked = reactor->conns[client_fd].parked;
+    pthread_mutex_unlock(&reactor->lock);
+    if (!parked) {
+        // stale event for a client that already expired
+        return 0;
+    }
+
+    // a header too large to ever complete counts as ready, the worker
+    // answers it with a 431 like the other engines do
+    int ready = http_request_ready(client_fd, &reactor->conns[client_fd].scanned);
+    if (ready == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    if (ready == -1) {
+        // hung up or errored
+        drop_client(reactor, client_fd);
+        pthread_mutex_unlock(&reactor->lock);
+        return 0;
+    }
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) == -1) {
+        perror("epoll_ctl");
+    }
+    parked_list_remove(reactor, client_fd);
+    pthread_mutex_unlock(&reactor->lock);
+
+    // a request that arrived is what counts against the in-flight limit,
+    // clients idling in epoll cost no worker
+    if (!admission_enter()) {
+        admission_shed(client_fd, METRICS_SHED_INFLIGHT);
+        return 0;
+    }
+    // behind anyone already waiting for room, so requests keep their order
+    metrics_connection_queued(client_fd);
+    ready_list_append(reactor, client_fd);
+    return flush_ready(reactor);
+}
+
+int reactor_run(reactor_t *reactor, const int *keep_going) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (*keep_going != 0) {
+        int timeout = expire_idle_clients(reactor);
+        if (reactor->accept_resume_ms != 0) {
+            long long left = reactor->accept_resume_ms - now_ms();
+            if (left <= 0) {
+                reactor->accept_resume_ms = 0;
+                watch_listener(reactor, 1);
+            } else if (timeout == -1 || left < timeout) {
+                timeout = left;
+            }
+        }
+        int n_events = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+        if (n_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+
+        // every client event is handled even once stopping, the edge is
+        // not reported again and reactor_drain relies on it
+        for (int i = 0; i < n_events; i++) {
+            int fd = events[i].data.fd;
+            if (fd == reactor->listen_fd) {
+                if (*keep_going != 0 && accept_clients(reactor) == -1) {
+                    // EINVAL once the listening socket is shut down to stop us
+                    if (errno == EINTR || *keep_going == 0) {
+                        continue;
+                    }
+                    perror("accept");
+                    return -1;
+                }
+            } else if ((fd == reactor->wake_fd ? handle_wake(reactor) : check_client(reactor, fd)) == -1) {
+                if (reactor->queue->shutdown == 0) {
+                    printf("Connection_enqueue error\n");
+                    return -1;
+                }
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Close parked clients that have already been answered at least once,
+// keeping only those still waiting for their first response
+static void drop_kept_alive(reactor_t *reactor) {
+    pthread_mutex_lock(&reactor->lock);
+    while (reactor->idle.head != -1) {
+        drop_client(reactor, reactor->idle.head);
+    }
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+int reactor_drain(reactor_t *reactor, int timeout_ms, int grace_ms) {
+    long long deadline = now_ms() + timeout_ms;
+    long long grace_end = now_ms() + grace_ms;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    // the listening socket may be shared with a process taking over, leave
+    // its connections to that one
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, reactor->listen_fd, NULL) == -1) {
+        perror("epoll_ctl");
+    }
+    while (1) {
+        // workers stop keeping connections alive once the server stops,
+        // but may have parked a client just before
+        long long grace_left = grace_end - now_ms();
+        if (grace_left <= 0) {
+            drop_kept_alive(reactor);
+        }
+        int timeout = expire_idle_clients(reactor);
+        long long left = deadline - now_ms();
+        pthread_mutex_lock(&reactor->lock);
+        int empty = reactor->fresh.head == -1 && reactor->idle.head == -1 && reactor->ready_head == -1;
+        pthread_mutex_unlock(&reactor->lock);
+        if (empty || left <= 0) {
+            break;
+        }
+        if (grace_left > 0 && grace_left < left) {
+            left = grace_left;
+        }
+        if (timeout == -1 || timeout > left) {
+            timeout = left;
+        }
+        int n_events = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+        if (n_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < n_events; i++) {
+            int fd = events[i].data.fd;
+            if (fd != reactor->listen_fd &&
+                (fd == reactor->wake_fd ? handle_wake(reactor) : check_client(reactor, fd)) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    // out of time, whoever is left never got a request in or a worker
+    while (reactor->ready_head != -1) {
+        admission_leave();
+        admission_shed(ready_list_pop(reactor), METRICS_SHED_DRAIN);
+    }
+    pthread_mutex_lock(&reactor->lock);
+    while (reactor->fresh.head != -1) {
+        drop_client(reactor, reactor->fresh.head);
+        metrics_record_timeout(METRICS_TIMEOUT_DRAIN);
+    }
+    while (reactor->idle.head != -1) {
+        drop_client(reactor, reactor->idle.head);
+        metrics_record_timeout(METRICS_TIMEOUT_DRAIN);
+    }
+    pthread_mutex_unlock(&reactor->lock);
+    return 0;
+}
+
+int reactor_free(reactor_t *reactor) {
+    int ret_val = 0;
+    while (reactor->fresh.head != -1) {
+        drop_client(reactor, reactor->fresh.head);
+    }
+    while (reactor->idle.head != -1) {
+        drop_client(reactor, reactor->idle.head);
+    }
+    while (reactor->ready_head != -1) {
+        admission_leave();
+        close(ready_list_pop(reactor));
+    }
+    free(reactor->conns);
+    close(reactor->wake_fd);
+
+    int result;
+    if ((result = pthread_mutex_destroy(&reactor->lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+        ret_val = -1;
+    }
+    if (close(reactor->epoll_fd) == -1) {
+        perror("close");
+        ret_val = -1;
+    }
+    return ret_val;
+}
@@ -0,0 +1,123 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include "connection_queue.h"
+
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_FD_CAP (1 << 20)
+#define REACTOR_ACCEPT_BACKOFF_MS 100 // pause after running out of descriptors
+
+// Per-fd bookkeeping for a client parked in the reactor. Parked clients form
+// doubly linked lists in parking order, one for new clients, which get the
+// header deadline to send their first request, and one for kept-alive
+// clients, which get the idle timeout. Every client on a list has the same
+// timeout, so parking order is also deadline order and expiring clients is
+// O(1) each. A client whose request has arrived but that found the queue
+// full moves to the ready list instead, linked through the same fields.
+typedef struct {
+    long long deadline_ms; // CLOCK_MONOTONIC time at which the client is dropped
+    int prev;
+    int next;
+    int served;            // requests already answered on this connection
+    size_t scanned;        // bytes of the next request already searched
+    unsigned char parked;  // 1 while the client waits in epoll
+    unsigned char ready;   // 1 while the client waits for room in the queue
+} reactor_conn_t;
+
+// Ends of a list of clients linked through reactor_conn_t
+typedef struct {
+    int head; // oldest client or -1
+    int tail; // newest client or -1
+} reactor_list_t;
+
+// Struct representing an epoll-based event loop that accepts connections and
+// waits for each client's request to arrive before handing it to a worker
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    connection_queue_t *queue;
+    int first_timeout_ms;  // for the first request, 0 for no limit
+    int idle_timeout_ms;   // between requests, 0 for no limit
+    reactor_conn_t *conns; // indexed by fd
+    int max_fds;
+    reactor_list_t fresh;  // parked clients yet to send a request
+    reactor_list_t idle;   // parked clients kept alive after a response
+    int ready_head;        // oldest client waiting for room in the queue or -1
+    int ready_tail;        // newest one or -1, only the event loop uses the list
+    int ready_waiting;     // 1 while the ready list is not empty, read by workers
+    int wake_fd;           // eventfd workers write to when they make room
+    long long accept_resume_ms; // 0, or when to watch the listening socket again
+    pthread_mutex_t lock;  // protects conns and the idle list
+} reactor_t;
+
+/*
+ * Initialize a new reactor. The listening socket is switched to non-blocking
+ * mode and registered with a new epoll instance.
+ * reactor: Pointer to reactor_t to be initialized
+ * listen_fd: A socket that is already bound and listening
+ * queue: Queue that receives connections whose request has fully arrived
+ * first_timeout_ms: How long a new client may take to send its first
+ *                   complete request before it is closed, 0 for no limit
+ * idle_timeout_ms: The same for each later request on a kept-alive
+ *                  connection, 0 for no limit
+ * Returns 0 on success or -1 on error
+ */
+int reactor_init(reactor_t *reactor, int listen_fd, connection_queue_t *queue, int first_timeout_ms,
+                 int idle_timeout_ms);
+
+/*
+ * Run the event loop on the calling thread until *keep_going becomes 0 or an
+ * error occurs. Accepted sockets stay in epoll (and cost no worker thread)
+ * until the complete request header is sitting in the socket's receive
+ * buffer, at which point they are removed from epoll and enqueued. The loop
+ * never blocks on a full queue: such clients wait on a ready list until a
+ * worker makes room, or are shed once the queue wait deadline passes.
+ * reactor: The reactor to run
+ * keep_going: Checked after every wakeup, typically cleared by a signal handler
+ * Returns 0 on a clean stop or -1 on error
+ */
+int reactor_run(reactor_t *reactor, const int *keep_going);
+
+/*
+ * Finish up after reactor_run has stopped, before the queue is shut down.
+ * No more connections are accepted. Clients are dispatched as their
+ * requests arrive for at most 'timeout_ms', after which any left are
+ * closed. Kept-alive clients between requests only get 'grace_ms' to send
+ * one, clients still owed their first response get all of it.
+ * Returns 0 on success or -1 on error
+ */
+int reactor_drain(reactor_t *reactor, int timeout_ms, int grace_ms);
+
+/*
+ * Hand a kept-alive connection back to the reactor to wait for its next
+ * request. Safe to call from worker threads; the caller must not touch the
+ * fd afterwards.
+ * reactor: The reactor to park the client in
+ * client_fd: The client socket
+ * served: Number of requests already answered on this connection
+ * Returns 0 on success or -1 on error, in which case the fd has been closed
+ */
+int reactor_park(reactor_t *reactor, int client_fd, int served);
+
+/*
+ * Called by a worker after it took a connection off the queue. Wakes the
+ * event loop if clients are waiting for room, otherwise costs nothing but
+ * a memory fence.
+ */
+void reactor_queue_space(reactor_t *reactor);
+
+/*
+ * Get the number of requests already answered on a connection that the
+ * reactor just dispatched to a worker.
+ */
+int reactor_requests_served(reactor_t *reactor, int client_fd);
+
+/*
+ * Close the epoll instance and any client sockets still waiting in it.
+ * Does not close the listening socket.
+ * Returns 0 on success or -1 on error
+ */
+int reactor_free(reactor_t *reactor);
+
+#endif // REACTOR_H
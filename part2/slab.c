@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "slab.h"
+
+void slab_init(slab_t *slab, size_t object_size, size_t per_block) {
+    if (object_size < sizeof(void *)) {
+        object_size = sizeof(void *); // room for the free list link
+    }
+    slab->object_size = (object_size + SLAB_ALIGN - 1) & ~((size_t) SLAB_ALIGN - 1);
+    slab->per_block = per_block > 0 ? per_block : 1;
+    slab->free_list = NULL;
+    slab->blocks = NULL;
+    slab->stats.in_use = 0;
+    slab->stats.high_water = 0;
+    slab->stats.reserved = 0;
+}
+
+// Allocate a block and put all of its objects on the free list
+// Returns 0 on success or -1 on error
+static int add_block(slab_t *slab) {
+    // the header takes the first SLAB_ALIGN bytes so objects stay aligned
+    size_t size = SLAB_ALIGN + slab->per_block * slab->object_size;
+    slab_block_t *block;
+    if (posix_memalign((void **) &block, SLAB_ALIGN, size) != 0) {
+        perror("posix_memalign");
+        return -1;
+    }
+    block->next = slab->blocks;
+    slab->blocks = block;
+    slab->stats.reserved += size;
+    char *objects = (char *) block + SLAB_ALIGN;
+    for (size_t i = slab->per_block; i > 0; i--) {
+        void *object = objects + (i - 1) * slab->object_size;
+        *(void **) object = slab->free_list;
+        slab->free_list = object;
+    }
+    return 0;
+}
+
+void *slab_alloc(slab_t *slab) {
+    if (slab->free_list == NULL && add_block(slab) == -1) {
+        return NULL;
+    }
+    void *object = slab->free_list;
+    slab->free_list = *(void **) object;
+    slab->stats.in_use++;
+    if (slab->stats.in_use > slab->stats.high_water) {
+        slab->stats.high_water = slab->stats.in_use;
+    }
+    return object;
+}
+
+void slab_free(slab_t *slab, void *object) {
+    *(void **) object = slab->free_list;
+    slab->free_list = object;
+    slab->stats.in_use--;
+}
+
+void slab_destroy(slab_t *slab) {
+    while (slab->blocks != NULL) {
+        slab_block_t *next = slab->blocks->next;
+        free(slab->blocks);
+        slab->blocks = next;
+    }
+    slab->free_list = NULL;
+    slab->stats.in_use = 0;
+    slab->stats.reserved = 0;
+}
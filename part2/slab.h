@@ -0,0 +1,58 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_ALIGN 64 // objects start on their own cache line
+
+typedef struct slab_block {
+    struct slab_block *next;
+} slab_block_t;
+
+typedef struct {
+    size_t in_use;        // objects handed out and not yet freed
+    size_t high_water;    // most objects in use at once
+    size_t reserved;      // bytes of blocks allocated from the system
+} slab_stats_t;
+
+// Struct representing a pool of equally sized objects such as connection
+// state or I/O buffers. Objects are carved out of blocks of 'per_block' at a
+// time and freed objects go on a free list, so allocating and freeing are a
+// couple of pointer moves and a buffer freed by one connection is reused,
+// still warm in the cache, by the next. Blocks are only returned to the
+// system by slab_destroy, so the pool stays at its high-water mark. There is
+// no locking: a pool belongs to the thread that uses it.
+typedef struct {
+    size_t object_size;   // rounded up to SLAB_ALIGN
+    size_t per_block;
+    void *free_list;      // freed objects, each holding the next one's address
+    slab_block_t *blocks;
+    slab_stats_t stats;
+} slab_t;
+
+/*
+ * Initialize an empty pool. Nothing is allocated until the first object.
+ * slab: Pointer to slab_t to be initialized
+ * object_size: Size of each object in bytes
+ * per_block: Objects allocated from the system at a time
+ */
+void slab_init(slab_t *slab, size_t object_size, size_t per_block);
+
+/*
+ * Take an object from the pool. Its contents are whatever the last user
+ * left, not zeroed.
+ * Returns the object, or NULL on error
+ */
+void *slab_alloc(slab_t *slab);
+
+/*
+ * Return an object obtained from slab_alloc on the same pool
+ */
+void slab_free(slab_t *slab, void *object);
+
+/*
+ * Free every block. Objects still in use become invalid.
+ */
+void slab_destroy(slab_t *slab);
+
+#endif // SLAB_H
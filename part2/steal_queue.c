@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "steal_queue.h"
+
+// Deque helpers, caller holds deque->lock. Each returns -1 if the deque is
+// full (push) or empty (pops).
+
+static int deque_push_back(worker_deque_t *deque, int capacity, int fd) {
+    if (deque->length == capacity) {
+        return -1;
+    }
+    deque->fds[(deque->head + deque->length) % capacity] = fd;
+    // length is also peeked at without the lock, see choose_worker
+    __atomic_store_n(&deque->length, deque->length + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int deque_pop_front(worker_deque_t *deque, int capacity) {
+    if (deque->length == 0) {
+        return -1;
+    }
+    int fd = deque->fds[deque->head];
+    deque->head = (deque->head + 1) % capacity;
+    __atomic_store_n(&deque->length, deque->length - 1, __ATOMIC_RELAXED);
+    return fd;
+}
+
+static int deque_pop_back(worker_deque_t *deque, int capacity) {
+    if (deque->length == 0) {
+        return -1;
+    }
+    __atomic_store_n(&deque->length, deque->length - 1, __ATOMIC_RELAXED);
+    return deque->fds[(deque->head + deque->length) % capacity];
+}
+
+int steal_queue_init(steal_queue_t *queue, int n_workers, int deque_capacity, int policy) {
+    memset(queue, 0, sizeof(steal_queue_t));
+    queue->n_workers = n_workers;
+    queue->deque_capacity = deque_capacity;
+    queue->policy = policy;
+
+    queue->deques = calloc(n_workers, sizeof(worker_deque_t));
+    if (queue->deques == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    int result;
+    for (int i = 0; i < n_workers; i++) {
+        queue->deques[i].fds = malloc(deque_capacity * sizeof(int));
+        if (queue->deques[i].fds == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        if ((result = pthread_mutex_init(&queue->deques[i].lock, NULL)) != 0) {
+            fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+            return -1;
+        }
+    }
+
+    if ((result = pthread_mutex_init(&queue->sleep_lock, NULL)) != 0) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_init(&queue->work_available, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
+    if ((result = pthread_cond_init(&queue->space_available, NULL)) != 0) {
+        fprintf(stderr, "pthread_cond_init: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int steal_queue_register_worker(steal_queue_t *queue) {
+    int id = __atomic_fetch_add(&queue->next_id, 1, __ATOMIC_RELAXED);
+    return id < queue->n_workers ? id : -1;
+}
+
+// Pick the deque a new connection should go to first
+static int choose_worker(steal_queue_t *queue) {
+    if (queue->policy == STEAL_LEAST_LOADED) {
+        // lengths are read without locks, a slightly stale answer is fine
+        int best = 0;
+        int best_length = __atomic_load_n(&queue->deques[0].length, __ATOMIC_RELAXED);
+        for (int i = 1; i < queue->n_workers && best_length > 0; i++) {
+            int length = __atomic_load_n(&queue->deques[i].length, __ATOMIC_RELAXED);
+            if (length < best_length) {
+                best = i;
+                best_length = length;
+            }
+        }
+        return best;
+    }
+    int worker = __atomic_fetch_add(&queue->next_worker, 1, __ATOMIC_RELAXED);
+    return (unsigned int) worker % queue->n_workers;
+}
+
+// Wake one sleeper on 'cond' if 'sleepers' says anyone is waiting. The
+// seq_cst load pairs with the sleeper registering itself under sleep_lock
+// before it re-checks 'pending', so the wakeup can't be lost.
+static void wake_one(steal_queue_t *queue, int *sleepers, pthread_cond_t *cond) {
+    if (__atomic_load_n(sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&queue->sleep_lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&queue->sleep_lock);
+    }
+}
+
+int steal_queue_push(steal_queue_t *queue, int connection_fd, int timeout_ms) {
+    int total_capacity = queue->n_workers * queue->deque_capacity;
+    // condition variables wait against CLOCK_REALTIME by default
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    while (1) {
+        // preferred deque first, then any deque with room
+        int start = choose_worker(queue);
+        for (int i = 0; i < queue->n_workers; i++) {
+            worker_deque_t *deque = &queue->deques[(start + i) % queue->n_workers];
+            pthread_mutex_lock(&deque->lock);
+            int result = deque_push_back(deque, queue->deque_capacity, connection_fd);
+            pthread_mutex_unlock(&deque->lock);
+            if (result == 0) {
+                __atomic_add_fetch(&queue->pending, 1, __ATOMIC_SEQ_CST);
+                wake_one(queue, &queue->idle_workers, &queue->work_available);
+                return 0;
+            }
+        }
+
+        // every deque is full, wait for a worker to take something
+        pthread_mutex_lock(&queue->sleep_lock);
+        __atomic_add_fetch(&queue->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        int timed_out = 0;
+        while (queue->shutdown == 0 && __atomic_load_n(&queue->pending, __ATOMIC_SEQ_CST) >= total_capacity &&
+               !timed_out) {
+            if (timeout_ms >= 0) {
+                timed_out = pthread_cond_timedwait(&queue->space_available, &queue->sleep_lock, &deadline) == ETIMEDOUT;
+            } else {
+                pthread_cond_wait(&queue->space_available, &queue->sleep_lock);
+            }
+        }
+        __atomic_sub_fetch(&queue->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        int shutdown = queue->shutdown;
+        int full = __atomic_load_n(&queue->pending, __ATOMIC_SEQ_CST) >= total_capacity;
+        pthread_mutex_unlock(&queue->sleep_lock);
+        if (shutdown) {
+            return -1;
+        }
+        if (timed_out && full) {
+            return STEAL_QUEUE_TIMEOUT;
+        }
+    }
+}
+
+int steal_queue_pop(steal_queue_t *queue, int worker_id) {
+    while (1) {
+        int fd = -1;
+        if (worker_id >= 0) {
+            worker_deque_t *own = &queue->deques[worker_id];
+            pthread_mutex_lock(&own->lock);
+            fd = deque_pop_front(own, queue->deque_capacity);
+            pthread_mutex_unlock(&own->lock);
+        }
+
+        // own deque is empty, steal from the back of the others
+        int start = worker_id >= 0 ? worker_id + 1 : 0;
+        for (int i = 0; fd == -1 && i < queue->n_workers; i++) {
+            int victim = (start + i) % queue->n_workers;
+            if (victim == worker_id) {
+                continue;
+            }
+            worker_deque_t *deque = &queue->deques[victim];
+            if (__atomic_load_n(&deque->length, __ATOMIC_RELAXED) == 0) {
+                continue; // don't bother locking an empty deque
+            }
+            pthread_mutex_lock(&deque->lock);
+            fd = deque_pop_back(deque, queue->deque_capacity);
+            pthread_mutex_unlock(&deque->lock);
+        }
+
+        if (fd != -1) {
+            __atomic_sub_fetch(&queue->pending, 1, __ATOMIC_SEQ_CST);
+            wake_one(queue, &queue->waiting_producers, &queue->space_available);
+            return fd;
+        }
+
+        // nothing anywhere, sleep until a producer adds work
+        pthread_mutex_lock(&queue->sleep_lock);
+        __atomic_add_fetch(&queue->idle_workers, 1, __ATOMIC_SEQ_CST);
+        while (queue->shutdown == 0 && __atomic_load_n(&queue->pending, __ATOMIC_SEQ_CST) <= 0) {
+            pthread_cond_wait(&queue->work_available, &queue->sleep_lock);
+        }
+        __atomic_sub_fetch(&queue->idle_workers, 1, __ATOMIC_SEQ_CST);
+        // after a shutdown, work still queued is handed out until none is left
+        int done = queue->shutdown && __atomic_load_n(&queue->pending, __ATOMIC_SEQ_CST) <= 0;
+        pthread_mutex_unlock(&queue->sleep_lock);
+        if (done) {
+            return -1;
+        }
+    }
+}
+
+int steal_queue_shutdown(steal_queue_t *queue) {
+    int result;
+    if ((result = pthread_mutex_lock(&queue->sleep_lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(result));
+        return -1;
+    }
+    queue->shutdown = 1;
+    if ((result = pthread_cond_broadcast(&queue->work_available)) != 0) {
+        fprintf(stderr, "pthread_cond_broadcast: %s\n", strerror(result));
+        pthread_mutex_unlock(&queue->sleep_lock);
+        return -1;
+    }
+    if ((result = pthread_cond_broadcast(&queue->space_available)) != 0) {
+        fprintf(stderr, "pthread_cond_broadcast: %s\n", strerror(result));
+        pthread_mutex_unlock(&queue->sleep_lock);
+        return -1;
+    }
+    if ((result = pthread_mutex_unlock(&queue->sleep_lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int steal_queue_free(steal_queue_t *queue) {
+    int ret_val = 0;
+    int result;
+    for (int i = 0; i < queue->n_workers; i++) {
+        free(queue->deques[i].fds);
+        if ((result = pthread_mutex_destroy(&queue->deques[i].lock)) != 0) {
+            fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+            ret_val = -1;
+        }
+    }
+    free(queue->deques);
+
+    if ((result = pthread_cond_destroy(&queue->work_available)) != 0) {
+        fprintf(stderr, "pthread_cond_destroy: %s\n", strerror(result));
+        ret_val = -1;
+    }
+    if ((result = pthread_cond_destroy(&queue->space_available)) != 0) {
+        fprintf(stderr, "pthread_cond_destroy: %s\n", strerror(result));
+        ret_val = -1;
+    }
+    if ((result = pthread_mutex_destroy(&queue->sleep_lock)) != 0) {
+        fprintf(stderr, "pthread_mutex_destroy: %s\n", strerror(result));
+        ret_val = -1;
+    }
+    return ret_val;
+}
@@ -0,0 +1,89 @@
+#ifndef STEAL_QUEUE_H
+#define STEAL_QUEUE_H
+
+#include <pthread.h>
+
+// How the producer picks the worker deque for a new connection
+#define STEAL_ROUND_ROBIN 0
+#define STEAL_LEAST_LOADED 1
+
+#define STEAL_PAD_SIZE 64
+
+// Returned by steal_queue_push when no space opened up in time
+#define STEAL_QUEUE_TIMEOUT -2
+
+// A single worker's deque. The owner takes from the front (oldest first),
+// thieves take from the back so they rarely touch the slot the owner wants.
+// Each deque has its own lock and sits on its own cache lines, so workers
+// only contend when one of them runs dry and steals.
+typedef struct {
+    pthread_mutex_t lock;
+    int *fds;
+    int head;
+    int length;
+    char pad[STEAL_PAD_SIZE];
+} worker_deque_t;
+
+// Struct representing a set of per-worker deques with work stealing
+typedef struct {
+    worker_deque_t *deques;
+    int n_workers;
+    int deque_capacity;
+    int policy;
+    int next_worker;       // round-robin cursor, producers only
+    int next_id;           // next id handed out by steal_queue_register_worker
+    int pending;           // connections queued across all deques
+    int idle_workers;      // workers asleep waiting for work
+    int waiting_producers; // producers asleep waiting for space
+    int shutdown;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t work_available;
+    pthread_cond_t space_available;
+} steal_queue_t;
+
+/*
+ * Initialize a new set of worker deques.
+ * queue: Pointer to steal_queue_t to be initialized
+ * n_workers: Number of worker threads that will register with the queue
+ * deque_capacity: Maximum connections waiting in any one worker's deque
+ * policy: STEAL_ROUND_ROBIN or STEAL_LEAST_LOADED
+ * Returns 0 on success or -1 on error
+ */
+int steal_queue_init(steal_queue_t *queue, int n_workers, int deque_capacity, int policy);
+
+/*
+ * Claim a deque for the calling worker thread. Each worker calls this once
+ * before its first steal_queue_pop.
+ * Returns the worker's deque index, or -1 if every deque is already claimed
+ */
+int steal_queue_register_worker(steal_queue_t *queue);
+
+/*
+ * Add a connection to a worker's deque chosen by the queue's policy. Blocks
+ * while every deque is full, for at most 'timeout_ms' milliseconds unless
+ * the timeout is negative. Fails if the queue is shut down while waiting.
+ * Returns 0 on success, STEAL_QUEUE_TIMEOUT on timeout, or -1 on error
+ */
+int steal_queue_push(steal_queue_t *queue, int connection_fd, int timeout_ms);
+
+/*
+ * Take a connection from the worker's own deque, or steal one from another
+ * worker's deque when its own is empty. Blocks while every deque is empty.
+ * worker_id: Index returned by steal_queue_register_worker, or -1 to only steal
+ * Returns the connection's fd, or -1 if the queue is shut down while waiting
+ */
+int steal_queue_pop(steal_queue_t *queue, int worker_id);
+
+/*
+ * Wake every blocked producer and worker, and make them return -1.
+ * Returns 0 on success or -1 on error
+ */
+int steal_queue_shutdown(steal_queue_t *queue);
+
+/*
+ * Deallocates the deques and synchronization primitives.
+ * Returns 0 on success or -1 on error
+ */
+int steal_queue_free(steal_queue_t *queue);
+
+#endif // STEAL_QUEUE_H
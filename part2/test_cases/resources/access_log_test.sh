@@ -0,0 +1,24 @@
+#! /bin/bash
+
+# Every response must reach the access log by the time the server exits on
+# SIGINT, one line per request in the common log format with the response
+# time appended. Every file is fetched three times at once, plus a missing
+# one, and each body must match the file.
+source test_cases/resources/fetch_all.sh
+
+log_format='^127\.0\.0\.1 - - \[[0-9]{2}/[A-Z][a-z]{2}/[0-9]{4}:[0-9]{2}:[0-9]{2}:[0-9]{2} [+-][0-9]{4}\] "GET /[^ ]* HTTP/1\.1" [0-9]{3} [0-9]+ [0-9]+$'
+
+for options in "-E threads" "-E epoll" "-E uring"
+do
+    start_server $options -L downloaded_files/access.log
+    curl -s -S -o /dev/null http://localhost:$PORT/missing.txt
+    fetch_concurrently
+    stop_server
+
+    echo "Log lines: $(wc -l < downloaded_files/access.log)"
+    echo "Well-formed lines: $(grep -c -E "$log_format" downloaded_files/access.log)"
+    # request, status and size of each distinct response
+    cut -d '"' -f 2- downloaded_files/access.log | sed 's/ [0-9]*$//' | LC_ALL=C sort | uniq -c
+
+    compare_downloads
+done
@@ -0,0 +1,45 @@
+#! /bin/bash
+
+# One worker and a one-slot queue: a connection that sends nothing keeps the
+# worker busy and a second one fills the queue
+echo "Starting HTTP Server with no queue wait allowed"
+./http_server -n 1 -q 1 -W 0 -R 2 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+exec 3<>/dev/tcp/localhost/$PORT
+exec 4<>/dev/tcp/localhost/$PORT
+sleep 0.2
+echo "Requesting with the queue full"
+curl -s -S -i http://localhost:$PORT/quote.txt | tr -d '\r'
+
+# the queued connection has now waited far past the deadline
+exec 3>&-
+exec 4>&-
+sleep 0.5
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+curl -s -S http://localhost:$PORT/__stats | grep shed_total
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+echo "Starting HTTP Server with one connection in flight allowed"
+./http_server -m 1 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+exec 3<>/dev/tcp/localhost/$PORT
+sleep 0.2
+echo "Requesting with a connection in flight"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+exec 3>&-
+sleep 0.2
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+curl -s -S http://localhost:$PORT/__stats | grep shed_total
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
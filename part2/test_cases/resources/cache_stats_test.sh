@@ -0,0 +1,32 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files/serve
+for name in quote a b c d; do
+    cp server_files/quote.txt downloaded_files/serve/$name.txt
+done
+echo "Starting HTTP Server with small content and descriptor caches"
+./http_server -f 4 -c 1400 downloaded_files/serve $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# a miss, then two hits
+for i in 1 2 3; do
+    curl -s -S -o /dev/null http://localhost:$PORT/quote.txt
+done
+echo "Rewriting quote.txt"
+echo "Rewritten in place" > downloaded_files/serve/quote.txt
+sleep 0.2
+curl -s -S http://localhost:$PORT/quote.txt
+# the fifth file pushes the least recently used one out of both caches
+for name in a b c d; do
+    curl -s -S -o /dev/null http://localhost:$PORT/$name.txt
+done
+
+curl -s -S http://localhost:$PORT/__stats | grep '^cache_'
+curl -s -S http://localhost:$PORT/__stats.json | python3 -c 'import json, sys; print(json.load(sys.stdin)["caches"]["fd"])'
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,47 @@
+#! /bin/bash
+
+target_files=(
+    "index.html"
+    "gatsby.txt"
+    "africa.jpg"
+    "quote.txt"
+)
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Starting HTTP Server"
+./http_server server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# Each line: the Content-Encoding sent to a client that accepts gzip (text
+# is compressed, images and tiny files are not) and whether the decoded body
+# matches the file. Asking twice checks the cached compressed copy too.
+for target_file in ${target_files[@]}
+do
+    url="http://localhost:$PORT/$target_file"
+    result="$target_file:"
+    for attempt in 1 2
+    do
+        encoding=$(curl -s -S -H 'Accept-Encoding: gzip' -D - -o downloaded_files/$target_file.body $url |
+                   tr -d '\r' | sed -n 's/^Content-Encoding: //p')
+        if [ "$encoding" == "gzip" ]; then
+            gzip -d -c downloaded_files/$target_file.body > downloaded_files/$target_file
+        else
+            encoding="identity"
+            mv downloaded_files/$target_file.body downloaded_files/$target_file
+        fi
+        if cmp -s downloaded_files/$target_file server_files/$target_file; then
+            result="$result $encoding match"
+        else
+            result="$result $encoding differ"
+        fi
+        rm -f downloaded_files/$target_file.body
+    done
+    echo "$result"
+done
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,33 @@
+#! /bin/bash
+
+target_files=(
+    "index.html"
+    "gatsby.txt"
+    "africa.jpg"
+    "Lec01.pdf"
+)
+
+echo "Starting HTTP Server"
+./http_server server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# Each line: plain GET, If-None-Match with the ETag, If-Modified-Since with
+# the Last-Modified date, and If-None-Match with an outdated ETag
+for target_file in ${target_files[@]}
+do
+    url="http://localhost:$PORT/$target_file"
+    header=$(curl -s -S -D - -o /dev/null $url | tr -d '\r')
+    etag=$(echo "$header" | sed -n 's/^ETag: //p')
+    last_modified=$(echo "$header" | sed -n 's/^Last-Modified: //p')
+    plain=$(echo "$header" | head -n 1 | cut -d ' ' -f 2)
+    by_etag=$(curl -s -S -o /dev/null -w '%{http_code}' -H "If-None-Match: $etag" $url)
+    by_date=$(curl -s -S -o /dev/null -w '%{http_code}' -H "If-Modified-Since: $last_modified" $url)
+    stale=$(curl -s -S -o /dev/null -w '%{http_code}' -H 'If-None-Match: "stale"' $url)
+    echo "$target_file: $plain $by_etag $by_date $stale"
+done
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,47 @@
+#! /bin/bash
+
+# One worker, kept busy by a client that has only sent half of its request
+echo "Starting HTTP Server with one worker"
+./http_server -n 1 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+exec 3<>/dev/tcp/localhost/$PORT
+printf 'GET /index.html HTTP/1.1\r\n' >&3
+sleep 0.2
+
+# These wait in the connection queue behind it, and are still answered
+# after the server is told to stop
+echo "Queueing two more requests"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt > drain_test_1.txt &
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt > drain_test_2.txt &
+sleep 0.2
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+sleep 0.2
+printf 'Host: localhost\r\n\r\n' >&3
+head -n 1 <&3 | tr -d '\r'
+exec 3<&-
+wait $http_server_pid
+echo "Server has terminated with status $?"
+wait
+cat drain_test_1.txt drain_test_2.txt
+
+# With too little time to drain, the stalled request is cut off and the one
+# queued behind it turned away
+echo "Starting HTTP Server with a 1 second drain"
+./http_server -n 1 -D 1 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+exec 3<>/dev/tcp/localhost/$PORT
+printf 'GET /index.html HTTP/1.1\r\n' >&3
+sleep 0.2
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt > drain_test_1.txt &
+sleep 0.2
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated with status $?"
+exec 3<&-
+wait
+cat drain_test_1.txt
+rm drain_test_1.txt drain_test_2.txt
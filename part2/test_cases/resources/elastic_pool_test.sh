@@ -0,0 +1,33 @@
+#! /bin/bash
+
+# An elastic pool of one to four workers. Three connections that stall
+# mid-request hold three workers, so fetching every file three times at once
+# must grow the pool to its maximum, and once everything is done it must
+# shrink back to one. Each body must match the file.
+source test_cases/resources/fetch_all.sh
+
+start_server -n 1 -N 4 -G 1 -w 10 -i 1
+curl -s -S http://localhost:$PORT/__stats | grep '^workers_running'
+
+exec 3<>/dev/tcp/localhost/$PORT
+exec 4<>/dev/tcp/localhost/$PORT
+exec 5<>/dev/tcp/localhost/$PORT
+for stalled in 3 4 5
+do
+    printf 'GET /quote.txt HTTP/1.1\r\n' >&$stalled
+done
+
+fetch_concurrently
+curl -s -S http://localhost:$PORT/__stats | grep '^workers_running'
+
+exec 3>&-
+exec 4>&-
+exec 5>&-
+echo "Waiting for idle workers to retire"
+sleep 3
+curl -s -S http://localhost:$PORT/__stats | grep '^workers_running'
+curl -s -S http://localhost:$PORT/__stats.json |
+    python3 -c 'import json, sys; stats = json.load(sys.stdin); print(stats["workers_started"], stats["workers_retired"])'
+
+stop_server
+compare_downloads
@@ -0,0 +1,30 @@
+#! /bin/bash
+
+# Connections wait in the epoll reactor until a request arrives, once with
+# one worker and a one-slot queue so ready clients pile up in the reactor.
+# Every file is fetched three times at once, then once more over a single
+# kept-alive connection that the reactor parks between requests, and each
+# body must match the file.
+source test_cases/resources/fetch_all.sh
+
+for options in "-E epoll" "-E epoll -n 1 -q 1"
+do
+    start_server $options
+    fetch_concurrently
+
+    # new connections made for each file, only the first should need one
+    curl_args=( )
+    for target_file in ${target_files[@]}
+    do
+        curl_args+=(-o downloaded_files/$target_file.kept_alive http://localhost:$PORT/$target_file)
+    done
+    curl -s -S -w '%{num_connects} ' "${curl_args[@]}"
+    echo
+
+    stop_server
+    compare_downloads
+    for target_file in ${target_files[@]}
+    do
+        cmp server_files/$target_file downloaded_files/$target_file.kept_alive
+    done
+done
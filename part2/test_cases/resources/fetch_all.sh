@@ -0,0 +1,72 @@
+#! /bin/bash
+
+# Shared by the tests that load the server with concurrent fetches. Source
+# it, then either call fetch_all with each set of server options, or the
+# steps one by one with checks of their own in between.
+target_files=(
+    "quote.txt"
+    "headers.html"
+    "index.html"
+    "courses.txt"
+    "mt2_practice.pdf"
+    "gatsby.txt"
+    "africa.jpg"
+    "ocelot.jpg"
+    "hard_drive.png"
+    "Lec01.pdf"
+)
+
+# Start ./http_server on server_files with the options given, downloads go
+# to a fresh downloaded_files
+start_server() {
+    rm -rf downloaded_files
+    mkdir -p downloaded_files
+    echo "Starting HTTP Server with $*"
+    ./http_server "$@" server_files $PORT &
+    http_server_pid=$!
+    sleep 0.5
+}
+
+# Fetch every file three times, all at once
+fetch_concurrently() {
+    local curl_pids=( )
+    for round in 1 2 3
+    do
+        for target_file in ${target_files[@]}
+        do
+            curl -s -S -o downloaded_files/$target_file.$round http://localhost:$PORT/$target_file &
+            curl_pids+=($!)
+        done
+    done
+    for curl_pid in ${curl_pids[@]}
+    do
+        wait $curl_pid
+    done
+    echo "All HTTP responses received"
+}
+
+stop_server() {
+    echo "Sending SIGINT to trigger server shutdown"
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+}
+
+# Compare every download with its file, cmp reports any that differ
+compare_downloads() {
+    for round in 1 2 3
+    do
+        for target_file in ${target_files[@]}
+        do
+            cmp server_files/$target_file downloaded_files/$target_file.$round
+        done
+    done
+}
+
+# One whole run: start the server with the options given, fetch, stop, compare
+fetch_all() {
+    start_server "$@"
+    fetch_concurrently
+    stop_server
+    compare_downloads
+}
@@ -0,0 +1,37 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files/serve
+cp server_files/quote.txt server_files/index.html downloaded_files/serve/
+echo "Starting HTTP Server"
+./http_server downloaded_files/serve $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# Open files and their stat are cached; changes must still show up at once
+url="http://localhost:$PORT/quote.txt"
+curl -s -S -o downloaded_files/first $url
+curl -s -S -o downloaded_files/second $url
+cmp server_files/quote.txt downloaded_files/first
+cmp server_files/quote.txt downloaded_files/second
+
+echo "Rewriting quote.txt"
+echo "Rewritten in place" > downloaded_files/serve/quote.txt
+sleep 0.2
+curl -s -S $url
+
+echo "Replacing quote.txt with a renamed file"
+echo "Renamed over the original" > downloaded_files/replacement.txt
+mv downloaded_files/replacement.txt downloaded_files/serve/quote.txt
+sleep 0.2
+curl -s -S $url
+
+echo "Deleting quote.txt"
+rm downloaded_files/serve/quote.txt
+sleep 0.2
+curl -s -S -o /dev/null -w '%{http_code}\n' $url
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
@@ -0,0 +1,40 @@
+#! /bin/bash
+
+control=handoff_test.sock
+echo "Starting HTTP Server with a control socket"
+./http_server -U $control server_files $PORT 2> handoff_test_old.txt &
+old_pid=$!
+sleep 0.5
+
+# a request the old server is in the middle of when it hands over
+exec 3<>/dev/tcp/localhost/$PORT
+printf 'GET /index.html HTTP/1.1\r\n' >&3
+sleep 0.2
+
+echo "Starting a new HTTP Server on the same control socket"
+./http_server -U $control server_files $PORT 2> handoff_test_new.txt &
+new_pid=$!
+sleep 0.5
+cat handoff_test_old.txt handoff_test_new.txt
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+
+# the old server finishes what it started, then exits on its own
+printf 'Host: localhost\r\n\r\n' >&3
+head -n 1 <&3 | tr -d '\r'
+exec 3<&-
+wait $old_pid
+echo "Old server has terminated with status $?"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+
+# a new server that can't use the sockets leaves the running one alone
+echo "Starting a new HTTP Server that needs two sockets"
+./http_server -U $control -a 2 server_files $PORT
+echo "New server has terminated with status $?"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $new_pid
+wait $new_pid
+echo "Server has terminated with status $?"
+if [ -e $control ]; then echo "Control socket left behind"; fi
+rm handoff_test_old.txt handoff_test_new.txt
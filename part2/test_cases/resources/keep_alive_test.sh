@@ -0,0 +1,64 @@
+#! /bin/bash
+
+target_files=(
+    "quote.txt"
+    "headers.html"
+    "index.html"
+    "courses.txt"
+    "gatsby.txt"
+    "africa.jpg"
+    "Lec01.pdf"
+)
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Starting HTTP Server"
+./http_server server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# A single curl invocation reuses one HTTP/1.1 connection for every URL
+urls=( )
+outputs=( )
+for target_file in ${target_files[@]}
+do
+    urls+=("http://localhost:$PORT/$target_file")
+    outputs+=("-o" "downloaded_files/$target_file")
+done
+echo "Requesting all files over one connection"
+curl -s -S -w '%{num_connects}\n' ${outputs[@]} ${urls[@]} | awk '{ n += $1 } END { print "Connections opened: " n }'
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+for target_file in ${target_files[@]}
+do
+    diff -q server_files/$target_file downloaded_files/$target_file
+done
+
+# -k 0 turns keep-alive off: every file is still served, each over its own
+# connection, and a new client isn't dropped before it sends its request
+for engine in threads epoll uring
+do
+    rm -rf downloaded_files
+    mkdir -p downloaded_files
+    echo "Starting HTTP Server with -E $engine -k 0"
+    ./http_server -E $engine -k 0 server_files $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    echo "Requesting all files with keep-alive off"
+    curl -s -S -w '%{num_connects}\n' ${outputs[@]} ${urls[@]} | awk '{ n += $1 } END { print "Connections opened: " n }'
+
+    echo "Sending SIGINT to trigger server shutdown"
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+
+    for target_file in ${target_files[@]}
+    do
+        diff -q server_files/$target_file downloaded_files/$target_file
+    done
+done
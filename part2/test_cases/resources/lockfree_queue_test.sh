@@ -0,0 +1,9 @@
+#! /bin/bash
+
+# Connections go through the lock-free queue, once with a two-slot queue
+# so the accept loop keeps waiting for room. Every file is fetched three
+# times at once and each body must match the file.
+source test_cases/resources/fetch_all.sh
+
+fetch_all -Q lockfree
+fetch_all -Q lockfree -q 2 -n 2
@@ -0,0 +1,19 @@
+#! /bin/bash
+
+echo "Starting HTTP Server with 2 workers copying file bodies"
+./http_server -n 2 -s copy -c 0 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+mkdir -p downloaded_files
+
+# each worker holds one arena chunk, and a copied body borrows its 64K
+# copy buffer from it for the length of the request
+curl -s -S -o downloaded_files/memory_pool_quote.txt http://localhost:$PORT/quote.txt
+cmp downloaded_files/memory_pool_quote.txt server_files/quote.txt && echo "quote.txt matches"
+curl -s -S http://localhost:$PORT/__stats | grep 'pool="arena"'
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
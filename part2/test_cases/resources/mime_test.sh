@@ -0,0 +1,27 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files/serve/v1.2
+for name in style.css logo.svg data.wasm notes.zzz README v1.2/CHANGES
+do
+    echo "$name" > downloaded_files/serve/$name
+done
+
+for options in "-E threads" "-E threads -c 0 -f 0" "-E epoll" "-E uring"
+do
+    echo "Starting HTTP Server with $options"
+    ./http_server $options downloaded_files/serve $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    # types come from the generated table, anything else is sent as bytes
+    for name in style.css logo.svg data.wasm notes.zzz README v1.2/CHANGES
+    do
+        curl -s -S -o downloaded_files/body -w "$name %{http_code} %{content_type}\n" http://localhost:$PORT/$name
+        echo "$name" | cmp - downloaded_files/body
+    done
+
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+done
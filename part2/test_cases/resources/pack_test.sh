@@ -0,0 +1,36 @@
+#! /bin/bash
+
+target_files=(
+    "quote.txt"
+    "index.html"
+    "gatsby.txt"
+    "africa.jpg"
+    "Lec01.pdf"
+)
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Packing server_files"
+./mkpack server_files downloaded_files/server_files.pack > /dev/null
+
+echo "Starting HTTP Server"
+./http_server downloaded_files/server_files.pack $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# Files come out of the pack byte for byte, and unknown paths are a 404
+for target_file in ${target_files[@]}
+do
+    curl -s -S -o downloaded_files/$target_file -w "$target_file: %{http_code}\n" http://localhost:$PORT/$target_file
+done
+curl -s -S -o /dev/null -w "missing.html: %{http_code}\n" http://localhost:$PORT/missing.html
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+for target_file in ${target_files[@]}
+do
+    cmp server_files/$target_file downloaded_files/$target_file
+done
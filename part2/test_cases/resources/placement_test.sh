@@ -0,0 +1,20 @@
+#! /bin/bash
+
+echo "Starting HTTP Server with 2 acceptor groups pinned to CPU 0"
+./http_server -v -a 2 -C 0 server_files $PORT 2> placement_test_stderr.txt &
+http_server_pid=$!
+sleep 0.5
+
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+grep '^group' placement_test_stderr.txt
+rm placement_test_stderr.txt
+
+echo "Starting HTTP Server with an invalid CPU list"
+./http_server -C 3-1 server_files $PORT > /dev/null 2>&1
+echo "Exit status $?"
@@ -0,0 +1,26 @@
+#! /bin/bash
+
+echo "Starting HTTP Server with 2 worker processes"
+./http_server -P 2 server_files $PORT 2> prefork_test_stderr.txt &
+http_server_pid=$!
+sleep 1.5
+
+echo "Worker processes: $(pgrep -P $http_server_pid | wc -l)"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+
+# A worker that crashes takes only itself down, the other keeps serving
+# and the supervisor starts a replacement
+echo "Killing one worker process"
+kill -KILL $(pgrep -P $http_server_pid | head -n 1)
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+sleep 0.5
+echo "Worker processes: $(pgrep -P $http_server_pid | wc -l)"
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+sed -E 's/[0-9]+ was/N was/' prefork_test_stderr.txt
+rm prefork_test_stderr.txt
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated with status $?"
+echo "Worker processes left: $(pgrep -P $http_server_pid | wc -l)"
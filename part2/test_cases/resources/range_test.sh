@@ -0,0 +1,36 @@
+#! /bin/bash
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+echo "Starting HTTP Server"
+./http_server server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+url="http://localhost:$PORT/Lec01.pdf"
+size=$(stat -c '%s' server_files/Lec01.pdf)
+
+echo "Requesting byte ranges of Lec01.pdf"
+curl -s -S -o downloaded_files/first -w '%{http_code}\n' -r 0-1023 $url
+curl -s -S -o downloaded_files/middle -w '%{http_code}\n' -r 500000-599999 $url
+curl -s -S -o downloaded_files/last -w '%{http_code}\n' -r -4096 $url
+curl -s -S -o /dev/null -w '%{http_code}\n' -r $size- $url
+curl -s -S -D downloaded_files/multi_header -o /dev/null -w '%{http_code}\n' -r 0-9,100-109 $url
+grep -c 'multipart/byteranges' downloaded_files/multi_header
+grep -c 'Vary' downloaded_files/multi_header
+
+# text has compressed representations, so its parts vary like its 200 does
+echo "Requesting byte ranges of gatsby.txt"
+curl -s -S -D downloaded_files/text_header -o /dev/null -w '%{http_code}\n' -r 0-99 http://localhost:$PORT/gatsby.txt
+grep 'Vary' downloaded_files/text_header | tr -d '\r'
+curl -s -S -D downloaded_files/text_multi_header -o /dev/null -w '%{http_code}\n' -r 0-9,100-109 http://localhost:$PORT/gatsby.txt
+grep 'Vary' downloaded_files/text_multi_header | tr -d '\r'
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
+
+head -c 1024 server_files/Lec01.pdf | cmp - downloaded_files/first
+head -c 600000 server_files/Lec01.pdf | tail -c 100000 | cmp - downloaded_files/middle
+tail -c 4096 server_files/Lec01.pdf | cmp - downloaded_files/last
@@ -0,0 +1,46 @@
+#! /bin/bash
+
+# Send raw bytes on a new connection and print the status line of each response
+request() {
+    exec 3<>/dev/tcp/localhost/$PORT
+    printf '%b' "$1" >&3
+    grep -a '^HTTP/' <&3 | tr -d '\r'
+    exec 3>&-
+}
+
+long_path=$(printf '%600s' '' | tr ' ' 'a')
+# exactly MAX_REQUEST_HEADER bytes without the blank line, nothing left unread
+long_header="GET /quote.txt HTTP/1.1\r\nX-Padding: $(printf '%8156s' '' | tr ' ' 'a')"
+
+for engine in threads epoll uring
+do
+    echo "Starting HTTP Server with the $engine engine"
+    ./http_server -E $engine server_files $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    echo "A request split across writes, then two pipelined ones"
+    exec 3<>/dev/tcp/localhost/$PORT
+    printf 'GET /quo' >&3
+    sleep 0.2
+    printf 'te.txt HTTP/1.1\r\nHo' >&3
+    sleep 0.2
+    printf 'st: localhost\r\n\r\n' >&3
+    sleep 0.2
+    printf 'GET /index.html HTTP/1.1\r\n\r\nGET /missing.txt HTTP/1.1\r\nConnection: close\r\n\r\n' >&3
+    grep -a '^HTTP/' <&3 | tr -d '\r'
+    exec 3>&-
+
+    echo "Malformed, not GET, too long, outside the directory"
+    request 'GARBAGE\r\n\r\n'
+    request 'POST /quote.txt HTTP/1.1\r\n\r\n'
+    request "GET /$long_path HTTP/1.1\r\n\r\n"
+    request "$long_header"
+    request 'GET /../server_files/quote.txt HTTP/1.1\r\n\r\n'
+    request 'GET /dir/../../server_files/quote.txt HTTP/1.1\r\n\r\n'
+    request 'GET quote.txt HTTP/1.1\r\n\r\n'
+
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+done
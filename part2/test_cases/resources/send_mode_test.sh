@@ -0,0 +1,30 @@
+#! /bin/bash
+
+# Bodies streamed from the file with each send mode, the caches off so
+# nothing is served from memory, must match what copy mode sends. Every file
+# is fetched three times at once, and a range of each once, and each body
+# must match the file.
+source test_cases/resources/fetch_all.sh
+
+for options in "-s copy -c 0" "-s sendfile -c 0" "-s splice -c 0" "-s splice -c 0 -f 0"
+do
+    start_server $options
+    curl_pids=( )
+    for target_file in ${target_files[@]}
+    do
+        curl -s -S -r 100-99999 -o downloaded_files/$target_file.range http://localhost:$PORT/$target_file &
+        curl_pids+=($!)
+    done
+    fetch_concurrently
+    for curl_pid in ${curl_pids[@]}
+    do
+        wait $curl_pid
+    done
+    stop_server
+
+    compare_downloads
+    for target_file in ${target_files[@]}
+    do
+        head -c 100000 server_files/$target_file | tail -c +101 | cmp - downloaded_files/$target_file.range
+    done
+done
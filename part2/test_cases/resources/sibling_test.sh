@@ -0,0 +1,49 @@
+#! /bin/bash
+
+# Precompressed siblings are found through the fd cache once per version of
+# the file; adding, replacing or removing one must still show up at once.
+# Each check prints the Content-Encoding and either "file" if the decoded
+# body is the file or the body itself if it came from the sibling.
+fetch() {
+    curl -s -S -H 'Accept-Encoding: gzip' -D downloaded_files/headers -o downloaded_files/body \
+         http://localhost:$PORT/gatsby.txt
+    encoding=$(tr -d '\r' < downloaded_files/headers | sed -n 's/^Content-Encoding: //p')
+    gzip -d -c downloaded_files/body > downloaded_files/decoded
+    if cmp -s downloaded_files/decoded downloaded_files/serve/gatsby.txt; then
+        echo "$encoding file"
+    else
+        echo "$encoding $(cat downloaded_files/decoded)"
+    fi
+}
+
+for options in "-E threads" "-E threads -f 0" "-E uring"
+do
+    rm -rf downloaded_files
+    mkdir -p downloaded_files/serve
+    cp server_files/gatsby.txt downloaded_files/serve/
+    echo "Starting HTTP Server with $options"
+    ./http_server $options downloaded_files/serve $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    fetch
+    echo "Adding gatsby.txt.gz"
+    echo "first sibling" | gzip > downloaded_files/serve/gatsby.txt.gz
+    sleep 0.2
+    fetch
+    fetch
+    echo "Replacing gatsby.txt.gz"
+    echo "second sibling" | gzip > downloaded_files/sibling.gz
+    mv downloaded_files/sibling.gz downloaded_files/serve/gatsby.txt.gz
+    sleep 0.2
+    fetch
+    echo "Removing gatsby.txt.gz"
+    rm downloaded_files/serve/gatsby.txt.gz
+    sleep 0.2
+    fetch
+
+    echo "Sending SIGINT to trigger server shutdown"
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+done
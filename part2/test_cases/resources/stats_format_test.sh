@@ -0,0 +1,62 @@
+#! /bin/bash
+
+# /__stats must be one "name{label="value"} number" line per metric with a
+# Content-Length that matches, and /__stats.json valid JSON with the same
+# counters. Values that depend on timing are left out, only the names and
+# the response counts are printed.
+check_headers() {
+    tr -d '\r' < $1 | grep '^Content-Type:'
+    length=$(tr -d '\r' < $1 | sed -n 's/^Content-Length: //p')
+    if [ "$length" == "$(wc -c < $2)" ]; then
+        echo "Content-Length matches"
+    else
+        echo "Content-Length $length, body $(wc -c < $2) bytes"
+    fi
+}
+text_format='^[a-z_]+(\{[a-z]+="[a-z0-9._]+"\})? [0-9]+$'
+
+rm -rf downloaded_files
+mkdir -p downloaded_files
+for options in "-E threads" "-E epoll" "-E uring"
+do
+    echo "Starting HTTP Server with $options"
+    ./http_server $options server_files $PORT &
+    http_server_pid=$!
+    sleep 0.5
+
+    curl -s -S -o /dev/null http://localhost:$PORT/quote.txt
+    curl -s -S -o /dev/null http://localhost:$PORT/quote.txt
+    curl -s -S -o /dev/null http://localhost:$PORT/missing.txt
+    curl -s -S -D downloaded_files/headers -o downloaded_files/stats http://localhost:$PORT/__stats
+    curl -s -S -D downloaded_files/json_headers -o downloaded_files/stats.json http://localhost:$PORT/__stats.json
+
+    check_headers downloaded_files/headers downloaded_files/stats
+    echo "Lines: $(wc -l < downloaded_files/stats)"
+    echo "Malformed lines: $(grep -c -v -E "$text_format" downloaded_files/stats)"
+    sed 's/ [0-9]*$//' downloaded_files/stats | tr '\n' ' '
+    echo
+    grep -E '^(requests_total|responses_total\{status="(200|404)"\}) ' downloaded_files/stats
+
+    check_headers downloaded_files/json_headers downloaded_files/stats.json
+    python3 - downloaded_files/stats.json downloaded_files/stats <<'PYTHON'
+import json, sys
+stats = json.load(open(sys.argv[1]))
+text = dict(line.rsplit(" ", 1) for line in open(sys.argv[2]).read().splitlines())
+def keys(value):
+    if not isinstance(value, dict):
+        return ""
+    return "{" + ",".join(key + keys(value[key]) for key in value) + "}"
+print("JSON keys: " + keys(stats))
+# the JSON was fetched after the text, which counts as one more 200
+agree = stats["responses"]["404"] == int(text['responses_total{status="404"}']) and \
+        stats["responses"]["200"] == int(text['responses_total{status="200"}']) + 1 and \
+        all(stats["caches"][cache][counter] >= int(text['cache_%s_total{cache="%s"}' % (counter, cache)])
+            for cache in ("file", "fd") for counter in ("hits", "misses", "evictions", "invalidations"))
+print("JSON agrees with text: %s" % agree)
+PYTHON
+
+    echo "Sending SIGINT to trigger server shutdown"
+    kill -INT $http_server_pid
+    wait $http_server_pid
+    echo "Server has terminated"
+done
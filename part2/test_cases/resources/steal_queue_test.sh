@@ -0,0 +1,12 @@
+#! /bin/bash
+
+# Connections go through the work-stealing deques, placed round robin and
+# on the least loaded worker, also with two-slot deques so workers steal and
+# the accept loop waits for room. Every file is fetched three times at once
+# and each body must match the file.
+source test_cases/resources/fetch_all.sh
+
+fetch_all -Q steal
+fetch_all -Q steal-least
+fetch_all -Q steal -q 2 -n 3
+fetch_all -Q steal-least -q 2 -n 3
@@ -0,0 +1,26 @@
+#! /bin/bash
+
+echo "Starting HTTP Server with a 1 second header deadline"
+./http_server -k 1 -H 1 server_files $PORT &
+http_server_pid=$!
+sleep 0.5
+
+# A client that starts a request and never finishes it must not keep its
+# worker, and one that sends nothing at all is let go once idle
+exec 3<>/dev/tcp/localhost/$PORT
+printf 'GET /quote.txt HTTP/1.1\r\nHost: localhost\r\n' >&3
+exec 4<>/dev/tcp/localhost/$PORT
+sleep 2
+echo "Reading from the stalled connections"
+cat <&3
+cat <&4
+exec 3>&-
+exec 4>&-
+
+curl -s -S -o /dev/null -w '%{http_code}\n' http://localhost:$PORT/quote.txt
+curl -s -S http://localhost:$PORT/__stats | grep timeouts_total
+
+echo "Sending SIGINT to trigger server shutdown"
+kill -INT $http_server_pid
+wait $http_server_pid
+echo "Server has terminated"
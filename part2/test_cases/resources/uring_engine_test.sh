@@ -0,0 +1,10 @@
+#! /bin/bash
+
+# Every connection is served by the io_uring engine, with and without the
+# caches and with two rings taking turns at the listening port. Every file is
+# fetched three times at once and each body must match the file.
+source test_cases/resources/fetch_all.sh
+
+fetch_all -E uring
+fetch_all -E uring -c 0 -f 0
+fetch_all -E uring -a 2
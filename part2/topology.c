@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+#define CPULIST_BUFSIZE 4096
+
+// Set once by topology_init before any threads start, read-only afterwards
+static int cpu_node[CPU_SETSIZE];   // node of each allowed CPU
+static int placement[CPU_SETSIZE];  // allowed CPUs in the order groups get them
+static int n_placed = 0;
+static cpu_set_t allowed_cpus;
+
+int topology_parse_cpulist(const char *list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return -1;
+        }
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+// Read the cpulist of every node into cpu_node. CPUs no node claims stay on
+// node 0.
+static void read_nodes(void) {
+    DIR *dir = opendir(NODE_DIR);
+    if (dir == NULL) {
+        return; // no NUMA support in the kernel, one node
+    }
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        int node;
+        char extra;
+        if (sscanf(dirent->d_name, "node%d%c", &node, &extra) != 1 || node < 0 || node >= TOPOLOGY_MAX_NODES) {
+            continue;
+        }
+        char path[sizeof(NODE_DIR) + sizeof(dirent->d_name) + 16];
+        snprintf(path, sizeof(path), "%s/%s/cpulist", NODE_DIR, dirent->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        char list[CPULIST_BUFSIZE];
+        cpu_set_t cpus;
+        // a node with memory but no CPUs has an empty list
+        if (fgets(list, sizeof(list), file) != NULL && topology_parse_cpulist(list, &cpus) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpus)) {
+                    cpu_node[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+int topology_init(const cpu_set_t *allowed) {
+    cpu_set_t online;
+    if (sched_getaffinity(0, sizeof(online), &online) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    if (allowed != NULL) {
+        CPU_AND(&allowed_cpus, &online, allowed);
+    } else {
+        allowed_cpus = online;
+    }
+    if (CPU_COUNT(&allowed_cpus) == 0) {
+        fprintf(stderr, "topology_init: none of the CPUs asked for are available\n");
+        return -1;
+    }
+    memset(cpu_node, 0, sizeof(cpu_node));
+    read_nodes();
+
+    // deal the CPUs out one node at a time: first CPU of each node, then
+    // the second of each, and so on
+    cpu_set_t left = allowed_cpus;
+    n_placed = 0;
+    while (CPU_COUNT(&left) > 0) {
+        int taken[TOPOLOGY_MAX_NODES] = {0};
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &left) && !taken[cpu_node[cpu]]) {
+                taken[cpu_node[cpu]] = 1;
+                placement[n_placed++] = cpu;
+                CPU_CLR(cpu, &left);
+            }
+        }
+    }
+    return 0;
+}
+
+int topology_group_cpu(int i) {
+    return placement[i % n_placed];
+}
+
+int topology_node_of(int cpu) {
+    return cpu_node[cpu];
+}
+
+int topology_n_nodes(void) {
+    int seen[TOPOLOGY_MAX_NODES] = {0};
+    int n_nodes = 0;
+    for (int i = 0; i < n_placed; i++) {
+        if (!seen[cpu_node[placement[i]]]) {
+            seen[cpu_node[placement[i]]] = 1;
+            n_nodes++;
+        }
+    }
+    return n_nodes;
+}
+
+void topology_node_cpus(int node, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    for (int i = 0; i < n_placed; i++) {
+        if (cpu_node[placement[i]] == node) {
+            CPU_SET(placement[i], cpus);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>
+
+#define TOPOLOGY_MAX_NODES 64
+
+// Which CPUs the server may run on and which NUMA node each belongs to,
+// read from /sys/devices/system/node without needing libnuma. A machine
+// without that directory is treated as a single node holding every CPU.
+//
+// Threads placed with this keep their memory local: a thread's stack and
+// the buffers it allocates and fills itself are first touched on the node
+// it is pinned to, so the kernel places their pages there.
+
+/*
+ * Parse a CPU list such as "0-3,8,10-11", the format of -C and of the
+ * cpulist files in sysfs
+ * cpus: Set to the CPUs listed
+ * Returns 0 on success or -1 if the list is malformed or names a CPU
+ * beyond CPU_SETSIZE
+ */
+int topology_parse_cpulist(const char *list, cpu_set_t *cpus);
+
+/*
+ * Read the machine's NUMA nodes and order the CPUs threads will be placed
+ * on. Must be called before any other topology function.
+ * allowed: CPUs to use, or NULL for every CPU the process may run on
+ * Returns 0 on success or -1 if none of the allowed CPUs are online
+ */
+int topology_init(const cpu_set_t *allowed);
+
+/*
+ * Returns the CPU for the i-th group of threads. Consecutive groups go to
+ * different nodes in turn, so a few groups already spread over every
+ * socket, and wrap around once every allowed CPU has a group.
+ */
+int topology_group_cpu(int i);
+
+/*
+ * Returns the NUMA node 'cpu' belongs to
+ */
+int topology_node_of(int cpu);
+
+/*
+ * Returns the number of NUMA nodes with at least one allowed CPU
+ */
+int topology_n_nodes(void);
+
+/*
+ * Set 'cpus' to the allowed CPUs on 'node'
+ */
+void topology_node_cpus(int node, cpu_set_t *cpus);
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,79 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+// A minimal io_uring wrapper over the raw system calls, so the server does
+// not depend on liburing. One thread owns a ring: it fills SQEs, submits
+// them in batches and reaps CQEs, all without locks.
+typedef struct {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;     // advanced by the kernel as it consumes SQEs
+    unsigned *sq_tail;     // advanced by us when publishing SQEs
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head;     // first SQE not yet handed to the kernel
+    unsigned sqe_tail;     // next SQE to fill
+    unsigned *cq_head;     // advanced by us as we consume CQEs
+    unsigned *cq_tail;     // advanced by the kernel
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;         // same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+/*
+ * Create a ring and map its queues.
+ * ring: Pointer to uring_t to be initialized
+ * entries: Submission queue size, a power of two
+ * Returns 0 on success or -1 on error (errno is ENOSYS or EPERM when the
+ * kernel has no io_uring or it is disabled)
+ */
+int uring_init(uring_t *ring, unsigned entries);
+
+/*
+ * Check that the kernel supports every opcode in 'ops'
+ * Returns 1 if it does, 0 otherwise
+ */
+int uring_supports(uring_t *ring, const int *ops, int n_ops);
+
+/*
+ * Get a zeroed SQE to fill in. It is submitted by the next uring_submit.
+ * Returns the SQE, or NULL if the submission queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*
+ * Returns the number of SQEs that can be filled before the next submit
+ */
+unsigned uring_sq_space(uring_t *ring);
+
+/*
+ * Submit every filled SQE and wait until at least 'wait_nr' completions are
+ * available, all in one io_uring_enter call.
+ * Returns the number of SQEs submitted, or -1 on error (EINTR if a signal
+ * arrived while waiting)
+ */
+int uring_submit(uring_t *ring, unsigned wait_nr);
+
+/*
+ * Returns the oldest unconsumed completion, or NULL if there is none
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+
+/*
+ * Mark the completion returned by uring_peek_cqe as consumed
+ */
+void uring_cqe_seen(uring_t *ring);
+
+/*
+ * Unmap the queues and close the ring, cancelling anything in flight
+ */
+void uring_free(uring_t *ring);
+
+#endif // URING_H
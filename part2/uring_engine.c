@@ -0,0 +1,925 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "access_log.h"
+#include "admission.h"
+#include "deadline.h"
+#include "file_cache.h"
+#include "http.h"
+#include "metrics.h"
+#include "slab.h"
+#include "uring.h"
+#include "uring_engine.h"
+
+#define URING_ENTRIES 256
+#define CHUNK_SIZE (64 * 1024) // file bytes read and sent per READ/SENDMSG pair
+#define HEADER_BUFSIZE 512
+#define PATH_BUFSIZE 512
+#define DEFAULT_MAX_FDS 65536
+#define CONNS_PER_BLOCK 16
+#define CHUNKS_PER_BLOCK 4
+#define ACCEPT_BACKOFF_MS 100 // pause after running out of descriptors
+
+// What a completion belongs to, kept in the upper half of user_data with the
+// connection's fd in the lower half
+#define OP_ACCEPT 1
+#define OP_RECV 2
+#define OP_TIMEOUT 3 // idle timeout linked to a RECV, only its RECV matters
+#define OP_READ 4
+#define OP_SEND 5
+#define OP_CANCEL 6  // cancelling the accept or an idle RECV when the drain begins
+#define OP_DRAIN 7   // timeout that ends the drain
+#define OP_GRACE 8   // timeout after which kept-alive connections are closed
+#define OP_RESUME 9  // timeout after which a paused accept is tried again
+
+// One client connection and the response it has in flight
+typedef struct {
+    int fd;
+    http_conn_t http;
+    http_request_t request;
+    int parsed;            // request is valid, 0 for a request that didn't parse
+    int served;
+    int keep_alive;
+    int status;
+    size_t bytes;          // response bytes, header included
+    long long start;       // when the request was parsed, for metrics and the log
+    char peer[INET6_ADDRSTRLEN];
+    char header[HEADER_BUFSIZE];
+    int header_pending;    // header goes out with the first file chunk
+    file_cache_entry_t *entry;
+    int file;              // -1 unless the body is read from disk
+    fd_cache_entry_t *opened; // holds 'file' open when it came from the fd cache
+    off_t file_offset;     // next file byte to read
+    size_t file_left;      // file bytes not yet read
+    size_t chunk_len;      // bytes the READ in flight was asked for
+    int read_failed;
+    char *chunk;           // CHUNK_SIZE bytes from the chunk pool, held only
+                           // while a response needs it
+    deadline_timer_t timer;
+    int header_started;    // the header deadline for this request is running
+    int receiving;         // a RECV is in flight
+    struct iovec iov[3];
+    struct msghdr msg;
+} uring_conn_t;
+
+typedef struct {
+    uring_t ring;
+    int listen_fd;
+    int multishot;         // the pending accept keeps producing connections
+    int accept_paused;     // out of descriptors, no accept until one is freed
+    const uring_engine_config_t *config;
+    const int *keep_going;
+    uring_conn_t **conns;  // indexed by fd
+    int max_fds;
+    slab_t conn_pool;      // uring_conn_t objects
+    slab_t chunk_pool;     // CHUNK_SIZE buffers
+    int n_conns;
+    int draining;          // stopped accepting, finishing what is in flight
+    int drain_expired;
+    struct __kernel_timespec idle_timeout;
+    struct __kernel_timespec drain_timeout;
+    struct __kernel_timespec grace_timeout;
+    struct __kernel_timespec accept_backoff;
+} uring_engine_t;
+
+static const int required_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_READ, IORING_OP_SENDMSG, IORING_OP_LINK_TIMEOUT,
+    IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+};
+
+static uint64_t make_data(int op, int fd) {
+    return ((uint64_t) op << 32) | (uint32_t) fd;
+}
+
+int uring_engine_supported(void) {
+    uring_t ring;
+    if (uring_init(&ring, 8) == -1) {
+        return 0;
+    }
+    int supported = uring_supports(&ring, required_ops, sizeof(required_ops) / sizeof(required_ops[0]));
+    uring_free(&ring);
+    return supported;
+}
+
+// Get 'n' SQEs in a row, flushing the queue first if they don't fit, so a
+// linked pair is never split across two submissions. Room for all 'n' is
+// checked up front, the caller takes the rest with uring_get_sqe, which
+// can't fail then.
+// Returns the first SQE, or NULL on error
+static struct io_uring_sqe *get_sqes(uring_engine_t *engine, unsigned n) {
+    if (uring_sq_space(&engine->ring) < n && uring_submit(&engine->ring, 0) == -1) {
+        perror("io_uring_enter");
+        return NULL;
+    }
+    // the kernel may have taken only part of the queue
+    if (uring_sq_space(&engine->ring) < n) {
+        fprintf(stderr, "uring_get_sqe: submission queue full\n");
+        return NULL;
+    }
+    return uring_get_sqe(&engine->ring);
+}
+
+static int submit_accept(uring_engine_t *engine) {
+    struct io_uring_sqe *sqe = get_sqes(engine, 1);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = engine->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (engine->multishot) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    sqe->user_data = make_data(OP_ACCEPT, engine->listen_fd);
+    return 0;
+}
+
+// Complete with 'op' after 'timeout'
+// Returns 0 on success or -1 on error
+static int submit_timeout(uring_engine_t *engine, struct __kernel_timespec *timeout, int op) {
+    struct io_uring_sqe *sqe = get_sqes(engine, 1);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) timeout;
+    sqe->len = 1;
+    sqe->user_data = make_data(op, 0);
+    return 0;
+}
+
+// Accept again after a pause, unless the server is stopping
+static void resume_accept(uring_engine_t *engine) {
+    if (engine->accept_paused && !engine->draining && *engine->keep_going) {
+        engine->accept_paused = 0;
+        submit_accept(engine);
+    }
+}
+
+// Let go of a file: back to the fd cache if it came from there, closed
+// otherwise
+static void put_file(int file, fd_cache_entry_t *opened) {
+    if (opened != NULL) {
+        fd_cache_release(opened);
+    } else if (file != -1) {
+        close(file);
+    }
+}
+
+// Publish the pools' sizes to the ring thread's metrics slot
+static void record_pools(uring_engine_t *engine) {
+    metrics_record_pool(METRICS_POOL_CONN, engine->conn_pool.stats.reserved,
+                        engine->conn_pool.stats.high_water * engine->conn_pool.object_size);
+    metrics_record_pool(METRICS_POOL_BUFFER, engine->chunk_pool.stats.reserved,
+                        engine->chunk_pool.stats.high_water * engine->chunk_pool.object_size);
+}
+
+// Give the chunk buffer back to the pool once a response is done with it
+static void release_chunk(uring_engine_t *engine, uring_conn_t *conn) {
+    if (conn->chunk != NULL) {
+        slab_free(&engine->chunk_pool, conn->chunk);
+        conn->chunk = NULL;
+    }
+}
+
+static void close_conn(uring_engine_t *engine, uring_conn_t *conn) {
+    if (conn->entry != NULL) {
+        file_cache_release(conn->entry);
+    }
+    put_file(conn->file, conn->opened);
+    deadline_disarm(&conn->timer);
+    if (close(conn->fd) == -1) {
+        perror("close");
+    }
+    engine->conns[conn->fd] = NULL;
+    engine->n_conns--;
+    release_chunk(engine, conn);
+    slab_free(&engine->conn_pool, conn);
+    admission_leave();
+    resume_accept(engine); // a descriptor was freed
+}
+
+// Receive more of the request header, giving up after the keep-alive timeout
+static void submit_recv(uring_engine_t *engine, uring_conn_t *conn) {
+    int timed = engine->config->keep_alive_timeout_ms > 0;
+    struct io_uring_sqe *sqe = get_sqes(engine, timed ? 2 : 1);
+    if (sqe == NULL) {
+        close_conn(engine, conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t) (conn->http.buf + conn->http.len);
+    sqe->len = MAX_REQUEST_HEADER - conn->http.len;
+    sqe->user_data = make_data(OP_RECV, conn->fd);
+    conn->receiving = 1;
+    if (timed) {
+        sqe->flags = IOSQE_IO_LINK;
+        struct io_uring_sqe *timeout = uring_get_sqe(&engine->ring);
+        timeout->opcode = IORING_OP_LINK_TIMEOUT;
+        timeout->fd = -1;
+        timeout->addr = (uintptr_t) &engine->idle_timeout;
+        timeout->len = 1;
+        timeout->user_data = make_data(OP_TIMEOUT, conn->fd);
+    }
+}
+
+// Send conn->iov[0..n_iov), optionally after a READ it is linked to
+static struct io_uring_sqe *fill_send(struct io_uring_sqe *sqe, uring_conn_t *conn, int n_iov) {
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = n_iov;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t) &conn->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = make_data(OP_SEND, conn->fd);
+    return sqe;
+}
+
+static void submit_send(uring_engine_t *engine, uring_conn_t *conn, int n_iov) {
+    struct io_uring_sqe *sqe = get_sqes(engine, 1);
+    if (sqe == NULL) {
+        close_conn(engine, conn);
+        return;
+    }
+    fill_send(sqe, conn, n_iov);
+}
+
+// Start a response whose bytes are all in conn->iov already
+static void start_send(uring_engine_t *engine, uring_conn_t *conn, int status, int n_iov) {
+    conn->status = status;
+    conn->bytes = 0;
+    for (int i = 0; i < n_iov; i++) {
+        conn->bytes += conn->iov[i].iov_len;
+    }
+    submit_send(engine, conn, n_iov);
+}
+
+static void send_error(uring_engine_t *engine, uring_conn_t *conn, int status, int keep_alive) {
+    conn->keep_alive = keep_alive;
+    int len = http_format_error(conn->header, sizeof(conn->header), status, keep_alive);
+    if (len == -1) {
+        close_conn(engine, conn);
+        return;
+    }
+    conn->iov[0].iov_base = conn->header;
+    conn->iov[0].iov_len = len;
+    start_send(engine, conn, status, 1);
+}
+
+static int ensure_chunk(uring_engine_t *engine, uring_conn_t *conn) {
+    if (conn->chunk == NULL) {
+        if ((conn->chunk = slab_alloc(&engine->chunk_pool)) == NULL) {
+            return -1;
+        }
+        record_pools(engine);
+    }
+    return 0;
+}
+
+static void send_metrics(uring_engine_t *engine, uring_conn_t *conn, int json) {
+    if (ensure_chunk(engine, conn) == -1) {
+        close_conn(engine, conn);
+        return;
+    }
+    int body_len = metrics_format(conn->chunk, CHUNK_SIZE, json);
+    if (body_len == -1) {
+        send_error(engine, conn, 500, conn->keep_alive);
+        return;
+    }
+    int header_len = snprintf(conn->header, sizeof(conn->header),
+                              "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n%s",
+                              json ? "application/json" : "text/plain", body_len,
+                              http_connection_line(conn->keep_alive));
+    conn->iov[0].iov_base = conn->header;
+    conn->iov[0].iov_len = header_len;
+    conn->iov[1].iov_base = conn->chunk;
+    conn->iov[1].iov_len = body_len;
+    start_send(engine, conn, 200, 2);
+}
+
+// Queue the next piece of an uncached file: a READ into the chunk buffer
+// linked to the SENDMSG that sends it, behind the header on the first piece
+static void send_next_chunk(uring_engine_t *engine, uring_conn_t *conn) {
+    size_t len = conn->file_left < CHUNK_SIZE ? conn->file_left : CHUNK_SIZE;
+    int n_iov = 0;
+    if (conn->header_pending) {
+        conn->iov[n_iov].iov_base = conn->header;
+        conn->iov[n_iov].iov_len = strlen(conn->header);
+        n_iov++;
+        conn->header_pending = 0;
+    }
+    if (len == 0) {
+        submit_send(engine, conn, n_iov); // empty file, header only
+        return;
+    }
+
+    struct io_uring_sqe *sqe = get_sqes(engine, 2);
+    if (sqe == NULL) {
+        close_conn(engine, conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = conn->file;
+    sqe->addr = (uintptr_t) conn->chunk;
+    sqe->len = len;
+    sqe->off = conn->file_offset;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = make_data(OP_READ, conn->fd);
+    conn->chunk_len = len;
+
+    conn->iov[n_iov].iov_base = conn->chunk;
+    conn->iov[n_iov].iov_len = len;
+    fill_send(uring_get_sqe(&engine->ring), conn, n_iov + 1);
+    conn->file_offset += len;
+    conn->file_left -= len;
+}
+
+// Answer with a 304 if 'not_modified', otherwise a 416
+static void send_bodyless(uring_engine_t *engine, uring_conn_t *conn, int not_modified, const struct stat *info) {
+    int len = not_modified
+                  ? http_format_not_modified(conn->header, sizeof(conn->header), info, conn->keep_alive)
+                  : http_format_range_not_satisfiable(conn->header, sizeof(conn->header), info->st_size,
+                                                      conn->keep_alive);
+    if (len == -1) {
+        close_conn(engine, conn);
+        return;
+    }
+    conn->iov[0].iov_base = conn->header;
+    conn->iov[0].iov_len = len;
+    start_send(engine, conn, not_modified ? 304 : 416, 1);
+}
+
+// Answer from the asset pack. Headers and bodies go out straight from the
+// mapping, so the send is the only operation a request needs.
+static void send_pack(uring_engine_t *engine, uring_conn_t *conn) {
+    const pack_t *pack = engine->config->pack;
+    const pack_entry_t *packed = pack_lookup(pack, conn->request.path.data, conn->request.path.len);
+    if (packed == NULL) {
+        send_error(engine, conn, 404, conn->keep_alive);
+        return;
+    }
+    struct stat info;
+    memset(&info, 0, sizeof(info));
+    info.st_ino = packed->ino;
+    info.st_size = packed->size;
+    info.st_mtim.tv_sec = packed->mtime_sec;
+    info.st_mtim.tv_nsec = packed->mtime_nsec;
+
+    http_range_t range;
+    int n_ranges = 0;
+    int not_modified = http_not_modified(&conn->request, &info);
+    if (!not_modified) {
+        n_ranges = http_parse_ranges(&conn->request, &info, &range, 1);
+    }
+    if (not_modified || n_ranges == -1) {
+        send_bodyless(engine, conn, not_modified, &info);
+        return;
+    }
+    if (n_ranges == 1) {
+        int header_len = http_format_range_header(conn->header, sizeof(conn->header), pack_data(pack, &packed->name),
+                                                  &info, &range, conn->keep_alive);
+        if (header_len == -1) {
+            close_conn(engine, conn);
+            return;
+        }
+        conn->iov[0].iov_base = conn->header;
+        conn->iov[0].iov_len = header_len;
+        conn->iov[1].iov_base = (void *) (pack_data(pack, &packed->body) + range.first);
+        conn->iov[1].iov_len = range.last - range.first + 1;
+        start_send(engine, conn, 206, 2);
+        return;
+    }
+
+    const pack_blob_t *header = &packed->header;
+    const pack_blob_t *body = &packed->body;
+    int candidates = 0;
+    for (int encoding = ENCODING_GZIP; encoding <= ENCODING_BR; encoding++) {
+        if (packed->encoded_body[encoding - 1].len > 0) {
+            candidates |= 1 << encoding;
+        }
+    }
+    int encoding = http_preferred_encoding(&conn->request, candidates);
+    if (encoding != ENCODING_IDENTITY) {
+        header = &packed->encoded_header[encoding - 1];
+        body = &packed->encoded_body[encoding - 1];
+    }
+    const char *connection = http_connection_line(conn->keep_alive);
+    conn->iov[0].iov_base = (void *) pack_data(pack, header);
+    conn->iov[0].iov_len = header->len;
+    conn->iov[1].iov_base = (void *) connection;
+    conn->iov[1].iov_len = strlen(connection);
+    conn->iov[2].iov_base = (void *) pack_data(pack, body);
+    conn->iov[2].iov_len = body->len;
+    start_send(engine, conn, 200, 3);
+}
+
+static void send_file(uring_engine_t *engine, uring_conn_t *conn, const char *resource_path) {
+    file_cache_entry_t *entry = NULL;
+    fd_cache_entry_t *opened = NULL;
+    int file = -1;
+    struct stat info;
+    if (engine->config->fds != NULL) {
+        if (fd_cache_get(engine->config->fds, resource_path, &opened) == -1) {
+            send_error(engine, conn, 404, conn->keep_alive);
+            return;
+        }
+        file = opened->fd;
+        info = opened->info;
+        if (engine->config->cache != NULL) {
+            entry = file_cache_get_open(engine->config->cache, resource_path, file, &info);
+        }
+    } else if (engine->config->cache != NULL) {
+        if (file_cache_get(engine->config->cache, resource_path, &entry, &file, &info) == -1) {
+            send_error(engine, conn, 404, conn->keep_alive);
+            return;
+        }
+    } else if ((file = open(resource_path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(file, &info) == -1) {
+        if (file != -1) {
+            close(file);
+        }
+        send_error(engine, conn, 404, conn->keep_alive);
+        return;
+    }
+
+    // Only single ranges are served here; asking for one range at most
+    // makes http_parse_ranges fall back to the whole file for several
+    http_range_t range;
+    int n_ranges = 0;
+    int not_modified = http_not_modified(&conn->request, &info);
+    if (!not_modified) {
+        n_ranges = http_parse_ranges(&conn->request, &info, &range, 1);
+    }
+    if (not_modified || n_ranges == -1) {
+        if (entry != NULL) {
+            file_cache_release(entry);
+        }
+        put_file(file, opened);
+        send_bodyless(engine, conn, not_modified, &info);
+        return;
+    }
+    off_t first = n_ranges == 1 ? range.first : 0;
+    size_t count = n_ranges == 1 ? (size_t) (range.last - range.first + 1) : (size_t) info.st_size;
+
+    // whole-file responses go out compressed if the client accepts a coding
+    // we have: a precompressed sibling streamed in place of the file, or the
+    // cache's compressed copy of the body
+    http_sibling_t sibling = {.fd = -1};
+    int encoding = ENCODING_IDENTITY;
+    const file_cache_variant_t *variant = NULL;
+    if (n_ranges == 0) {
+        encoding = http_negotiate_encoding(&conn->request, resource_path, &info, opened,
+                                           entry != NULL && entry->body != NULL, &sibling);
+    }
+    if (encoding != ENCODING_IDENTITY && sibling.fd == -1) {
+        variant = file_cache_get_variant(engine->config->cache, entry, encoding);
+        if (variant == NULL) {
+            encoding = ENCODING_IDENTITY;
+        }
+    } else if (encoding != ENCODING_IDENTITY) {
+        if (entry != NULL) {
+            file_cache_release(entry);
+            entry = NULL;
+        }
+        if (sibling.owned) {
+            put_file(file, opened);
+            opened = NULL;
+        }
+        // otherwise 'opened' stays referenced, it holds the sibling open
+        file = sibling.fd;
+        count = sibling.info.st_size;
+    }
+
+    const char *connection = http_connection_line(conn->keep_alive);
+    if (variant != NULL) {
+        put_file(file, opened);
+        conn->entry = entry; // the variant lives as long as the entry
+        conn->iov[0].iov_base = variant->header;
+        conn->iov[0].iov_len = variant->header_len;
+        conn->iov[1].iov_base = (void *) connection;
+        conn->iov[1].iov_len = strlen(connection);
+        conn->iov[2].iov_base = variant->body;
+        conn->iov[2].iov_len = variant->body_len;
+        start_send(engine, conn, 200, 3);
+        return;
+    }
+    if (entry != NULL && entry->body != NULL) {
+        put_file(file, opened);
+        conn->entry = entry;
+        if (n_ranges == 1) {
+            int header_len = http_format_range_header(conn->header, sizeof(conn->header), resource_path, &info,
+                                                      &range, conn->keep_alive);
+            if (header_len == -1) {
+                close_conn(engine, conn);
+                return;
+            }
+            conn->iov[0].iov_base = conn->header;
+            conn->iov[0].iov_len = header_len;
+            conn->iov[1].iov_base = entry->body + first;
+            conn->iov[1].iov_len = count;
+            start_send(engine, conn, 206, 2);
+            return;
+        }
+        conn->iov[0].iov_base = entry->header;
+        conn->iov[0].iov_len = entry->header_len;
+        conn->iov[1].iov_base = (void *) connection;
+        conn->iov[1].iov_len = strlen(connection);
+        conn->iov[2].iov_base = entry->body;
+        conn->iov[2].iov_len = entry->body_len;
+        start_send(engine, conn, 200, 3);
+        return;
+    }
+
+    conn->file = file;
+    conn->opened = opened;
+    int header_len;
+    if (n_ranges == 1) {
+        // the Connection line is part of a range header
+        header_len = http_format_range_header(conn->header, sizeof(conn->header), resource_path, &info, &range,
+                                              conn->keep_alive);
+        connection = "";
+    } else if (encoding != ENCODING_IDENTITY) {
+        header_len = http_format_encoded_header(conn->header, sizeof(conn->header), resource_path, &info, encoding,
+                                                count);
+    } else if (entry != NULL) {
+        // header-only entry, the body is read from the file
+        header_len = entry->header_len < sizeof(conn->header) ? (int) entry->header_len : -1;
+        if (header_len != -1) {
+            memcpy(conn->header, entry->header, header_len);
+        }
+    } else {
+        header_len = http_format_header(conn->header, sizeof(conn->header), resource_path, &info);
+    }
+    if (entry != NULL) {
+        file_cache_release(entry);
+    }
+    if (header_len == -1 || header_len + strlen(connection) >= sizeof(conn->header) || ensure_chunk(engine, conn) == -1) {
+        close_conn(engine, conn); // like write_http_response, drop the client
+        return;
+    }
+    strcpy(conn->header + header_len, connection);
+    conn->status = n_ranges == 1 ? 206 : 200;
+    conn->bytes = header_len + strlen(connection) + count;
+    conn->header_pending = 1;
+    conn->file_offset = first;
+    conn->file_left = count;
+    conn->read_failed = 0;
+    send_next_chunk(engine, conn);
+}
+
+// Answer the next buffered request, or receive more of it
+static void handle_request(uring_engine_t *engine, uring_conn_t *conn) {
+    long long start = metrics_now_us();
+    int result = http_parse_buffered(&conn->http, &conn->request);
+    if (result == HTTP_NEED_MORE) {
+        // once part of a request is in, the rest has to follow in time
+        if (conn->http.len > 0 && !conn->header_started) {
+            deadline_arm(&conn->timer, DEADLINE_HEADER);
+            conn->header_started = 1;
+        }
+        submit_recv(engine, conn);
+        return;
+    }
+    deadline_arm(&conn->timer, DEADLINE_SEND);
+    conn->header_started = 0;
+    metrics_record_parse(metrics_now_us() - start);
+    conn->start = start;
+    conn->parsed = result == 0;
+    if (result == HTTP_BAD_REQUEST || result == HTTP_HEADER_TOO_LARGE) {
+        // the rest of the stream can't be trusted, answer and hang up
+        send_error(engine, conn, result == HTTP_BAD_REQUEST ? 400 : 431, 0);
+        return;
+    }
+    if (!http_slice_equals(&conn->request.method, "GET")) {
+        send_error(engine, conn, 501, 0);
+        return;
+    }
+
+    conn->served++;
+    conn->keep_alive = conn->request.keep_alive;
+    if (conn->served >= engine->config->max_requests || engine->config->keep_alive_timeout_ms == 0 ||
+        *engine->keep_going == 0) {
+        conn->keep_alive = 0;
+    }
+
+    int metrics_json = http_slice_equals(&conn->request.path, METRICS_JSON_PATH);
+    if (metrics_json || http_slice_equals(&conn->request.path, METRICS_PATH)) {
+        send_metrics(engine, conn, metrics_json);
+        return;
+    }
+    if (engine->config->pack != NULL) {
+        send_pack(engine, conn);
+        return;
+    }
+    char resource_path[PATH_BUFSIZE];
+    int resolved = http_resolve_path(&conn->request, engine->config->serve_dir, resource_path, sizeof(resource_path));
+    if (resolved != 0) {
+        send_error(engine, conn, resolved == HTTP_BAD_REQUEST ? 400 : 414, 0);
+        return;
+    }
+    send_file(engine, conn, resource_path);
+}
+
+// Account for a fully sent response and move on to the next request
+static void finish_response(uring_engine_t *engine, uring_conn_t *conn) {
+    metrics_record_response(conn->status, conn->bytes);
+    access_log_request(conn->peer, conn->parsed ? &conn->request : NULL, conn->status, conn->bytes,
+                       metrics_now_us() - conn->start);
+    metrics_record_request(metrics_now_us() - conn->start);
+    if (conn->entry != NULL) {
+        file_cache_release(conn->entry);
+        conn->entry = NULL;
+    }
+    put_file(conn->file, conn->opened);
+    conn->file = -1;
+    conn->opened = NULL;
+    release_chunk(engine, conn);
+    deadline_disarm(&conn->timer);
+    if (!conn->keep_alive) {
+        close_conn(engine, conn);
+        return;
+    }
+    // a pipelined request may already be buffered
+    handle_request(engine, conn);
+}
+
+static void on_accept(uring_engine_t *engine, int result, unsigned flags) {
+    // every open connection is in flight here, there is no queue to wait in
+    if (result >= 0 && !admission_enter()) {
+        admission_shed(result, METRICS_SHED_INFLIGHT);
+    } else if (result >= 0) {
+        uring_conn_t *conn = result < engine->max_fds ? slab_alloc(&engine->conn_pool) : NULL;
+        if (conn == NULL) {
+            close(result);
+            admission_leave();
+        } else {
+            // only the fields before the receive buffer need clearing,
+            // http_conn_init empties it
+            memset(conn, 0, offsetof(uring_conn_t, http.buf));
+            memset(&conn->request, 0, sizeof(uring_conn_t) - offsetof(uring_conn_t, request));
+            record_pools(engine);
+            conn->fd = result;
+            conn->file = -1;
+            http_conn_init(&conn->http, result);
+            deadline_timer_init(&conn->timer, result);
+            strcpy(conn->peer, "-");
+            if (access_log_enabled()) {
+                struct sockaddr_storage addr;
+                socklen_t addr_len = sizeof(addr);
+                if (getpeername(result, (struct sockaddr *) &addr, &addr_len) == 0) {
+                    void *ip = addr.ss_family == AF_INET6 ? (void *) &((struct sockaddr_in6 *) &addr)->sin6_addr
+                                                          : (void *) &((struct sockaddr_in *) &addr)->sin_addr;
+                    inet_ntop(addr.ss_family, ip, conn->peer, sizeof(conn->peer));
+                }
+            }
+            engine->conns[result] = conn;
+            engine->n_conns++;
+            submit_recv(engine, conn);
+        }
+    } else if (result == -EINVAL && engine->multishot && *engine->keep_going) {
+        engine->multishot = 0; // kernel older than 5.19, accept one at a time
+    } else if ((result == -EMFILE || result == -ENFILE || result == -ENOBUFS || result == -ENOMEM) &&
+               *engine->keep_going) {
+        // accepting again would fail at once, wait for a connection to
+        // close or the backoff, whichever comes first
+        fprintf(stderr, "accept: %s\n", strerror(-result));
+        if (!(flags & IORING_CQE_F_MORE) && !engine->accept_paused) {
+            engine->accept_paused = 1;
+            if (submit_timeout(engine, &engine->accept_backoff, OP_RESUME) == -1) {
+                resume_accept(engine);
+            }
+        }
+        return;
+    } else if (*engine->keep_going) {
+        fprintf(stderr, "accept: %s\n", strerror(-result));
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && *engine->keep_going) {
+        submit_accept(engine);
+    }
+}
+
+static void on_recv(uring_engine_t *engine, uring_conn_t *conn, int result) {
+    conn->receiving = 0;
+    if (result <= 0) {
+        // hung up, failed, or cancelled by the idle timeout or the drain
+        if (result == -ECANCELED && !engine->draining) {
+            metrics_record_timeout(METRICS_TIMEOUT_IDLE);
+        }
+        close_conn(engine, conn);
+        return;
+    }
+    conn->http.len += result;
+    handle_request(engine, conn);
+}
+
+static void on_send(uring_engine_t *engine, uring_conn_t *conn, int result) {
+    if (result < 0 || conn->read_failed) {
+        close_conn(engine, conn);
+        return;
+    }
+    // skip what was sent and resend the rest
+    struct msghdr *msg = &conn->msg;
+    size_t sent = result;
+    while (msg->msg_iovlen > 0 && sent >= msg->msg_iov->iov_len) {
+        sent -= msg->msg_iov->iov_len;
+        msg->msg_iov++;
+        msg->msg_iovlen--;
+    }
+    if (msg->msg_iovlen > 0) {
+        msg->msg_iov->iov_base = (char *) msg->msg_iov->iov_base + sent;
+        msg->msg_iov->iov_len -= sent;
+        struct io_uring_sqe *sqe = get_sqes(engine, 1);
+        if (sqe == NULL) {
+            close_conn(engine, conn);
+            return;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (uintptr_t) msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = make_data(OP_SEND, conn->fd);
+        return;
+    }
+    if (conn->file_left > 0) {
+        send_next_chunk(engine, conn);
+        return;
+    }
+    finish_response(engine, conn);
+}
+
+static void on_read(uring_conn_t *conn, int result) {
+    // a failed or short read cancels the linked send, which then closes the
+    // connection; the body can't be completed either way
+    if (result < 0 || (size_t) result != conn->chunk_len) {
+        conn->read_failed = 1;
+    }
+}
+
+// Cancel the request whose user_data is 'target'
+static void submit_cancel(uring_engine_t *engine, uint64_t target) {
+    struct io_uring_sqe *sqe = get_sqes(engine, 1);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = make_data(OP_CANCEL, 0);
+}
+
+// Close the kept-alive connections waiting between requests
+static void cancel_idle(uring_engine_t *engine) {
+    for (int fd = 0; fd < engine->max_fds; fd++) {
+        uring_conn_t *conn = engine->conns[fd];
+        if (conn != NULL && conn->receiving && conn->served > 0 && conn->http.len == 0) {
+            submit_cancel(engine, make_data(OP_RECV, fd));
+        }
+    }
+}
+
+// The server is stopping: stop accepting and time the rest of the drain.
+// Responses in progress and clients still owed their first response carry
+// on, kept-alive clients between requests only get the grace period.
+static void begin_drain(uring_engine_t *engine) {
+    engine->draining = 1;
+    submit_cancel(engine, make_data(OP_ACCEPT, engine->listen_fd));
+    if (submit_timeout(engine, &engine->grace_timeout, OP_GRACE) == -1) {
+        cancel_idle(engine);
+    }
+    if (submit_timeout(engine, &engine->drain_timeout, OP_DRAIN) == -1) {
+        engine->drain_expired = 1;
+    }
+}
+
+int uring_engine_run(int listen_fd, const uring_engine_config_t *config, const int *keep_going) {
+    uring_engine_t engine;
+    memset(&engine, 0, sizeof(engine));
+    engine.listen_fd = listen_fd;
+    engine.multishot = 1;
+    engine.config = config;
+    engine.keep_going = keep_going;
+    engine.idle_timeout.tv_sec = config->keep_alive_timeout_ms / 1000;
+    engine.idle_timeout.tv_nsec = (config->keep_alive_timeout_ms % 1000) * 1000000L;
+    engine.drain_timeout.tv_sec = config->drain_ms / 1000;
+    engine.drain_timeout.tv_nsec = (config->drain_ms % 1000) * 1000000L;
+    engine.grace_timeout.tv_sec = config->drain_idle_grace_ms / 1000;
+    engine.grace_timeout.tv_nsec = (config->drain_idle_grace_ms % 1000) * 1000000L;
+    engine.accept_backoff.tv_nsec = ACCEPT_BACKOFF_MS * 1000000L;
+
+    struct rlimit limit;
+    engine.max_fds = DEFAULT_MAX_FDS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        engine.max_fds = limit.rlim_cur;
+    }
+    engine.conns = calloc(engine.max_fds, sizeof(uring_conn_t *));
+    if (engine.conns == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    slab_init(&engine.conn_pool, sizeof(uring_conn_t), CONNS_PER_BLOCK);
+    slab_init(&engine.chunk_pool, CHUNK_SIZE, CHUNKS_PER_BLOCK);
+    if (uring_init(&engine.ring, URING_ENTRIES) == -1) {
+        perror("io_uring_setup");
+        free(engine.conns);
+        return -1;
+    }
+
+    metrics_attach(config->slot_id);
+    access_log_attach(config->slot_id);
+
+    int ret_val = 0;
+    if (submit_accept(&engine) == -1) {
+        ret_val = -1;
+    }
+    while (ret_val == 0) {
+        if (*keep_going == 0 && !engine.draining) {
+            begin_drain(&engine);
+        }
+        if (engine.draining && (engine.n_conns == 0 || engine.drain_expired)) {
+            break;
+        }
+        // one system call submits everything queued while handling the last
+        // batch and waits for the next completion
+        if (uring_submit(&engine.ring, 1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("io_uring_enter");
+            ret_val = -1;
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&engine.ring)) != NULL) {
+            int op = cqe->user_data >> 32;
+            int fd = (int) (uint32_t) cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&engine.ring);
+
+            if (op == OP_ACCEPT) {
+                on_accept(&engine, result, flags);
+                continue;
+            }
+            if (op == OP_DRAIN) {
+                engine.drain_expired = 1;
+                continue;
+            }
+            if (op == OP_GRACE) {
+                cancel_idle(&engine);
+                continue;
+            }
+            if (op == OP_RESUME) {
+                resume_accept(&engine);
+                continue;
+            }
+            if (op == OP_CANCEL) {
+                continue;
+            }
+            uring_conn_t *conn = engine.conns[fd];
+            if (conn == NULL) {
+                continue;
+            }
+            if (op == OP_RECV) {
+                on_recv(&engine, conn, result);
+            } else if (op == OP_READ) {
+                on_read(conn, result);
+            } else if (op == OP_SEND) {
+                on_send(&engine, conn, result);
+            }
+        }
+    }
+
+    // closing the ring cancels whatever is still in flight, which the
+    // drain ran out of time for
+    uring_free(&engine.ring);
+    engine.accept_paused = 0; // nothing may be submitted any more
+    for (int fd = 0; fd < engine.max_fds; fd++) {
+        if (engine.conns[fd] != NULL) {
+            if (engine.draining) {
+                metrics_record_timeout(METRICS_TIMEOUT_DRAIN);
+            }
+            close_conn(&engine, engine.conns[fd]);
+        }
+    }
+    free(engine.conns);
+    record_pools(&engine);
+    slab_destroy(&engine.conn_pool);
+    slab_destroy(&engine.chunk_pool);
+    return ret_val;
+}
@@ -0,0 +1,40 @@
+#ifndef URING_ENGINE_H
+#define URING_ENGINE_H
+
+#include "fd_cache.h"
+#include "file_cache.h"
+#include "pack.h"
+
+// Settings the io_uring engine shares with the rest of the server
+typedef struct {
+    const char *serve_dir;
+    file_cache_t *cache;       // NULL to read every file from disk
+    fd_cache_t *fds;           // NULL to open every file per request
+    const pack_t *pack;        // serve from this asset pack instead of serve_dir
+    int keep_alive_timeout_ms; // 0 closes every connection after one response
+    int max_requests;          // per connection
+    int drain_ms;              // time connections get to finish once stopped
+    int drain_idle_grace_ms;   // of it, for kept-alive connections between requests
+    int slot_id;               // metrics and access log slot of the ring thread
+} uring_engine_config_t;
+
+/*
+ * Returns 1 if the kernel supports every io_uring operation the engine
+ * uses, 0 otherwise
+ */
+int uring_engine_supported(void);
+
+/*
+ * Serve connections from 'listen_fd' on the calling thread until *keep_going
+ * becomes 0. A single ring carries a multishot accept plus every client's
+ * receive, file read and send, so one thread keeps many requests in flight
+ * and makes one io_uring_enter call per batch of completions. Shutting the
+ * listening socket down or interrupting the thread with a signal wakes it up
+ * to check *keep_going. It then stops accepting and gives the connections
+ * it has up to config->drain_ms to finish before closing what is left,
+ * kept-alive ones between requests only config->drain_idle_grace_ms.
+ * Returns 0 on a clean stop or -1 on error
+ */
+int uring_engine_run(int listen_fd, const uring_engine_config_t *config, const int *keep_going);
+
+#endif // URING_ENGINE_H